@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+"""Boil run.sh's raw output down to one JSON file, and compare such files.
+
+  results.py summarize OUTDIR          results.json on stdout
+  results.py filesystems RESULTS       xiafs against the others in it
+  results.py compare [-t PCT] [--fail] BASE NEW
+                                       NEW against an earlier run
+
+Each test ends up with a few metrics, the median over the runs. Rates
+(iops, bw_kib) are better higher; times (*_ns, seconds) are better lower.
+"""
+
+import argparse
+import json
+import os
+import statistics
+import sys
+
+
+def fio_metrics(path):
+    with open(path) as f:
+        data = json.load(f)
+    job = data["jobs"][0]  # group_reporting makes it one
+    if job.get("error"):
+        return None
+    m = {}
+    # The filecreate/filestat/filedelete engines count their files under
+    # one direction or the other depending on the fio version; take the
+    # one that did something.
+    for ddir in ("read", "write"):
+        d = job.get(ddir)
+        if not d or not d.get("total_ios"):
+            continue
+        m["iops"] = m.get("iops", 0) + d["iops"]
+        m["bw_kib"] = m.get("bw_kib", 0) + d["bw"]
+        pct = d.get("clat_ns", {}).get("percentile", {})
+        for name, key in (("p50_ns", "50.000000"), ("p99_ns", "99.000000"),
+                          ("p99.9_ns", "99.900000")):
+            if key in pct:
+                m[name] = max(m.get(name, 0), pct[key])
+    if not m.get("bw_kib"):
+        m.pop("bw_kib", None)
+    return m or None
+
+
+def sec_metrics(path):
+    with open(path) as f:
+        return {"seconds": float(f.read())}
+
+
+def summarize(outdir):
+    meta_path = os.path.join(outdir, "meta.json")
+    meta = {}
+    if os.path.exists(meta_path):
+        with open(meta_path) as f:
+            meta = json.load(f)
+    results = {}
+    raw = os.path.join(outdir, "raw")
+    for fs in sorted(os.listdir(raw)):
+        for test in sorted(os.listdir(os.path.join(raw, fs))):
+            tdir = os.path.join(raw, fs, test)
+            runs = []
+            for name in sorted(os.listdir(tdir)):
+                path = os.path.join(tdir, name)
+                if name.endswith(".json"):
+                    m = fio_metrics(path)
+                elif name.endswith(".sec"):
+                    m = sec_metrics(path)
+                else:
+                    continue
+                if m:
+                    runs.append(m)
+            if not runs:
+                continue
+            keys = set().union(*runs)
+            res = {k: statistics.median(r[k] for r in runs if k in r)
+                   for k in sorted(keys)}
+            res["runs"] = len(runs)
+            results.setdefault(fs, {})[test] = res
+    return {"meta": meta, "results": results}
+
+
+def higher_is_better(metric):
+    return metric in ("iops", "bw_kib")
+
+
+def headline(res):
+    """The one metric to compare a test by."""
+    for k in ("iops", "seconds"):
+        if k in res:
+            return k
+    return None
+
+
+def num(v, width):
+    return "%*.*f" % (width, 3 if abs(v) < 100 else 1, v)
+
+
+def change(metric, old, new):
+    """Percent change, signed so that positive is always an improvement."""
+    if not old:
+        return 0.0
+    pct = (new - old) * 100.0 / old
+    return (pct if higher_is_better(metric) else -pct) + 0.0
+
+
+def cmd_summarize(args):
+    json.dump(summarize(args.outdir), sys.stdout, indent=2, sort_keys=True)
+    print()
+    return 0
+
+
+def cmd_filesystems(args):
+    with open(args.results) as f:
+        results = json.load(f)["results"]
+    base = results.get(args.fs)
+    others = [fs for fs in sorted(results) if fs != args.fs]
+    if not base or not others:
+        print("nothing to compare %s with" % args.fs)
+        return 0
+    print("%-28s %-8s %12s" % ("test", "metric", args.fs)
+          + "".join(" %18s" % fs for fs in others))
+    for test in sorted(base):
+        metric = headline(base[test])
+        if not metric:
+            continue
+        line = "%-28s %-8s %s" % (test, metric, num(base[test][metric], 12))
+        for fs in others:
+            r = results[fs].get(test)
+            if r and metric in r:
+                # how xiafs does relative to this one
+                line += " %s %+6.1f%%" % (num(r[metric], 10),
+                    -change(metric, base[test][metric], r[metric]) + 0.0)
+            else:
+                line += " %18s" % "-"
+        print(line)
+    return 0
+
+
+def cmd_compare(args):
+    with open(args.base) as f:
+        base = json.load(f)["results"]
+    with open(args.new) as f:
+        new = json.load(f)["results"]
+    worse = 0
+    print("%-8s %-28s %-8s %12s %12s %8s" %
+          ("fs", "test", "metric", "base", "new", "change"))
+    for fs in sorted(new):
+        for test in sorted(new[fs]):
+            old = base.get(fs, {}).get(test)
+            if not old:
+                continue
+            for metric in sorted(new[fs][test]):
+                if metric == "runs" or metric not in old:
+                    continue
+                pct = change(metric, old[metric], new[fs][test][metric])
+                flag = ""
+                if pct <= -args.threshold:
+                    flag = "worse"
+                    if metric == headline(new[fs][test]):
+                        worse += 1
+                elif pct >= args.threshold:
+                    flag = "better"
+                print("%-8s %-28s %-8s %s %s %+7.1f%% %s" %
+                      (fs, test, metric, num(old[metric], 12),
+                       num(new[fs][test][metric], 12), pct, flag))
+    if worse:
+        print("%d test(s) more than %g%% worse" % (worse, args.threshold))
+    return 1 if worse and args.fail else 0
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    sub = p.add_subparsers(dest="cmd", required=True)
+
+    s = sub.add_parser("summarize", help="make results.json from run.sh's output")
+    s.add_argument("outdir")
+    s.set_defaults(func=cmd_summarize)
+
+    s = sub.add_parser("filesystems", help="xiafs against minix and ext2")
+    s.add_argument("results")
+    s.add_argument("--fs", default="xiafs", help="the one to compare the rest with")
+    s.set_defaults(func=cmd_filesystems)
+
+    s = sub.add_parser("compare", help="a run against an earlier one")
+    s.add_argument("base")
+    s.add_argument("new")
+    s.add_argument("-t", "--threshold", type=float, default=5.0,
+                   help="percent change worth pointing out (default 5)")
+    s.add_argument("--fail", action="store_true",
+                   help="exit 1 if any test's headline metric got worse "
+                        "by more than the threshold")
+    s.set_defaults(func=cmd_compare)
+
+    args = p.parse_args()
+    return args.func(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,277 @@
+#!/bin/bash
+#
+# Run the benchmark matrix on xiafs, and the same on minix and ext2 to
+# judge it against, each on a freshly made loop-mounted image. See
+# README.md in this directory.
+
+set -eu
+
+usage() {
+	cat >&2 <<EOF
+usage: $0 [-q] [-f fs]... [-j max_jobs] [-r reps] [-s image_mb]
+          [-t tarball] [-w workdir] [-o outdir] [-b baseline.json]
+  -q  quick: one job, one run of each, smaller files
+  -f  file systems to run on (xiafs, minix, ext2; default all three)
+  -j  most fio jobs at once; runs 1, 2, 4... up to it (default: cpus, <= 8)
+  -r  runs of each test; results are the median (default 3)
+  -s  size of each image in MB (default 1024)
+  -t  tarball to untar and rm -rf (default: a generated tree)
+  -w  where the images and mount point go (default /var/tmp/xiafs-bench)
+  -o  where results go (default bench/results/<date>)
+  -b  compare the results against this earlier results.json
+EOF
+	exit 1
+}
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+TOP=$(dirname "$BENCH")
+
+FSLIST=""
+MAXJOBS=$(nproc)
+[ "$MAXJOBS" -gt 8 ] && MAXJOBS=8
+REPS=3
+IMAGE_MB=1024
+TARBALL=""
+WORK=/var/tmp/xiafs-bench
+OUT=""
+BASELINE=""
+QUICK=0
+
+while getopts "qf:j:r:s:t:w:o:b:" opt; do
+	case $opt in
+	q) QUICK=1 ;;
+	f) FSLIST="$FSLIST $OPTARG" ;;
+	j) MAXJOBS=$OPTARG ;;
+	r) REPS=$OPTARG ;;
+	s) IMAGE_MB=$OPTARG ;;
+	t) TARBALL=$OPTARG ;;
+	w) WORK=$OPTARG ;;
+	o) OUT=$OPTARG ;;
+	b) BASELINE=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+[ $OPTIND -gt $# ] || usage
+FSLIST=${FSLIST:-xiafs minix ext2}
+OUT=${OUT:-$BENCH/results/$(date +%Y%m%d-%H%M%S)}
+
+# Per job; xiafs files can't be any bigger than 64MB.
+FILESIZE=48M
+SMALLFILES=2000
+BIGDIR_FILES=20000
+RUNTIME=60
+if [ $QUICK = 1 ]; then
+	MAXJOBS=1
+	REPS=1
+	FILESIZE=16M
+	SMALLFILES=500
+	BIGDIR_FILES=5000
+fi
+
+JOBS=""
+for ((j = 1; j <= MAXJOBS; j *= 2)); do
+	JOBS="$JOBS $j"
+done
+
+MKXFS=${MKXFS:-$TOP/programs/mkxfs}
+IMAGE=$WORK/image
+MNT=$WORK/mnt
+LOOP=""
+
+die() {
+	echo "$0: $*" >&2
+	exit 1
+}
+
+log() {
+	echo "[$(date +%H:%M:%S)] $*" >&2
+}
+
+[ "$(id -u)" = 0 ] || die "must be run as root"
+for tool in fio python3 losetup mkfs.minix mkfs.ext2; do
+	command -v $tool >/dev/null || die "$tool is needed"
+done
+fio --enghelp 2>/dev/null | grep -qw filedelete ||
+	die "fio is too old: the filecreate/filestat/filedelete engines are needed"
+[ -x "$MKXFS" ] || make -C "$TOP/programs" mkxfs >/dev/null ||
+	die "can't build mkxfs"
+if ! grep -qw xiafs /proc/filesystems; then
+	case " $FSLIST " in
+	*" xiafs "*)
+		insmod "$TOP/module/xiafs.ko" ||
+			die "build the module first, see the top level README"
+		;;
+	esac
+fi
+
+cleanup() {
+	mountpoint -q "$MNT" && umount "$MNT"
+	[ -n "$LOOP" ] && losetup -d "$LOOP"
+	LOOP=""
+}
+trap cleanup EXIT
+
+mkdir -p "$WORK" "$MNT" "$OUT/raw"
+
+drop_caches() {
+	sync
+	echo 3 > /proc/sys/vm/drop_caches
+}
+
+# A fresh file system for every test, so nothing depends on what ran
+# before it. Loop with direct I/O so the backing file's page cache
+# doesn't flatter anyone.
+fresh_fs() {
+	local fs=$1
+
+	cleanup
+	rm -f "$IMAGE"
+	truncate -s ${IMAGE_MB}M "$IMAGE"
+	LOOP=$(losetup --direct-io=on -f --show "$IMAGE")
+	case $fs in
+	xiafs) "$MKXFS" ${XIAFS_MKFS_OPTS:-} "$LOOP" $((IMAGE_MB * 1024)) \
+		>/dev/null ;;
+	minix) mkfs.minix -3 "$LOOP" >/dev/null ;;
+	ext2)  mkfs.ext2 -q -F -b 1024 "$LOOP" ;;
+	*)     die "don't know how to make $fs" ;;
+	esac
+	mount -t $fs "$LOOP" "$MNT"
+	mkdir "$MNT/bench"
+}
+
+# run_fio <fs> <test> <rep> <job file> [VAR=value]...
+run_fio() {
+	local fs=$1 test=$2 rep=$3 job=$4 out
+
+	shift 4
+	out=$OUT/raw/$fs/$test
+	mkdir -p "$out"
+	if ! env BENCH_DIR="$MNT/bench" "$@" fio --output-format=json \
+			--output="$out/$rep.json" "$BENCH/fio/$job"; then
+		log "$fs $test failed"
+		rm -f "$out/$rep.json"
+	fi
+}
+
+# time_cmd <fs> <test> <rep> <command>...: seconds, sync included
+time_cmd() {
+	local fs=$1 test=$2 rep=$3 start end
+
+	shift 3
+	mkdir -p "$OUT/raw/$fs/$test"
+	start=$(date +%s%N)
+	if "$@" && sync; then
+		end=$(date +%s%N)
+		awk "BEGIN { printf \"%.3f\\n\", ($end - $start) / 1e9 }" \
+			> "$OUT/raw/$fs/$test/$rep.sec"
+	else
+		log "$fs $test failed"
+	fi
+}
+
+# The same tree every time: 64 directories of 64 files from 100 bytes to
+# about 32K, sizes from a fixed sequence.
+make_tree() {
+	local tree=$WORK/tree d f size=12345
+
+	rm -rf "$tree"
+	for ((d = 0; d < 64; d++)); do
+		mkdir -p "$tree/src/dir$d"
+		for ((f = 0; f < 64; f++)); do
+			size=$(((size * 1103515245 + 12345) % 2147483648))
+			head -c $((100 + size % 32668)) /dev/zero \
+				> "$tree/src/dir$d/file$f.c"
+		done
+	done
+	tar -C "$tree" -cf "$WORK/tree.tar" src
+	rm -rf "$tree"
+}
+
+bench_rw() {
+	local fs=$1 rep=$2 rw bs direct mode j
+
+	for rw in read write randread randwrite; do
+		case $rw in
+		rand*) bs=4k ;;
+		*)     bs=128k ;;
+		esac
+		for direct in 0 1; do
+			[ $direct = 1 ] && mode=direct || mode=buffered
+			for j in $JOBS; do
+				fresh_fs $fs
+				drop_caches
+				run_fio $fs $rw-$mode-j$j $rep rw.fio \
+					RW=$rw BS=$bs DIRECT=$direct NUMJOBS=$j \
+					FILESIZE=$FILESIZE RUNTIME=$RUNTIME
+			done
+		done
+	done
+}
+
+# create, then stat with cold caches, then unlink
+bench_files() {
+	local fs=$1 rep=$2 name=$3 jobs=$4 nrfiles=$5 phase engine
+
+	fresh_fs $fs
+	for phase in create stat unlink; do
+		case $phase in
+		create) engine=filecreate ;;
+		stat)   engine=filestat ;;
+		unlink) engine=filedelete ;;
+		esac
+		drop_caches
+		run_fio $fs $name-$phase $rep files.fio ENGINE=$engine \
+			NUMJOBS=$jobs NRFILES=$nrfiles
+	done
+}
+
+bench_tree() {
+	local fs=$1 rep=$2
+
+	fresh_fs $fs
+	drop_caches
+	time_cmd $fs untar $rep tar -C "$MNT/bench" -xf "$TARBALL"
+	drop_caches
+	time_cmd $fs rm-rf $rep rm -rf "$MNT/bench"
+}
+
+if [ -z "$TARBALL" ]; then
+	TARBALL=$WORK/tree.tar
+	[ -f "$TARBALL" ] || make_tree
+fi
+
+cat > "$OUT/meta.json" <<EOF
+{
+  "date": "$(date -Iseconds)",
+  "host": "$(uname -n)",
+  "kernel": "$(uname -r)",
+  "commit": "$(git -C "$TOP" rev-parse --short HEAD 2>/dev/null || echo unknown)",
+  "cpus": $(nproc),
+  "image_mb": $IMAGE_MB,
+  "reps": $REPS,
+  "jobs": "$(echo $JOBS)",
+  "filesize": "$FILESIZE",
+  "tarball": "$(basename "$TARBALL")",
+  "xiafs_mkfs_opts": "${XIAFS_MKFS_OPTS:-}"
+}
+EOF
+
+for fs in $FSLIST; do
+	for ((rep = 1; rep <= REPS; rep++)); do
+		log "$fs: run $rep of $REPS"
+		bench_rw $fs $rep
+		for j in $JOBS; do
+			bench_files $fs $rep smallfile-j$j $j $SMALLFILES
+		done
+		bench_files $fs $rep bigdir 1 $BIGDIR_FILES
+		bench_tree $fs $rep
+	done
+done
+cleanup
+
+python3 "$BENCH/results.py" summarize "$OUT" > "$OUT/results.json"
+log "results in $OUT/results.json"
+python3 "$BENCH/results.py" filesystems "$OUT/results.json"
+if [ -n "$BASELINE" ]; then
+	python3 "$BENCH/results.py" compare "$BASELINE" "$OUT/results.json"
+fi
@@ -23,7 +23,9 @@
 
 #include "xiafs.h"
 #include "bitmap.h"
+#include "trace/events/xiafs.h"
 #include <linux/fs.h>
+#include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/bitops.h>
 #include <linux/sched.h>
@@ -51,34 +53,47 @@ static unsigned long count_used(struct buffer_head *map[], unsigned numblocks, _
 	return(sum);
 }
 
-void xiafs_free_block(struct inode *inode, unsigned long block)
+/*
+ * Clear a zone's bit in the zmap. Returns false if the zone isn't in the
+ * data area at all.
+ */
+bool xiafs_free_zone(struct super_block *sb, unsigned long block)
 {
-	struct super_block *sb = inode->i_sb;
 	struct xiafs_sb_info *sbi = xiafs_sb(sb);
 	struct buffer_head *bh;
-	int k = sb->s_blocksize_bits + 3;
+	int k = XIAFS_BITS_PER_Z_BITS(sbi);
 	unsigned long bit, zone;
+	u64 locked;
 
 	if (block < sbi->s_firstdatazone || block >= sbi->s_nzones) {
 		printk("Trying to free block not in datazone\n");
-		return;
+		return false;
 	}
 	zone = block - sbi->s_firstdatazone + 1;
 	bit = zone & ((1<<k) - 1);
 	zone >>= k;
 	if (zone >= sbi->s_zmap_zones) {
 		printk("xiafs_free_block: nonexistent bitmap buffer\n");
-		return;
+		return false;
 	}
 	bh = sbi->s_zmap_buf[zone];
-	spin_lock(&bitmap_lock);
+	locked = xiafs_spin_lock(&bitmap_lock, XIAFS_LOCK_FREE_BLOCK);
 	if (!xiafs_test_and_clear_bit(bit, bh->b_data))
 		printk("xiafs_free_block (%s:%lu): bit already cleared\n",
 		       sb->s_id, block);
-	inode->i_blocks -= 2 << XIAFS_ZSHIFT(sbi);
-	spin_unlock(&bitmap_lock);
+	xiafs_spin_unlock(&bitmap_lock, XIAFS_LOCK_FREE_BLOCK, locked);
 	mark_buffer_dirty(bh);
-	return;
+	xiafs_stat_inc(sb, XIAFS_STAT_BLOCKS_FREED);
+	return true;
+}
+
+void xiafs_free_block(struct inode *inode, unsigned long block)
+{
+	if (!xiafs_free_zone(inode->i_sb, block))
+		return;
+	trace_xiafs_free_block(inode->i_sb, inode->i_ino, block);
+	inode->i_blocks -= 2 << XIAFS_ZSHIFT(xiafs_sb(inode->i_sb));
+	xiafs_layout_changed(inode);
 }
 
 int xiafs_new_block(struct inode * inode)
@@ -87,24 +102,41 @@ int xiafs_new_block(struct inode * inode)
 	int bits_per_zone = XIAFS_BITS_PER_Z(sbi);
 	int i;
 
+retry:
 	for (i = 0; i < sbi->s_zmap_zones; i++) {
 		struct buffer_head *bh = sbi->s_zmap_buf[i];
+		u64 locked;
 		int j;
 
-		spin_lock(&bitmap_lock);
+		locked = xiafs_spin_lock(&bitmap_lock, XIAFS_LOCK_NEW_BLOCK);
 		j = xiafs_find_first_zero_bit(bh->b_data, bits_per_zone);
 		if (j < bits_per_zone) {
 			xiafs_set_bit(j, bh->b_data);
-			spin_unlock(&bitmap_lock);
+			xiafs_spin_unlock(&bitmap_lock, XIAFS_LOCK_NEW_BLOCK,
+					  locked);
 			mark_buffer_dirty(bh);
 			j += i * bits_per_zone + sbi->s_firstdatazone-1;
 			if (j < sbi->s_firstdatazone || j >= sbi->s_nzones)
 				break;
 			inode->i_blocks += 2 << XIAFS_ZSHIFT(sbi);
+			xiafs_layout_changed(inode);
+			trace_xiafs_new_block(inode, j,
+				j - sbi->s_firstdatazone + 2);
+			xiafs_stat_inc(inode->i_sb, XIAFS_STAT_BLOCKS_ALLOC);
+			xiafs_stat_add(inode->i_sb, XIAFS_STAT_ZMAP_SCANNED,
+				(j - sbi->s_firstdatazone + 2 + 7) / 8);
 			return j;
 		}
-		spin_unlock(&bitmap_lock);
+		xiafs_spin_unlock(&bitmap_lock, XIAFS_LOCK_NEW_BLOCK, locked);
 	}
+	/* Full, but maybe not once deleted files are out of the way. */
+	if (atomic_long_read(&sbi->s_free_pending) &&
+	    xiafs_flush_orphans(inode->i_sb))
+		goto retry;
+	trace_xiafs_new_block(inode, 0,
+		(unsigned long)sbi->s_zmap_zones * bits_per_zone);
+	xiafs_stat_add(inode->i_sb, XIAFS_STAT_ZMAP_SCANNED,
+		(u64)sbi->s_zmap_zones * bits_per_zone / 8);
 	return 0;
 }
 
@@ -128,16 +160,86 @@ xiafs_raw_inode(struct super_block *sb, ino_t ino, struct buffer_head **bh)
 		       sb->s_id, (long)ino);
 		return NULL;
 	}
-	ino--;
-	block = 1 + sbi->s_imap_zones + sbi->s_zmap_zones +
-		 ino / xiafs_inodes_per_block;
+	block = xiafs_inode_block(sbi, ino);
 	*bh = sb_bread(sb, block);
 	if (!*bh) {
 		printk("Unable to read inode block\n");
 		return NULL;
 	}
 	p = (void *)(*bh)->b_data;
-	return p + ino % xiafs_inodes_per_block;
+	return p + (ino - 1) % xiafs_inodes_per_block;
+}
+
+/* The inode table block holding inode `ino'. */
+sector_t xiafs_inode_block(struct xiafs_sb_info *sbi, ino_t ino)
+{
+	return 1 + sbi->s_imap_zones + sbi->s_zmap_zones +
+		(ino - 1) / _XIAFS_INODES_PER_BLOCK;
+}
+
+/*
+ * Called by iget when it has to go to the inode table. If this miss is in
+ * the same inode table block as the last one or a little past it, whoever
+ * is asking is walking the inodes more or less in order (find, du, tar
+ * and friends do), so start reads on the next s_inode_ra blocks of the
+ * table instead of waiting on each one as we get to it. Anything else is
+ * left alone. The hints aren't locked; a race just costs a readahead.
+ */
+void xiafs_inode_readahead(struct super_block *sb, ino_t ino)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	sector_t block, prev, start, end, ra_end, b;
+	struct blk_plug plug;
+
+	if (!sbi->s_inode_ra || !ino || ino > sbi->s_ninodes)
+		return;
+
+	block = xiafs_inode_block(sbi, ino);
+	prev = READ_ONCE(sbi->s_inode_ra_last);
+	WRITE_ONCE(sbi->s_inode_ra_last, block);
+	if (block < prev || block > prev + sbi->s_inode_ra)
+		return;
+
+	start = block + 1;
+	end = min_t(sector_t, start + sbi->s_inode_ra,
+		    xiafs_inode_block(sbi, sbi->s_ninodes) + 1);
+	/* Don't ask for what the last call already asked for. */
+	ra_end = READ_ONCE(sbi->s_inode_ra_end);
+	if (ra_end > start && ra_end <= end)
+		start = ra_end;
+	if (start >= end)
+		return;
+
+	blk_start_plug(&plug);
+	for (b = start; b < end; b++)
+		sb_breadahead(sb, b);
+	blk_finish_plug(&plug);
+	WRITE_ONCE(sbi->s_inode_ra_end, end);
+}
+
+/*
+ * The first allocated inode at or after `ino', or 0 if there are no more.
+ * This doesn't take bitmap_lock; it's for scans that only want a snapshot
+ * of the imap.
+ */
+unsigned long xiafs_next_inode(struct super_block *sb, unsigned long ino)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	int k = XIAFS_BITS_PER_Z_BITS(sbi);
+	unsigned long i, bit;
+
+	if (ino > sbi->s_ninodes)
+		return 0;
+	i = ino >> k;
+	bit = ino & ((1<<k) - 1);
+	for (; i < sbi->s_imap_zones; i++, bit = 0) {
+		bit = xiafs_find_next_bit(sbi->s_imap_buf[i]->b_data, 1<<k, bit);
+		if (bit < (1<<k)) {
+			ino = (i << k) + bit;
+			return ino <= sbi->s_ninodes ? ino : 0;
+		}
+	}
+	return 0;
 }
 
 /* Clear the link count and mode of a deleted inode on disk. */
@@ -163,8 +265,9 @@ void xiafs_free_inode(struct inode * inode)
 	struct super_block *sb = inode->i_sb;
 	struct xiafs_sb_info *sbi = xiafs_sb(inode->i_sb);
 	struct buffer_head *bh;
-	int k = sb->s_blocksize_bits + 3;
+	int k = XIAFS_BITS_PER_Z_BITS(sbi);
 	unsigned long ino, bit;
+	u64 locked;
 
 	ino = inode->i_ino;
 	if (ino < 1 || ino > sbi->s_ninodes) {
@@ -181,11 +284,13 @@ void xiafs_free_inode(struct inode * inode)
 	xiafs_clear_inode(inode);	/* clear on-disk copy */
 
 	bh = sbi->s_imap_buf[ino];
-	spin_lock(&bitmap_lock);
+	locked = xiafs_spin_lock(&bitmap_lock, XIAFS_LOCK_FREE_INODE);
 	if (!xiafs_test_and_clear_bit(bit, bh->b_data))
 		printk("xiafs_free_inode: bit %lu already cleared\n", bit);
-	spin_unlock(&bitmap_lock);
+	xiafs_spin_unlock(&bitmap_lock, XIAFS_LOCK_FREE_INODE, locked);
 	mark_buffer_dirty(bh);
+	trace_xiafs_free_inode(inode);
+	xiafs_stat_inc(sb, XIAFS_STAT_INODES_FREED);
 }
 
 struct inode * xiafs_new_inode(const struct inode * dir, umode_t mode, int * error)
@@ -194,8 +299,9 @@ struct inode * xiafs_new_inode(const struct inode * dir, umode_t mode, int * err
 	struct xiafs_sb_info *sbi = xiafs_sb(sb);
 	struct inode *inode = new_inode(sb);
 	struct buffer_head * bh;
-	int bits_per_zone = 8 * sb->s_blocksize;
+	int bits_per_zone = XIAFS_BITS_PER_Z(sbi);
 	unsigned long j;
+	u64 locked;
 	int i;
 
 	if (!inode) {
@@ -205,7 +311,7 @@ struct inode * xiafs_new_inode(const struct inode * dir, umode_t mode, int * err
 	j = bits_per_zone;
 	bh = NULL;
 	*error = -ENOSPC;
-	spin_lock(&bitmap_lock);
+	locked = xiafs_spin_lock(&bitmap_lock, XIAFS_LOCK_NEW_INODE);
 	for (i = 0; i < sbi->s_imap_zones; i++) {
 		bh = sbi->s_imap_buf[i];
 		j = xiafs_find_first_zero_bit(bh->b_data, bits_per_zone);
@@ -213,17 +319,19 @@ struct inode * xiafs_new_inode(const struct inode * dir, umode_t mode, int * err
 			break;
 	}
 	if (!bh || j >= bits_per_zone) {
-		spin_unlock(&bitmap_lock);
+		xiafs_spin_unlock(&bitmap_lock, XIAFS_LOCK_NEW_INODE, locked);
 		iput(inode);
 		return NULL;
 	}
+	xiafs_stat_add(sb, XIAFS_STAT_IMAP_SCANNED,
+		((u64)i * bits_per_zone + j + 8) / 8);
 	if (xiafs_test_and_set_bit(j, bh->b_data)) {	/* shouldn't happen */
-		spin_unlock(&bitmap_lock);
+		xiafs_spin_unlock(&bitmap_lock, XIAFS_LOCK_NEW_INODE, locked);
 		printk("xiafs_new_inode: bit already set\n");
 		iput(inode);
 		return NULL;
 	}
-	spin_unlock(&bitmap_lock);
+	xiafs_spin_unlock(&bitmap_lock, XIAFS_LOCK_NEW_INODE, locked);
 	mark_buffer_dirty(bh);
 	j += i * bits_per_zone;
 	if (!j || j > sbi->s_ninodes) {
@@ -238,6 +346,8 @@ struct inode * xiafs_new_inode(const struct inode * dir, umode_t mode, int * err
 	memset(&xiafs_i(inode)->i_zone, 0, sizeof(xiafs_i(inode)->i_zone));
 	insert_inode_hash(inode);
 	mark_inode_dirty(inode);
+	trace_xiafs_new_inode(dir, inode);
+	xiafs_stat_inc(sb, XIAFS_STAT_INODES_ALLOC);
 
 	*error = 0;
 	return inode;
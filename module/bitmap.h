@@ -16,3 +16,5 @@
 #define xiafs_test_and_clear_bit	__test_and_clear_bit_le
 #define xiafs_test_bit	test_bit_le
 #define xiafs_find_first_zero_bit	find_first_zero_bit_le
+#define xiafs_find_next_bit	find_next_bit_le
+#define xiafs_find_next_zero_bit	find_next_zero_bit_le
@@ -0,0 +1,511 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * <debugfs>/xiafs/<dev>/: things for looking into a mounted xiafs that
+ * aren't worth a stable interface.
+ *
+ * latency: log2 histograms of how long the metadata operations took, in
+ * nanoseconds, each with rough percentiles. Writing anything to it starts
+ * them over.
+ *
+ * freespace: how the free zones are laid out, from the in-memory zmap:
+ * a histogram of free run lengths, the longest run, and how much is free
+ * in each sixteenth of the data area.
+ *
+ * extents: write an inode number to it, then read back that file's zones
+ * as runs of contiguous logical and physical zones.
+ *
+ * <debugfs>/xiafs/lock_stats isn't per mount, as the locks it's about
+ * aren't either; see lockstat.c. Writing to it starts it over too.
+ */
+
+#include <linux/buffer_head.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include "xiafs.h"
+#include "bitmap.h"
+
+static struct dentry *xiafs_debugfs_root;
+
+/* in enum xiafs_lat_op order */
+static const char * const xiafs_lat_names[XIAFS_NR_LAT_OPS] = {
+	"lookup",
+	"create",
+	"unlink",
+	"rename",
+	"mkdir",
+	"readdir",
+	"fsync",
+	"truncate",
+};
+
+/* in enum xiafs_lock_site order */
+static const char * const xiafs_lock_site_names[XIAFS_NR_LOCK_SITES] = {
+	"new_block",
+	"free_block",
+	"new_inode",
+	"free_inode",
+	"get_branch",
+	"splice_branch",
+	"find_shared",
+};
+
+/* The upper bound of the bucket the given fraction of calls falls in. */
+static u64 xiafs_lat_percentile(const u64 *h, u64 total, u64 permille)
+{
+	u64 want = div64_u64(total * permille + 999, 1000), seen = 0;
+	int b;
+
+	for (b = 0; b < XIAFS_LAT_BUCKETS - 1; b++) {
+		seen += h[b];
+		if (seen >= want)
+			break;
+	}
+	return 1ULL << b;
+}
+
+static int xiafs_latency_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	u64 h[XIAFS_LAT_BUCKETS], total;
+	int op, b, cpu;
+
+	for (op = 0; op < XIAFS_NR_LAT_OPS; op++) {
+		memset(h, 0, sizeof(h));
+		for_each_possible_cpu(cpu) {
+			struct xiafs_latency *lat = per_cpu_ptr(sbi->s_latency,
+								cpu);
+
+			for (b = 0; b < XIAFS_LAT_BUCKETS; b++)
+				h[b] += READ_ONCE(lat->lh[op][b]);
+		}
+		total = 0;
+		for (b = 0; b < XIAFS_LAT_BUCKETS; b++)
+			total += h[b];
+
+		seq_printf(m, "%s: count %llu", xiafs_lat_names[op], total);
+		if (total)
+			seq_printf(m, " p50 <%lluns p90 <%lluns p99 <%lluns "
+				   "p99.9 <%lluns",
+				   xiafs_lat_percentile(h, total, 500),
+				   xiafs_lat_percentile(h, total, 900),
+				   xiafs_lat_percentile(h, total, 990),
+				   xiafs_lat_percentile(h, total, 999));
+		seq_putc(m, '\n');
+		for (b = 0; b < XIAFS_LAT_BUCKETS; b++) {
+			if (!h[b])
+				continue;
+			if (b == XIAFS_LAT_BUCKETS - 1)
+				seq_printf(m, "  %llu+ ns: %llu\n",
+					   1ULL << (b - 1), h[b]);
+			else
+				seq_printf(m, "  %llu-%llu ns: %llu\n",
+					   b ? 1ULL << (b - 1) : 0,
+					   (1ULL << b) - 1, h[b]);
+		}
+	}
+	return 0;
+}
+
+static int xiafs_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, xiafs_latency_show, inode->i_private);
+}
+
+static ssize_t xiafs_latency_write(struct file *file, const char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct super_block *sb = file_inode(file)->i_private;
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	int cpu;
+
+	/* Anything racing with this may or may not be counted. */
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(sbi->s_latency, cpu), 0,
+		       sizeof(struct xiafs_latency));
+	return count;
+}
+
+static const struct file_operations xiafs_latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= xiafs_latency_open,
+	.read		= seq_read,
+	.write		= xiafs_latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+#define XIAFS_FREE_REGIONS	16
+#define XIAFS_FREE_BUCKETS	24	/* runs of 2^23 zones and up last */
+
+/*
+ * The next zmap bit at or after `pos' (and before `end') that is set, or
+ * clear if `set' is false; `end' if there isn't one. Bit n of the zmap is
+ * data zone s_firstdatazone + n - 1, bit 0 being unused.
+ */
+static unsigned long xiafs_zmap_next(struct xiafs_sb_info *sbi,
+		unsigned long pos, unsigned long end, bool set)
+{
+	unsigned long bits = XIAFS_BITS_PER_Z(sbi), i, n;
+
+	while (pos < end) {
+		const void *map;
+
+		i = pos / bits;
+		if (i >= sbi->s_zmap_zones)
+			break;
+		map = sbi->s_zmap_buf[i]->b_data;
+		n = set ? xiafs_find_next_bit(map, bits, pos % bits) :
+			  xiafs_find_next_zero_bit(map, bits, pos % bits);
+		if (n < bits)
+			return min(i * bits + n, end);
+		pos = (i + 1) * bits;
+	}
+	return end;
+}
+
+/*
+ * This reads the zmap without bitmap_lock, so on a busy file system the
+ * numbers are a close approximation rather than a snapshot.
+ */
+static int xiafs_freespace_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	unsigned long end = sbi->s_nzones - sbi->s_firstdatazone + 1;
+	unsigned long region = DIV_ROUND_UP(end - 1, XIAFS_FREE_REGIONS);
+	unsigned long runs[XIAFS_FREE_BUCKETS] = { };
+	unsigned long zones[XIAFS_FREE_BUCKETS] = { };
+	unsigned long rfree[XIAFS_FREE_REGIONS] = { };
+	unsigned long pos = 1, start, len, longest = 0, total = 0, nruns = 0;
+	int b;
+
+	while ((start = xiafs_zmap_next(sbi, pos, end, false)) < end) {
+		pos = xiafs_zmap_next(sbi, start, end, true);
+		len = pos - start;
+		b = min_t(int, fls_long(len) - 1, XIAFS_FREE_BUCKETS - 1);
+		runs[b]++;
+		zones[b] += len;
+		nruns++;
+		total += len;
+		longest = max(longest, len);
+		/* spread the run over the regions it covers */
+		while (start < pos) {
+			unsigned long r = (start - 1) / region;
+			unsigned long stop = min((r + 1) * region + 1, pos);
+
+			rfree[r] += stop - start;
+			start = stop;
+		}
+		cond_resched();
+	}
+
+	seq_printf(m, "data zones: %lu\nfree zones: %lu\nfree runs: %lu\n"
+		   "longest free run: %lu\n", end - 1, total, nruns, longest);
+	if (nruns)
+		seq_printf(m, "average free run: %lu\n", total / nruns);
+	seq_puts(m, "\nfree run length: runs zones\n");
+	for (b = 0; b < XIAFS_FREE_BUCKETS; b++)
+		if (runs[b])
+			seq_printf(m, "  %lu-%lu: %lu %lu\n", 1UL << b,
+				   (2UL << b) - 1, runs[b], zones[b]);
+	seq_puts(m, "\nregion (first zone): free zones, % free\n");
+	for (b = 0; b < XIAFS_FREE_REGIONS; b++) {
+		unsigned long first = b * region + 1;
+		unsigned long size;
+
+		if (first >= end)
+			break;
+		size = min(region, end - first);
+		seq_printf(m, "  %2d (%lu): %lu %lu%%\n", b,
+			   first + sbi->s_firstdatazone - 1, rfree[b],
+			   rfree[b] * 100 / size);
+	}
+	return 0;
+}
+
+static int xiafs_freespace_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, xiafs_freespace_show, inode->i_private);
+}
+
+static const struct file_operations xiafs_freespace_fops = {
+	.owner		= THIS_MODULE,
+	.open		= xiafs_freespace_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+struct xiafs_extent_walk {
+	struct seq_file *m;
+	unsigned long logical, physical, len;	/* the run being built */
+	unsigned long extents, zones, indirect;
+};
+
+static void xiafs_extent_flush(struct xiafs_extent_walk *w)
+{
+	if (!w->len)
+		return;
+	seq_printf(w->m, "  %lu %lu %lu\n", w->logical, w->physical, w->len);
+	w->extents++;
+	w->len = 0;
+}
+
+static void xiafs_extent_add(struct xiafs_extent_walk *w,
+		unsigned long logical, block_t phys)
+{
+	if (!phys)
+		return;
+	w->zones++;
+	if (w->len && logical == w->logical + w->len &&
+	    phys == w->physical + w->len) {
+		w->len++;
+		return;
+	}
+	xiafs_extent_flush(w);
+	w->logical = logical;
+	w->physical = phys;
+	w->len = 1;
+}
+
+/*
+ * Hand the zones under one pointer to xiafs_extent_add, `depth' levels of
+ * indirection down, starting at logical zone `logical' and not going past
+ * `last'. Returns the logical zone after the ones covered.
+ */
+static unsigned long xiafs_extent_tree(struct super_block *sb,
+		struct xiafs_extent_walk *w, block_t nr, int depth,
+		unsigned long logical, unsigned long last)
+{
+	unsigned long per = XIAFS_ADDRS_PER_Z(xiafs_sb(sb));
+	unsigned long span = depth == 2 ? per * per : per;
+	struct buffer_head *bh;
+	block_t *p;
+	int i;
+
+	if (!depth) {
+		xiafs_extent_add(w, logical, nr);
+		return logical + 1;
+	}
+	if (!nr)
+		return logical + span;
+	w->indirect++;
+	bh = sb_bread(sb, nr);
+	if (!bh) {
+		seq_printf(w->m, "  can't read indirect zone %u\n", nr);
+		return logical + span;
+	}
+	p = (block_t *)bh->b_data;
+	for (i = 0; i < per && logical < last; i++)
+		logical = xiafs_extent_tree(sb, w, block_to_cpu(p[i]),
+					    depth - 1, logical, last);
+	brelse(bh);
+	return logical;
+}
+
+static int xiafs_extents_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	unsigned long ino = READ_ONCE(sbi->s_debug_ino);
+	struct xiafs_extent_walk w = { .m = m };
+	unsigned long logical = 0, last;
+	block_t zones[_XIAFS_NUM_BLOCK_POINTERS], *idata;
+	struct xiafs_inode *raw_inode;
+	struct buffer_head *bh;
+	struct inode *inode;
+	umode_t mode;
+	loff_t size;
+	bool fast;
+	int i;
+
+	if (!ino) {
+		seq_puts(m, "write an inode number here first\n");
+		return 0;
+	}
+	if (xiafs_next_inode(sb, ino) != ino) {
+		seq_printf(m, "inode %lu is not in use\n", ino);
+		return 0;
+	}
+	/*
+	 * Not iget: that could bring an inode into the cache of a file system
+	 * that's being unmounted and has already evicted its inodes. One that
+	 * isn't in core is read off the disk instead, unlocked, so a file
+	 * being changed meanwhile may come out half old and half new.
+	 */
+	inode = ilookup(sb, ino);
+	if (inode) {
+		inode_lock_shared(inode);
+		mode = inode->i_mode;
+		size = i_size_read(inode);
+		fast = xiafs_inode_is_fast_symlink(inode);
+		idata = i_data(inode);
+	} else {
+		raw_inode = xiafs_raw_inode(sb, ino, &bh);
+		if (!raw_inode) {
+			brelse(bh);
+			return -EIO;
+		}
+		mode = raw_inode->i_mode;
+		size = raw_inode->i_size;
+		fast = xiafs_fast_symlink(sb, mode, size);
+		for (i = 0; i < _XIAFS_NUM_BLOCK_POINTERS; i++)
+			zones[i] = raw_inode->i_zone[i] & 0xffffff;
+		brelse(bh);
+		idata = zones;
+	}
+
+	seq_printf(m, "inode %lu size %lld\nlogical physical zones\n", ino,
+		   size);
+	if ((S_ISREG(mode) || S_ISDIR(mode) || S_ISLNK(mode)) && !fast) {
+		last = DIV_ROUND_UP(size, XIAFS_ZSIZE(sbi));
+		for (i = 0; i < _XIAFS_NUM_BLOCK_POINTERS && logical < last;
+		     i++)
+			logical = xiafs_extent_tree(sb, &w,
+					block_to_cpu(idata[i]),
+					i < 8 ? 0 : i - 7, logical, last);
+		xiafs_extent_flush(&w);
+	}
+	if (inode) {
+		inode_unlock_shared(inode);
+		iput(inode);
+	}
+	seq_printf(m, "zones %lu extents %lu indirect zones %lu\n", w.zones,
+		   w.extents, w.indirect);
+	return 0;
+}
+
+static int xiafs_extents_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, xiafs_extents_show, inode->i_private);
+}
+
+static ssize_t xiafs_extents_write(struct file *file, const char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct super_block *sb = file_inode(file)->i_private;
+	unsigned long ino;
+	int err;
+
+	err = kstrtoul_from_user(buf, count, 0, &ino);
+	if (err)
+		return err;
+	if (!ino || ino > xiafs_sb(sb)->s_ninodes)
+		return -EINVAL;
+	WRITE_ONCE(xiafs_sb(sb)->s_debug_ino, ino);
+	return count;
+}
+
+static const struct file_operations xiafs_extents_fops = {
+	.owner		= THIS_MODULE,
+	.open		= xiafs_extents_open,
+	.read		= seq_read,
+	.write		= xiafs_extents_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int xiafs_lock_stats_show(struct seq_file *m, void *v)
+{
+	struct xiafs_lock_stat sum;
+	int site, cpu;
+
+	seq_printf(m, "lock_stats %s\n",
+		   static_key_enabled(&xiafs_lock_stats_on) ? "on" : "off");
+	seq_printf(m, "%-14s %12s %12s %14s %14s %10s %10s\n", "site",
+		   "acquired", "contended", "wait_ns", "hold_ns",
+		   "avg_wait", "avg_hold");
+	for (site = 0; site < XIAFS_NR_LOCK_SITES; site++) {
+		memset(&sum, 0, sizeof(sum));
+		for_each_possible_cpu(cpu) {
+			struct xiafs_lock_stat *ls =
+				&per_cpu(xiafs_lock_stats, cpu).ls[site];
+
+			sum.acquired += READ_ONCE(ls->acquired);
+			sum.contended += READ_ONCE(ls->contended);
+			sum.wait_ns += READ_ONCE(ls->wait_ns);
+			sum.hold_ns += READ_ONCE(ls->hold_ns);
+		}
+		/* the wait is averaged over the waits, the hold over all */
+		seq_printf(m, "%-14s %12llu %12llu %14llu %14llu %10llu %10llu\n",
+			   xiafs_lock_site_names[site], sum.acquired,
+			   sum.contended, sum.wait_ns, sum.hold_ns,
+			   sum.contended ?
+				div64_u64(sum.wait_ns, sum.contended) : 0,
+			   sum.acquired ?
+				div64_u64(sum.hold_ns, sum.acquired) : 0);
+	}
+	return 0;
+}
+
+static int xiafs_lock_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, xiafs_lock_stats_show, NULL);
+}
+
+static ssize_t xiafs_lock_stats_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(&per_cpu(xiafs_lock_stats, cpu), 0,
+		       sizeof(struct xiafs_lock_stats));
+	return count;
+}
+
+static const struct file_operations xiafs_lock_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= xiafs_lock_stats_open,
+	.read		= seq_read,
+	.write		= xiafs_lock_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * The histograms are kept whether or not debugfs is there to show them,
+ * so a failure to allocate them fails the mount, but a failure to make
+ * the files doesn't.
+ */
+int xiafs_register_debugfs(struct super_block *sb)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+
+	sbi->s_latency = alloc_percpu(struct xiafs_latency);
+	if (!sbi->s_latency)
+		return -ENOMEM;
+
+	sbi->s_debugfs = debugfs_create_dir(sb->s_id, xiafs_debugfs_root);
+	debugfs_create_file("latency", 0600, sbi->s_debugfs, sb,
+			    &xiafs_latency_fops);
+	debugfs_create_file("freespace", 0400, sbi->s_debugfs, sb,
+			    &xiafs_freespace_fops);
+	debugfs_create_file("extents", 0600, sbi->s_debugfs, sb,
+			    &xiafs_extents_fops);
+	return 0;
+}
+
+void xiafs_unregister_debugfs(struct super_block *sb)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+
+	debugfs_remove_recursive(sbi->s_debugfs);
+	sbi->s_debugfs = NULL;
+	free_percpu(sbi->s_latency);
+	sbi->s_latency = NULL;
+}
+
+void __init xiafs_init_debugfs(void)
+{
+	xiafs_debugfs_root = debugfs_create_dir("xiafs", NULL);
+	debugfs_create_file("lock_stats", 0600, xiafs_debugfs_root, NULL,
+			    &xiafs_lock_stats_fops);
+}
+
+void xiafs_exit_debugfs(void)
+{
+	debugfs_remove_recursive(xiafs_debugfs_root);
+}
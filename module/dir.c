@@ -21,18 +21,21 @@
 #include "xiafs.h"
 #include <linux/buffer_head.h>
 #include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
 #include <linux/swap.h>
+#include "trace/events/xiafs.h"
 
 typedef struct xiafs_direct xiafs_dirent;
 
-static int xiafs_readdir(struct file *, struct dir_context *);
-
 #define RNDUP4(x)	((3+(u_long)(x)) & ~3)
 
 const struct file_operations xiafs_dir_operations = {
 	.llseek		= generic_file_llseek,
 	.read		= generic_read_dir,
 	.iterate_shared	= xiafs_readdir,
+	.unlocked_ioctl	= xiafs_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
 	.fsync		= xiafs_fsync,
 };
 
@@ -58,6 +61,7 @@ static void dir_commit_chunk(struct folio *folio, loff_t pos, unsigned len)
 
 	if (pos+len > dir->i_size) {
 		i_size_write(dir, pos+len);
+		xiafs_layout_changed(dir);
 		mark_inode_dirty(dir);
 	}
 	/* write_on_page if (IS_DIRSYNC(dir)) moved apparently. o_O */
@@ -66,11 +70,18 @@ static void dir_commit_chunk(struct folio *folio, loff_t pos, unsigned len)
 
 /* Stealing this from fs/minix/dir.c. Directory handling generally seems to
  * have been shaken up a bit between 6.1 and 6.15 somewhere along the way.
+ *
+ * Like minix, only write the directory out here when it is DIRSYNC; other
+ * directory changes go out with regular writeback like they would anywhere
+ * else.
  */
-static int xiafs_handle_dirsync(struct inode *dir)
+int xiafs_handle_dirsync(struct inode *dir)
 {
 	int err;
 
+	if (!IS_DIRSYNC(dir))
+		return 0;
+	xiafs_stat_inc(dir->i_sb, XIAFS_STAT_DIRSYNC);
 	err = filemap_write_and_wait(dir->i_mapping);
 	if (!err)
 		err = sync_inode_metadata(dir, 1);
@@ -88,6 +99,40 @@ static void *dir_get_folio(struct inode *dir, unsigned long n,
 	return kmap_local_folio(folio, 0);
 }
 
+/*
+ * Start readahead on the directory pages from `n' through the end of the
+ * directory before we go and read page `n'. Without this a scan of a cold
+ * directory turns into one synchronous read_folio per page; with it the
+ * rest of the directory comes in as one streaming read. The request is
+ * sized by how much of the directory is left, and the readahead code caps
+ * it at the bdi's limit and keeps things going asynchronously from there.
+ */
+static void dir_readahead(struct inode *dir, struct file_ra_state *ra,
+		unsigned long n, unsigned long npages)
+{
+	struct address_space *mapping = dir->i_mapping;
+	struct folio *folio;
+
+	if (n >= npages)
+		return;
+
+	folio = filemap_get_folio(mapping, n);
+	if (IS_ERR(folio)) {
+		page_cache_sync_readahead(mapping, ra, NULL, n, npages - n);
+		return;
+	}
+	if (folio_test_readahead(folio))
+		page_cache_async_readahead(mapping, ra, NULL, folio, npages - n);
+	folio_put(folio);
+}
+
+static void *dir_get_folio_ra(struct inode *dir, struct file_ra_state *ra,
+		unsigned long n, unsigned long npages, struct folio **foliop)
+{
+	dir_readahead(dir, ra, n, npages);
+	return dir_get_folio(dir, n, foliop);
+}
+
 static inline void *xiafs_next_entry(void *de)
 {
 	/* make this less gimpy */
@@ -95,19 +140,20 @@ static inline void *xiafs_next_entry(void *de)
 	return (void*)((char*)de + d->d_rec_len);
 }
 
-static int xiafs_readdir(struct file * file, struct dir_context *ctx)
+/* Untimed, for callers that aren't readdir(2) itself; see xiafs_readdir(). */
+int do_xiafs_readdir(struct file * file, struct dir_context *ctx)
 {
 	unsigned long pos = ctx->pos;
 	struct inode *inode = file_inode(file);
 	unsigned long npages = dir_pages(inode);
 	unsigned chunk_size = _XIAFS_DIR_SIZE; /* 1st entry is always 12, it seems. */
+	unsigned zsize = XIAFS_ZSIZE(xiafs_sb(inode->i_sb));
 	char *name;
 	unsigned char namelen;
 	__u32 inumber;
 	unsigned offset;
 	unsigned long n;
 
-	ctx->pos = pos = ALIGN(pos, chunk_size); /* (pos + chunk_size-1) & ~(chunk_size-1); */
 	if (pos >= inode->i_size)
 		return 0;
 
@@ -117,11 +163,23 @@ static int xiafs_readdir(struct file * file, struct dir_context *ctx)
 	for ( ; n < npages; n++, offset = 0) {
 		char *p, *kaddr, *limit;
 		struct folio *folio;
-		kaddr = dir_get_folio(inode, n, &folio);
+		kaddr = dir_get_folio_ra(inode, &file->f_ra, n, npages, &folio);
 
-		if (IS_ERR(folio))
+		if (IS_ERR(kaddr))
 			continue;
 		p = kaddr+offset;
+		if (offset) {
+			/* ctx->pos may no longer land on a record if the
+			 * directory was changed or compacted since it was
+			 * handed out, so walk up to it from the start of its
+			 * zone. Records never cross a zone boundary. */
+			char *q = kaddr + (offset & ~(zsize - 1));
+
+			while (q < p && ((xiafs_dirent *)q)->d_rec_len)
+				q = xiafs_next_entry(q);
+			p = q;
+			ctx->pos = ((loff_t)n << PAGE_SHIFT) + (p - kaddr);
+		}
 		limit = kaddr + xiafs_last_byte(inode, n) - chunk_size;
 		for ( ; p <= limit; p = xiafs_next_entry(p)) {
 			xiafs_dirent *de = (xiafs_dirent *)p;
@@ -152,6 +210,16 @@ static int xiafs_readdir(struct file * file, struct dir_context *ctx)
 	return 0;
 }
 
+int xiafs_readdir(struct file * file, struct dir_context *ctx)
+{
+	struct super_block *sb = file_inode(file)->i_sb;
+	u64 start = ktime_get_ns();
+	int err = do_xiafs_readdir(file, ctx);
+
+	xiafs_lat_record(sb, XIAFS_LAT_READDIR, start);
+	return err;
+}
+
 static inline int namecompare(int len, int maxlen,
 	const char * name, const char * buffer)
 {
@@ -179,13 +247,16 @@ xiafs_dirent *xiafs_find_entry(struct dentry *dentry, struct folio **foliop, str
 
 	char *namx;
 	__u32 inumber;
+	unsigned int scanned = 0;
+	struct file_ra_state ra;
 
+	file_ra_state_init(&ra, dir->i_mapping);
 	for (n = 0; n < npages; n++) {
 		char *kaddr, *limit;
 		unsigned short reclen;
 		xiafs_dirent *de_pre;
 
-		kaddr = dir_get_folio(dir, n, foliop);
+		kaddr = dir_get_folio_ra(dir, &ra, n, npages, foliop);
 		if (IS_ERR(kaddr))
 			continue;
 
@@ -198,6 +269,7 @@ xiafs_dirent *xiafs_find_entry(struct dentry *dentry, struct folio **foliop, str
 				folio_release_kmap(*foliop, kaddr);
 				return ERR_PTR(-EIO);
 			}
+			scanned++;
 			namx = de->d_name;
 			inumber = de->d_ino;
 			if (!inumber)
@@ -211,13 +283,131 @@ xiafs_dirent *xiafs_find_entry(struct dentry *dentry, struct folio **foliop, str
 		}
 		folio_release_kmap(*foliop, kaddr);
 	}
+	trace_xiafs_find_entry(dir, &dentry->d_name, scanned, 0);
+	xiafs_stat_inc(dir->i_sb, XIAFS_STAT_LOOKUPS);
+	xiafs_stat_add(dir->i_sb, XIAFS_STAT_LOOKUP_SCANNED, scanned);
 	return NULL;
 
 found:
+	trace_xiafs_find_entry(dir, &dentry->d_name, scanned, 1);
+	xiafs_stat_inc(dir->i_sb, XIAFS_STAT_LOOKUPS);
+	xiafs_stat_add(dir->i_sb, XIAFS_STAT_LOOKUP_SCANNED, scanned);
 	return (xiafs_dirent *)p;
 }
 
-int xiafs_add_link(struct dentry *dentry, struct inode *inode)
+/*
+ *	xiafs_find_entries()
+ *
+ * Like xiafs_find_entry(), but looks for `name1' and, if it's not NULL,
+ * `name2' in the same pass over the directory. Rename within a directory
+ * needs both entries and would otherwise read the directory twice. Returns
+ * 0 once everything asked for has been found, with each entry's folio
+ * mapped and referenced in its xiafs_dir_loc; drop them with
+ * xiafs_put_entries().
+ */
+int xiafs_find_entries(struct inode *dir, const struct qstr *name1,
+		struct xiafs_dir_loc *loc1, const struct qstr *name2,
+		struct xiafs_dir_loc *loc2)
+{
+	unsigned long n;
+	unsigned long npages = dir_pages(dir);
+	int want = name2 ? 2 : 1;
+	struct file_ra_state ra;
+
+	loc1->de = NULL;
+	if (name2)
+		loc2->de = NULL;
+
+	file_ra_state_init(&ra, dir->i_mapping);
+	for (n = 0; n < npages && want; n++) {
+		struct folio *folio;
+		char *kaddr, *limit, *p;
+		xiafs_dirent *de_pre;
+		int hits = 0;
+
+		kaddr = dir_get_folio_ra(dir, &ra, n, npages, &folio);
+		if (IS_ERR(kaddr))
+			continue;
+
+		limit = kaddr + xiafs_last_byte(dir, n) - _XIAFS_DIR_SIZE;
+		de_pre = (xiafs_dirent *)kaddr;
+		for (p = kaddr; p <= limit && want; p = xiafs_next_entry(p)) {
+			xiafs_dirent *de = (xiafs_dirent *)p;
+			struct xiafs_dir_loc *loc = NULL;
+
+			if (de->d_rec_len == 0) {
+				printk("XIAFS: Zero-length directory entry at (%s %d)\n", WHERE_ERR);
+				if (!hits)
+					folio_release_kmap(folio, kaddr);
+				xiafs_put_entries(loc1, loc2);
+				return -EIO;
+			}
+			if (!de->d_ino)
+				continue;
+			if (!loc1->de && namecompare(name1->len, _XIAFS_NAME_LEN,
+						name1->name, de->d_name))
+				loc = loc1;
+			else if (name2 && !loc2->de &&
+				 namecompare(name2->len, _XIAFS_NAME_LEN,
+						name2->name, de->d_name))
+				loc = loc2;
+			if (loc) {
+				/* Both names on one page get a mapping each,
+				 * so they can be released independently. */
+				if (hits++) {
+					folio_get(folio);
+					loc->de = (xiafs_dirent *)((char *)kmap_local_folio(folio, 0) + (p - kaddr));
+				} else
+					loc->de = de;
+				loc->de_pre = (xiafs_dirent *)((char *)loc->de - (p - (char *)de_pre));
+				loc->folio = folio;
+				want--;
+			}
+			de_pre = de;
+		}
+		if (!hits)
+			folio_release_kmap(folio, kaddr);
+	}
+	if (want) {
+		xiafs_put_entries(loc1, loc2);
+		return -ENOENT;
+	}
+	return 0;
+}
+
+/*
+ * Release what xiafs_find_entries() found, unmapping the later mapping
+ * first.
+ */
+void xiafs_put_entries(struct xiafs_dir_loc *loc1, struct xiafs_dir_loc *loc2)
+{
+	struct xiafs_dir_loc *first = loc1, *last = loc2;
+
+	if (!loc2 || !loc2->de) {
+		last = NULL;
+	} else if (loc1->de && loc1->folio->mapping == loc2->folio->mapping &&
+		   (loc1->folio->index > loc2->folio->index ||
+		    (loc1->folio == loc2->folio &&
+		     offset_in_page(loc1->de) > offset_in_page(loc2->de)))) {
+		first = loc2;
+		last = loc1;
+	}
+	if (last) {
+		folio_release_kmap(last->folio, last->de);
+		last->de = NULL;
+	}
+	if (first->de) {
+		folio_release_kmap(first->folio, first->de);
+		first->de = NULL;
+	}
+}
+
+/*
+ * The directory operations below come in pairs: the __ version does the
+ * work and leaves the directory dirty, the plain one also deals with
+ * DIRSYNC. Rename uses the former so it only has to sync once at the end.
+ */
+int __xiafs_add_link(struct dentry *dentry, struct inode *inode)
 {
 	struct inode *dir = dentry->d_parent->d_inode;
 	const char * name = dentry->d_name.name;
@@ -233,16 +423,19 @@ int xiafs_add_link(struct dentry *dentry, struct inode *inode)
 	int rec_size;
 	char *namx = NULL;
 	__u32 inumber;
+	unsigned int scanned = 0;
+	struct file_ra_state ra;
 
 	/*
 	 * We take care of directory expansion in the same loop
 	 * This code plays outside i_size, so it locks the page
 	 * to protect that region.
 	 */
+	file_ra_state_init(&ra, dir->i_mapping);
 	for (n = 0; n <= npages; n++) {
 		char *limit, *dir_end;
 
-		kaddr = dir_get_folio(dir, n, &folio);
+		kaddr = dir_get_folio_ra(dir, &ra, n, npages, &folio);
 		if (IS_ERR(kaddr))
 			return PTR_ERR(kaddr);
 
@@ -257,6 +450,7 @@ int xiafs_add_link(struct dentry *dentry, struct inode *inode)
 				folio_release_kmap(folio, kaddr);
 				return -EIO;
 			}
+			scanned++;
 			rec_size = de->d_rec_len;
 			if (de->d_ino && RNDUP4(de->d_name_len)+RNDUP4(namelen)+16 <= de->d_rec_len){
 				/* We have an entry we can get another one 
@@ -306,18 +500,31 @@ got_it:
 	de->d_name_len=namelen;
 	de->d_ino = inode->i_ino;
 	dir_commit_chunk(folio, pos, rec_size);
+	if (xiafs_i(dir)->i_dir_entries >= 0)
+		xiafs_i(dir)->i_dir_entries++;
 	inode_set_mtime_to_ts(dir, inode_set_ctime_current(dir));
 	mark_inode_dirty(dir);
-	err = xiafs_handle_dirsync(dir);
 out_put:
 	folio_release_kmap(folio, kaddr);
+	trace_xiafs_add_link(dir, &dentry->d_name, scanned, err);
+	xiafs_stat_inc(dir->i_sb, XIAFS_STAT_ADD_LINKS);
+	xiafs_stat_add(dir->i_sb, XIAFS_STAT_ADD_SCANNED, scanned);
 	return err;
 out_unlock:
 	folio_unlock(folio);
 	goto out_put;
 }
 
-int xiafs_delete_entry(struct xiafs_direct *de, struct xiafs_direct *de_pre, struct folio *folio)
+int xiafs_add_link(struct dentry *dentry, struct inode *inode)
+{
+	int err = __xiafs_add_link(dentry, inode);
+
+	if (!err)
+		err = xiafs_handle_dirsync(dentry->d_parent->d_inode);
+	return err;
+}
+
+int __xiafs_delete_entry(struct xiafs_direct *de, struct xiafs_direct *de_pre, struct folio *folio)
 {
 	struct inode *inode = folio->mapping->host;
 	loff_t pos = folio_pos(folio) + offset_in_folio(folio, de);
@@ -334,13 +541,14 @@ int xiafs_delete_entry(struct xiafs_direct *de, struct xiafs_direct *de_pre, str
 			if (de_pre->d_rec_len < _XIAFS_DIR_SIZE){
 				printk("XIA-FS: bad directory entry (%s %d)\n", WHERE_ERR);
 				folio_unlock(folio);
-				return -1;
+				return -EIO;
 			}
 			de_pre=(struct xiafs_direct *)(de_pre->d_rec_len + (u_char *)de_pre);
 		}
 		if (de_pre->d_rec_len + (u_char *)de_pre > (u_char *)de){
 			printk("XIA-FS: bad directory entry (%s %d)\n", WHERE_ERR);
-			return -1;
+			folio_unlock(folio);
+			return -EIO;
 			}
 		/* d_rec_len can only be XIAFS_ZSIZE at most. Don't join them
 		 * together if they'd go over */
@@ -362,10 +570,20 @@ int xiafs_delete_entry(struct xiafs_direct *de, struct xiafs_direct *de_pre, str
 	}
 
 	dir_commit_chunk(folio, pos, len);
+	if (xiafs_i(inode)->i_dir_entries > 0)
+		xiafs_i(inode)->i_dir_entries--;
 	inode_set_mtime_to_ts(inode, inode_set_ctime_current(inode));
 	mark_inode_dirty(inode);
+	return 0;
+}
+
+int xiafs_delete_entry(struct xiafs_direct *de, struct xiafs_direct *de_pre, struct folio *folio)
+{
+	int err = __xiafs_delete_entry(de, de_pre, folio);
 
-	return xiafs_handle_dirsync(inode);
+	if (!err)
+		err = xiafs_handle_dirsync(folio->mapping->host);
+	return err;
 }
 
 int xiafs_make_empty(struct inode *inode, struct inode *dir)
@@ -402,6 +620,7 @@ int xiafs_make_empty(struct inode *inode, struct inode *dir)
 	kunmap_local(kaddr);
 
 	dir_commit_chunk(folio, 0, zsize);
+	xiafs_i(inode)->i_dir_entries = 2;
 	err = xiafs_handle_dirsync(inode);
 fail:
 	folio_put(folio);
@@ -410,20 +629,31 @@ fail:
 
 /*
  * routine to check that the specified directory is empty (for rmdir)
+ *
+ * Once a directory has been looked through, the number of live entries in
+ * it is kept in the in-core inode and kept up to date by add and delete,
+ * so after the first time this doesn't have to read the directory at all.
  */
 int xiafs_empty_dir(struct inode * inode)
 {
+	struct xiafs_inode_info *xi = xiafs_i(inode);
 	struct folio *folio = NULL;
 	unsigned long i, npages = dir_pages(inode);
 	char *name, *kaddr;
 	__u32 inumber;
+	struct file_ra_state ra;
+	int entries = 0, others = 0;
 
+	if (xi->i_dir_entries >= 0)
+		return xi->i_dir_entries <= 2;
+
+	file_ra_state_init(&ra, inode->i_mapping);
 	for (i = 0; i < npages; i++) {
 		char *p, *limit;
 
-		kaddr = dir_get_folio(inode, i, &folio);
+		kaddr = dir_get_folio_ra(inode, &ra, i, npages, &folio);
 		if (IS_ERR(kaddr))
-			continue;
+			return 0;
 
 		limit = kaddr + xiafs_last_byte(inode, i) - _XIAFS_DIR_SIZE;
 		for (p = kaddr; p <= limit; p = xiafs_next_entry(p)) {
@@ -431,41 +661,81 @@ int xiafs_empty_dir(struct inode * inode)
 			if (de->d_rec_len == 0){
 				printk("XIAFS: Zero-length directory entry at (%s %d)\n", WHERE_ERR);
 				folio_release_kmap(folio, kaddr);
-				return -EIO;
+				return 0;
 			}
 			name = de->d_name;
 			inumber = de->d_ino;
 
 			if (inumber != 0) {
+				entries++;
 				/* check for . and .. */
 				if (name[0] != '.')
-					goto not_empty;
-				if (!name[1]) {
+					others++;
+				else if (!name[1]) {
 					if (inumber != inode->i_ino)
-						goto not_empty;
+						others++;
 				} else if (name[1] != '.')
-					goto not_empty;
+					others++;
 				else if (name[2])
-					goto not_empty;
+					others++;
 			}
 		}
 		folio_release_kmap(folio, kaddr);
 	}
-	return 1;
+	/* A "." pointing somewhere else is never empty, whatever the count. */
+	if (!others || entries > 2)
+		xi->i_dir_entries = entries;
+	return !others;
+}
 
-not_empty:
-	folio_release_kmap(folio, kaddr);
+int __xiafs_set_link(struct xiafs_direct *de, struct folio *folio,
+	struct inode *inode)
+{
+	struct inode *dir = folio->mapping->host;
+	loff_t pos = folio_pos(folio) + offset_in_folio(folio, de);
+	int err;
+
+	folio_lock(folio);
+
+	err = xiafs_prepare_chunk(folio, pos, de->d_rec_len);
+	if (err) {
+		folio_unlock(folio);
+		return err;
+	}
+
+	de->d_ino = inode->i_ino;
+	dir_commit_chunk(folio, pos, de->d_rec_len);
+
+	inode_set_mtime_to_ts(dir, inode_set_ctime_current(dir));
+	mark_inode_dirty(dir);
 	return 0;
 }
 
-/* Releases the page */
 int xiafs_set_link(struct xiafs_direct *de, struct folio *folio,
 	struct inode *inode)
+{
+	int err = __xiafs_set_link(de, folio, inode);
+
+	if (!err)
+		err = xiafs_handle_dirsync(folio->mapping->host);
+	return err;
+}
+
+/*
+ * Give the entry `de' a new name in place. Only for when the name fits in
+ * the record as it stands; rename uses this to skip adding a new entry and
+ * deleting the old one when both are in the same directory.
+ */
+int __xiafs_rename_entry(struct xiafs_direct *de, struct folio *folio,
+	const struct qstr *name)
 {
 	struct inode *dir = folio->mapping->host;
 	loff_t pos = folio_pos(folio) + offset_in_folio(folio, de);
 	int err;
 
+	if (RNDUP4(name->len) + 8 > de->d_rec_len)
+		return -ENOSPC;
+
 	folio_lock(folio);
 
 	err = xiafs_prepare_chunk(folio, pos, de->d_rec_len);
@@ -474,12 +744,14 @@ int xiafs_set_link(struct xiafs_direct *de, struct folio *folio,
 		return err;
 	}
 
-	de->d_ino = inode->i_ino;
+	memcpy(de->d_name, name->name, name->len);
+	de->d_name[name->len] = 0;
+	de->d_name_len = name->len;
 	dir_commit_chunk(folio, pos, de->d_rec_len);
 
 	inode_set_mtime_to_ts(dir, inode_set_ctime_current(dir));
 	mark_inode_dirty(dir);
-	return xiafs_handle_dirsync(dir);
+	return 0;
 }
 
 struct xiafs_direct * xiafs_dotdot (struct inode *dir, struct folio **foliop)
@@ -504,3 +776,128 @@ ino_t xiafs_inode_by_name(struct dentry *dentry)
 	}
 	return res;
 }
+
+/*
+ *	xiafs_compact_dir()
+ *
+ * Rewrites a directory with its live entries packed densely from the start,
+ * dropping the dead (d_ino == 0) records and the slack left behind when
+ * xiafs_add_link() splits entries, then truncates the zones that are no
+ * longer needed. xiafs_delete_entry() only ever merges a dead entry into
+ * its neighbour inside one zone, so without this a directory that has seen
+ * a lot of churn never gets any smaller and every later scan pays for the
+ * dead space.
+ *
+ * Entries keep their order, so "." and ".." stay where they belong. Pages
+ * whose contents don't change aren't touched. The caller holds the
+ * directory's i_rwsem exclusively.
+ */
+int xiafs_compact_dir(struct inode *dir, struct xiafs_dir_compact *dc)
+{
+	unsigned int zsize = XIAFS_ZSIZE(xiafs_sb(dir->i_sb));
+	unsigned long npages = dir_pages(dir);
+	loff_t old_size = dir->i_size;
+	struct file_ra_state ra;
+	xiafs_dirent *last = NULL;
+	char *buf, *zone, *out;
+	loff_t new_size, pos;
+	unsigned long n;
+	int err = 0;
+
+	memset(dc, 0, sizeof(*dc));
+	dc->dc_old_size = dc->dc_new_size = old_size;
+	if (!old_size || old_size & (zsize - 1))
+		return -EIO;
+
+	buf = kvzalloc(old_size, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	zone = out = buf;
+	file_ra_state_init(&ra, dir->i_mapping);
+	for (n = 0; n < npages; n++) {
+		char *kaddr, *p, *limit;
+		struct folio *folio;
+
+		kaddr = dir_get_folio_ra(dir, &ra, n, npages, &folio);
+		if (IS_ERR(kaddr)) {
+			err = PTR_ERR(kaddr);
+			goto out;
+		}
+		limit = kaddr + xiafs_last_byte(dir, n) - _XIAFS_DIR_SIZE;
+		for (p = kaddr; p <= limit; p = xiafs_next_entry(p)) {
+			xiafs_dirent *de = (xiafs_dirent *)p;
+			unsigned int len = RNDUP4(de->d_name_len) + 8;
+
+			if (de->d_rec_len < _XIAFS_DIR_SIZE ||
+			    (de->d_ino && len > de->d_rec_len)) {
+				printk("XIAFS: bad directory entry at (%s %d)\n", WHERE_ERR);
+				folio_release_kmap(folio, kaddr);
+				err = -EIO;
+				goto out;
+			}
+			if (!de->d_ino) {
+				dc->dc_dead++;
+				continue;
+			}
+			if (out + len > zone + zsize) {
+				/* The last entry in a zone runs to its end. */
+				last->d_rec_len += zone + zsize - out;
+				zone += zsize;
+				out = zone;
+			}
+			memcpy(out, de, offsetof(xiafs_dirent, d_name) + de->d_name_len);
+			last = (xiafs_dirent *)out;
+			last->d_rec_len = len;
+			out += len;
+			dc->dc_live++;
+		}
+		folio_release_kmap(folio, kaddr);
+	}
+	if (!last) {
+		err = -EIO;
+		goto out;
+	}
+	last->d_rec_len += zone + zsize - out;
+	new_size = zone + zsize - buf;
+
+	for (pos = 0; pos < new_size; pos += PAGE_SIZE) {
+		unsigned int len = min_t(loff_t, PAGE_SIZE, new_size - pos);
+		struct folio *folio;
+		char *kaddr;
+
+		kaddr = dir_get_folio(dir, pos >> PAGE_SHIFT, &folio);
+		if (IS_ERR(kaddr)) {
+			err = PTR_ERR(kaddr);
+			goto out;
+		}
+		if (!memcmp(kaddr, buf + pos, len)) {
+			folio_release_kmap(folio, kaddr);
+			continue;
+		}
+		folio_lock(folio);
+		err = xiafs_prepare_chunk(folio, pos, len);
+		if (err) {
+			folio_unlock(folio);
+			folio_release_kmap(folio, kaddr);
+			goto out;
+		}
+		memcpy(kaddr, buf + pos, len);
+		dir_commit_chunk(folio, pos, len);
+		folio_release_kmap(folio, kaddr);
+	}
+
+	if (new_size < old_size) {
+		truncate_setsize(dir, new_size);
+		xiafs_truncate(dir);
+	}
+	inode_set_mtime_to_ts(dir, inode_set_ctime_current(dir));
+	mark_inode_dirty(dir);
+	xiafs_i(dir)->i_dir_entries = dc->dc_live;
+	dc->dc_new_size = new_size;
+	dc->dc_reclaimed = old_size - new_size;
+	err = xiafs_handle_dirsync(dir);
+out:
+	kvfree(buf);
+	return err;
+}
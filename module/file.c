@@ -20,9 +20,46 @@
 #include "xiafs.h"
 #include <linux/pagemap.h>
 
+/*
+ * fdatasync of a file that has only had existing blocks overwritten since
+ * its metadata was last synced needs nothing but the data written: the
+ * inode's size and block pointers, and the indirect blocks, are already on
+ * disk. Otherwise the indirect blocks this inode dirtied are written, and
+ * the inode is copied into its table block.
+ *
+ * Either way, the inode table, the bitmaps and the disk cache flush are
+ * left to xiafs_commit(), which shares them between everyone fsyncing at
+ * the same time.
+ */
 int xiafs_fsync(struct file *file, loff_t start, loff_t end, int datasync)
 {
-	return mmb_fsync(file, &xiafs_i(file->f_mapping->host)->i_metadata_bhs, start, end, datasync);
+	struct inode *inode = file->f_mapping->host;
+	struct xiafs_inode_info *xi = xiafs_i(inode);
+	u64 now = ktime_get_ns();
+	int err;
+
+	err = file_write_and_wait_range(file, start, end);
+	if (err)
+		goto out;
+
+	/* Writeback allocates blocks for mmap'd writes into holes, so only
+	 * look at this after the data is out. */
+	if (datasync && !test_bit(XIAFS_I_LAYOUT, &xi->i_flags)) {
+		err = xiafs_commit(inode->i_sb);
+		goto out;
+	}
+
+	clear_bit(XIAFS_I_LAYOUT, &xi->i_flags);
+	err = mmb_sync(&xi->i_metadata_bhs);
+	if (!err)
+		err = xiafs_stage_inode(inode);
+	if (!err)
+		err = xiafs_commit(inode->i_sb);
+	if (err)
+		xiafs_layout_changed(inode);
+out:
+	xiafs_lat_record(inode->i_sb, XIAFS_LAT_FSYNC, now);
+	return err;
 }
 
 /* New functions for iomap support as part of that conversion, including direct
@@ -51,6 +88,7 @@ static int xiafs_dio_write_end_io(struct kiocb *iocb, ssize_t size, int error,
 	pos += size;
 	if (size && pos > i_size_read(inode)) {
 		i_size_write(inode, pos);
+		xiafs_layout_changed(inode);
 		mark_inode_dirty(inode);
 	}
 	return 0;
@@ -193,11 +231,16 @@ int xiafs_setattr(struct mnt_idmap *idmap, struct dentry *dentry, struct iattr *
 
         if ((attr->ia_valid & ATTR_SIZE) &&
             attr->ia_size != i_size_read(inode)) {
+		u64 start;
+
                 error = inode_newsize_ok(inode, attr->ia_size);
                 if (error)
                         return error;
+		start = ktime_get_ns();
 		truncate_setsize(inode, attr->ia_size);
 		xiafs_truncate(inode);
+		xiafs_layout_changed(inode);
+		xiafs_lat_record(inode->i_sb, XIAFS_LAT_TRUNCATE, start);
         }
 
         setattr_copy(&nop_mnt_idmap, inode, attr);
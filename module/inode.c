@@ -27,19 +27,30 @@
 #include <linux/init.h>
 #include <linux/highuid.h>
 #include <linux/mpage.h>
+#include <linux/blkdev.h>
 #include <linux/vfs.h>
+#include <linux/fs_parser.h>
+#include <linux/seq_file.h>
 #include <linux/writeback.h>
 #include <linux/fs_context.h>
 
+#define CREATE_TRACE_POINTS
+#include "trace/events/xiafs.h"
+
 static int xiafs_write_inode(struct inode * inode, struct writeback_control *wbc);
+static int xiafs_sync_fs(struct super_block *sb, int wait);
+static int xiafs_freeze_fs(struct super_block *sb);
+static int xiafs_unfreeze_fs(struct super_block *sb);
 static int xiafs_statfs(struct dentry *dentry, struct kstatfs *buf);
+static int xiafs_show_options(struct seq_file *seq, struct dentry *root);
 
 static void xiafs_evict_inode(struct inode *inode)
 {
 	truncate_inode_pages(&inode->i_data, 0);
 	if (!inode->i_nlink){
 		inode->i_size = 0;
-		xiafs_truncate(inode);
+		if (!xiafs_defer_free(inode))
+			xiafs_truncate(inode);
 	} else {
 		mmb_sync(&xiafs_i(inode)->i_metadata_bhs);
 	}
@@ -54,11 +65,16 @@ static void xiafs_put_super(struct super_block *sb)
 	int i;
 	struct xiafs_sb_info *sbi = xiafs_sb(sb);
 
+	/* evict_inodes() has queued up the last of them by now */
+	xiafs_orphan_destroy(sb);
+	xiafs_unregister_debugfs(sb);
+	xiafs_unregister_sysfs(sb);
 	for (i = 0; i < sbi->s_imap_zones; i++)
 		brelse(sbi->s_imap_buf[i]);
 	for (i = 0; i < sbi->s_zmap_zones; i++)
 		brelse(sbi->s_zmap_buf[i]);
 	kfree(sbi->s_imap_buf);
+	bitmap_free(sbi->s_itable_dirty);
 	sb->s_fs_info = NULL;
 	kfree(sbi);
 }
@@ -72,11 +88,21 @@ static struct inode *xiafs_alloc_inode(struct super_block *sb)
 	if (!ei)
 		return NULL;
 	mmb_init(&ei->i_metadata_bhs, &ei->vfs_inode.i_data);
+	ei->i_dir_entries = -1;
+	ei->i_flags = 0;
+	ei->vfs_inode.i_link = NULL;
 	return &ei->vfs_inode;
 }
 
-static void xiafs_destroy_inode(struct inode *inode)
+/*
+ * Called once an RCU grace period has passed since the inode was let go,
+ * so a path walk that picked up a symlink's cached target can't still be
+ * looking at it.
+ */
+static void xiafs_free_in_core_inode(struct inode *inode)
 {
+	if (S_ISLNK(inode->i_mode) && !xiafs_inode_is_fast_symlink(inode))
+		kfree(inode->i_link);
 	kmem_cache_free(xiafs_inode_cachep, xiafs_i(inode));
 }
 
@@ -106,13 +132,47 @@ static void destroy_inodecache(void)
 
 static const struct super_operations xiafs_sops = {
 	.alloc_inode	= xiafs_alloc_inode,
-	.destroy_inode	= xiafs_destroy_inode,
+	.free_inode	= xiafs_free_in_core_inode,
 	.write_inode	= xiafs_write_inode,
 	.evict_inode	= xiafs_evict_inode,
 	.put_super	= xiafs_put_super,
-	.statfs		= xiafs_statfs
+	.sync_fs	= xiafs_sync_fs,
+	.freeze_fs	= xiafs_freeze_fs,
+	.unfreeze_fs	= xiafs_unfreeze_fs,
+	.statfs		= xiafs_statfs,
+	.show_options	= xiafs_show_options,
+};
+
+/*
+ * Mount options. These get parsed into a struct xiafs_fs_context hung off
+ * the fs_context and copied into the xiafs_sb_info when we get that far.
+ * On remount only the options that were actually given are changed; `spec'
+ * says which those are. noatime, relatime, lazytime and the like are
+ * handled by the VFS and never get here.
+ */
+struct xiafs_fs_context {
+	unsigned int spec;
+	unsigned int inode_ra;
+};
+
+#define XIAFS_SPEC_INODE_RA	0x1
+
+enum {
+	Opt_inode_readahead_blks,
+};
+
+static const struct fs_parameter_spec xiafs_fs_parameters[] = {
+	fsparam_u32("inode_readahead_blks", Opt_inode_readahead_blks),
+	{}
 };
 
+static void xiafs_apply_options(struct xiafs_sb_info *sbi,
+		struct xiafs_fs_context *ctx, bool remount)
+{
+	if (!remount || (ctx->spec & XIAFS_SPEC_INODE_RA))
+		sbi->s_inode_ra = ctx->inode_ra;
+}
+
 static int xiafs_fill_super(struct super_block *s, struct fs_context *fc)
 {
 	struct buffer_head *bh;
@@ -128,6 +188,7 @@ static int xiafs_fill_super(struct super_block *s, struct fs_context *fc)
 	if (!sbi)
 		return -ENOMEM;
 	s->s_fs_info = sbi;
+	xiafs_apply_options(sbi, fc->fs_private, false);
 
 	BUILD_BUG_ON(64 != sizeof(struct xiafs_inode));
 
@@ -154,7 +215,13 @@ static int xiafs_fill_super(struct super_block *s, struct fs_context *fc)
 	sbi->s_firstdatazone = xs->s_firstdatazone;
 	sbi->s_zone_shift = xs->s_zone_shift;
 	sbi->s_max_size = xs->s_max_size;
-
+	sbi->s_features = xs->s_features;
+	if (sbi->s_features & ~XIAFS_FEATURE_ALL) {
+		if (!silent)
+			printk("XIAFS-fs: %s has unsupported features %#lx\n",
+			       s->s_id, sbi->s_features & ~XIAFS_FEATURE_ALL);
+		goto out_release;
+	}
 
 	/*
 	 * Allocate the buffer map to keep the superblock small.
@@ -168,6 +235,25 @@ static int xiafs_fill_super(struct super_block *s, struct fs_context *fc)
 	sbi->s_imap_buf = &map[0];
 	sbi->s_zmap_buf = &map[sbi->s_imap_zones];
 
+	sbi->s_itable_blocks = xiafs_inode_block(sbi, sbi->s_ninodes) -
+		xiafs_inode_block(sbi, 1) + 1;
+	sbi->s_itable_dirty = bitmap_zalloc(sbi->s_itable_blocks, GFP_KERNEL);
+	if (!sbi->s_itable_dirty) {
+		ret = -ENOMEM;
+		goto out_freemap;
+	}
+	mutex_init(&sbi->s_commit_mutex);
+	if (xiafs_orphan_init(s)) {
+		ret = -ENOMEM;
+		goto out_freemap;
+	}
+	ret = xiafs_register_sysfs(s);
+	if (!ret)
+		ret = xiafs_register_debugfs(s);
+	if (ret)
+		goto out_freemap;
+	ret = -EINVAL;
+
 	block=1;
 	for (i=0 ; i < sbi->s_imap_zones ; i++) {
 		if (!(sbi->s_imap_buf[i]=sb_bread(s, block)))
@@ -216,6 +302,10 @@ out_freemap:
 	for (i = 0; i < sbi->s_zmap_zones; i++)
 		brelse(sbi->s_zmap_buf[i]);
 	kfree(sbi->s_imap_buf);
+	bitmap_free(sbi->s_itable_dirty);
+	xiafs_orphan_destroy(s);
+	xiafs_unregister_debugfs(s);
+	xiafs_unregister_sysfs(s);
 	goto out_release;
 
 out_no_map:
@@ -257,7 +347,9 @@ static int xiafs_statfs(struct dentry *dentry, struct kstatfs *buf)
 	buf->f_type = sb->s_magic;
 	buf->f_bsize = sb->s_blocksize;
 	buf->f_blocks = sbi->s_ndatazones;
-	buf->f_bfree = xiafs_count_free_blocks(sbi);
+	/* zones of deleted files count as free even if not yet freed */
+	buf->f_bfree = xiafs_count_free_blocks(sbi) +
+		atomic_long_read(&sbi->s_free_pending);
 	buf->f_bavail = buf->f_bfree;
 	buf->f_files = sbi->s_ninodes;
 	buf->f_ffree = xiafs_count_free_inodes(sbi);
@@ -268,6 +360,15 @@ static int xiafs_statfs(struct dentry *dentry, struct kstatfs *buf)
 	return 0;
 }
 
+static int xiafs_show_options(struct seq_file *seq, struct dentry *root)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(root->d_sb);
+
+	if (sbi->s_inode_ra != XIAFS_DEF_INODE_RA)
+		seq_printf(seq, ",inode_readahead_blks=%u", sbi->s_inode_ra);
+	return 0;
+}
+
 static ssize_t xiafs_writeback_range(struct iomap_writepage_ctx *wpc,
 	struct folio *folio, u64 pos, unsigned int len, u64 end_pos)
 {
@@ -325,6 +426,12 @@ static void xiafs_readahead(struct readahead_control *rac)
 	iomap_bio_readahead(rac, &xiafs_iomap_ops);
 }
 
+/* Directories still go through buffer heads, so their readahead does too. */
+static void xiafs_block_readahead(struct readahead_control *rac)
+{
+	mpage_readahead(rac, xiafs_get_block);
+}
+
 /* bringing this back for directory operations, at least for the time being */
 static int xiafs_write_begin(const struct kiocb *iocb, struct address_space *mapping,
 			loff_t pos, unsigned len,
@@ -373,6 +480,7 @@ static const struct address_space_operations xiafs_dir_aops = {
 	.dirty_folio = block_dirty_folio,
 	.invalidate_folio = block_invalidate_folio,
 	.read_folio = xiafs_block_read_folio,
+	.readahead = xiafs_block_readahead,
 	.write_begin = xiafs_write_begin,
 	.write_end = generic_write_end,
 	.migrate_folio = buffer_migrate_folio,
@@ -415,10 +523,15 @@ struct inode *xiafs_iget(struct super_block *sb, unsigned long ino)
 
 	if (!inode)
 		return ERR_PTR(-ENOMEM);
-	if (!(inode_state_read_once(inode) & I_NEW))
+	if (!(inode_state_read_once(inode) & I_NEW)) {
+		trace_xiafs_iget(sb, ino, true);
 		return inode;
+	}
+	trace_xiafs_iget(sb, ino, false);
+	xiafs_stat_inc(sb, XIAFS_STAT_ITABLE_READS);
 	xiafs_inode = xiafs_i(inode);
 
+	xiafs_inode_readahead(inode->i_sb, inode->i_ino);
 	raw_inode = xiafs_raw_inode(inode->i_sb, inode->i_ino, &bh);
 	if (!raw_inode) {
 		iget_failed(inode);
@@ -437,10 +550,16 @@ struct inode *xiafs_iget(struct super_block *sb, unsigned long ino)
 	inode->i_atime.tv_nsec = 0;
 	inode->i_ctime.tv_nsec = 0;
 	*/
-	inode_set_mtime_to_ts(inode, inode_set_atime_to_ts(inode, inode_set_ctime(inode, raw_inode->i_ctime, 0)));
+	inode_set_mtime(inode, raw_inode->i_mtime, 0);
+	inode_set_atime(inode, raw_inode->i_atime, 0);
+	inode_set_ctime(inode, raw_inode->i_ctime, 0);
 	if (S_ISCHR(inode->i_mode) || S_ISBLK(inode->i_mode)) {
 		inode->i_blocks=0;
 		inode->i_rdev = old_decode_dev(raw_inode->i_zone[0]);
+	} else if (xiafs_fast_symlink(sb, inode->i_mode, inode->i_size)) {
+		inode->i_blocks = 0;
+		memcpy(xiafs_inode->i_zone, raw_inode->i_zone,
+		       sizeof(xiafs_inode->i_zone));
 	} else {
 		XIAFS_GET_BLOCKS(raw_inode, inode->i_blocks);
 		/* Changing this to put the former i_ind and i_dind_zone inode
@@ -452,6 +571,10 @@ struct inode *xiafs_iget(struct super_block *sb, unsigned long ino)
 		    	xiafs_inode->i_zone[zone] = raw_inode->i_zone[zone] & 0xffffff;
 	}
 	xiafs_set_inode(inode, old_decode_dev(raw_inode->i_zone[0]));
+	if (xiafs_fast_symlink(sb, inode->i_mode, inode->i_size)) {
+		inode->i_link = (char *)xiafs_inode->i_zone;
+		inode->i_link[inode->i_size] = '\0';
+	}
 	brelse(bh);
 	unlock_new_inode(inode);
 	return inode;
@@ -480,6 +603,9 @@ static struct buffer_head * xiafs_update_inode(struct inode * inode)
 	raw_inode->i_ctime = inode->i_ctime_sec;
 	if (S_ISCHR(inode->i_mode) || S_ISBLK(inode->i_mode))
 		raw_inode->i_zone[0] = old_encode_dev(inode->i_rdev);
+	else if (xiafs_inode_is_fast_symlink(inode))
+		memcpy(raw_inode->i_zone, xiafs_inode->i_zone,
+		       sizeof(raw_inode->i_zone));
 	else { 
 		XIAFS_PUT_BLOCKS(raw_inode, inode->i_blocks);
 		/* Changing this to put the former i_ind and i_dind_zone inode
@@ -494,15 +620,71 @@ static struct buffer_head * xiafs_update_inode(struct inode * inode)
 	return bh;
 }
 
+/*
+ * With lazytime, inodes whose only change is their timestamps sit in core
+ * as I_DIRTY_TIME until something forces them out. Since we're about to
+ * write this inode table block anyway, copy the times of any such inodes
+ * that live in it into the block too and call them clean, so they ride
+ * along with this write instead of costing one of their own later.
+ * Cribbed from ext4_update_other_inodes_time().
+ */
+static void xiafs_update_other_inodes_time(struct super_block *sb,
+		unsigned long orig_ino, struct buffer_head *bh)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	unsigned long ino, first, last;
+	struct inode *inode;
+
+	first = orig_ino - (orig_ino - 1) % _XIAFS_INODES_PER_BLOCK;
+	last = min_t(unsigned long, first + _XIAFS_INODES_PER_BLOCK - 1,
+		     sbi->s_ninodes);
+
+	rcu_read_lock();
+	for (ino = first; ino <= last; ino++) {
+		struct xiafs_inode *raw_inode;
+
+		if (ino == orig_ino)
+			continue;
+		inode = find_inode_by_ino_rcu(sb, ino);
+		if (!inode || !inode_is_dirtytime_only(inode))
+			continue;
+		spin_lock(&inode->i_lock);
+		if (!inode_is_dirtytime_only(inode)) {
+			spin_unlock(&inode->i_lock);
+			continue;
+		}
+		inode_state_clear(inode, I_DIRTY_TIME);
+		spin_unlock(&inode->i_lock);
+
+		raw_inode = (struct xiafs_inode *)bh->b_data +
+			(ino - 1) % _XIAFS_INODES_PER_BLOCK;
+		raw_inode->i_mtime = inode_get_mtime_sec(inode);
+		raw_inode->i_atime = inode_get_atime_sec(inode);
+		raw_inode->i_ctime = inode_get_ctime_sec(inode);
+	}
+	rcu_read_unlock();
+}
+
 static int xiafs_write_inode(struct inode *inode, struct writeback_control *wbc)
 {
+	struct xiafs_sb_info *sbi = xiafs_sb(inode->i_sb);
 	int err = 0;
 	struct buffer_head *bh;
 
+	trace_xiafs_write_inode(inode, wbc);
 	bh = xiafs_update_inode(inode);
 	if (!bh)
 		return -EIO;
-	if (wbc->sync_mode == WB_SYNC_ALL && buffer_dirty(bh)) {
+	if (inode->i_sb->s_flags & SB_LAZYTIME)
+		xiafs_update_other_inodes_time(inode->i_sb, inode->i_ino, bh);
+	if (wbc->sync_mode == WB_SYNC_ALL && wbc->for_sync) {
+		/* sync(2) and friends call ->sync_fs once they've been
+		 * through every dirty inode, so leave the block for
+		 * xiafs_sync_fs() to write along with the rest. */
+		set_bit(bh->b_blocknr - xiafs_inode_block(sbi, 1),
+			sbi->s_itable_dirty);
+	} else if (wbc->sync_mode == WB_SYNC_ALL && buffer_dirty(bh)) {
+		xiafs_stat_inc(inode->i_sb, XIAFS_STAT_ITABLE_WRITES);
 		sync_dirty_buffer(bh);
 		if (buffer_req(bh) && !buffer_uptodate(bh)) {
 			printk("IO error syncing xiafs inode [%s:%016llx]\n",
@@ -514,12 +696,196 @@ static int xiafs_write_inode(struct inode *inode, struct writeback_control *wbc)
 	return err;
 }
 
+static int xiafs_sync_wait(struct buffer_head *bh)
+{
+	int err = 0;
+
+	wait_on_buffer(bh);
+	if (!buffer_uptodate(bh)) {
+		printk("IO error syncing xiafs metadata [%pg:%llu]\n",
+			bh->b_bdev, (unsigned long long)bh->b_blocknr);
+		err = -EIO;
+	}
+	brelse(bh);
+	return err;
+}
+
+/*
+ * Start writing `bh' if it's dirty and keep it in bhs[] to be waited on
+ * later, or if bhs[] is full, wait for it now. Takes over the caller's
+ * reference either way. A clean buffer is waited on too: it may be clean
+ * only because the flusher or another sync already has its write in
+ * flight, and that write has to be done before the cache flush.
+ */
+static int xiafs_sync_start(struct buffer_head *bh, struct buffer_head **bhs,
+		unsigned long *n, unsigned long max)
+{
+	if (buffer_dirty(bh))
+		write_dirty_buffer(bh, REQ_SYNC);
+	if (*n < max) {
+		bhs[(*n)++] = bh;
+		return 0;
+	}
+	return xiafs_sync_wait(bh);
+}
+
+/*
+ * Write out the file system's own metadata: the imap and zmap blocks and
+ * the inode table blocks xiafs_write_inode() set aside during a sync.
+ * However many inodes in a table block were dirty, the block goes out
+ * once. Everything is submitted in ascending block order under one plug,
+ * so the block layer sees it as a single run, and then waited on together.
+ * Indirect blocks aren't tracked here; they go out with the block device
+ * flush that follows ->sync_fs.
+ */
+static int xiafs_sync_metadata(struct super_block *sb)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	sector_t first = xiafs_inode_block(sbi, 1);
+	unsigned long nmaps = sbi->s_imap_zones + sbi->s_zmap_zones;
+	unsigned long i, n = 0, max;
+	struct buffer_head **bhs;
+	struct blk_plug plug;
+	int err = 0;
+
+	max = nmaps + bitmap_weight(sbi->s_itable_dirty, sbi->s_itable_blocks);
+	bhs = kvmalloc_array(max, sizeof(*bhs), GFP_NOFS);
+	if (!bhs)
+		max = 0;
+
+	blk_start_plug(&plug);
+	/* s_imap_buf and s_zmap_buf are one array, in block order, and all
+	 * of it comes before the inode table. */
+	for (i = 0; i < nmaps; i++) {
+		get_bh(sbi->s_imap_buf[i]);
+		if (xiafs_sync_start(sbi->s_imap_buf[i], bhs, &n, max))
+			err = -EIO;
+	}
+	for (i = 0; ; i++) {
+		struct buffer_head *bh;
+
+		i = find_next_bit(sbi->s_itable_dirty, sbi->s_itable_blocks, i);
+		if (i >= sbi->s_itable_blocks)
+			break;
+		clear_bit(i, sbi->s_itable_dirty);
+		bh = sb_find_get_block(sb, first + i);
+		if (!bh)
+			continue;
+		if (buffer_dirty(bh))
+			xiafs_stat_inc(sb, XIAFS_STAT_ITABLE_WRITES);
+		if (xiafs_sync_start(bh, bhs, &n, max))
+			err = -EIO;
+	}
+	blk_finish_plug(&plug);
+
+	while (n--)
+		if (xiafs_sync_wait(bhs[n]))
+			err = -EIO;
+	kvfree(bhs);
+	return err;
+}
+
+/*
+ * Under s_commit_mutex, so that an xiafs_commit() can't find the inode
+ * table bits already cleared by us and flush before our writes are done.
+ */
+static int xiafs_sync_fs(struct super_block *sb, int wait)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	int err;
+
+	if (!wait)
+		return 0;
+	mutex_lock(&sbi->s_commit_mutex);
+	err = xiafs_sync_metadata(sb);
+	mutex_unlock(&sbi->s_commit_mutex);
+	return err;
+}
+
+/*
+ * Copy an inode into its table block and leave the block for the next
+ * xiafs_commit() (or sync) to write. This goes around the VFS's dirty
+ * tracking, so the inode stays dirty and may get copied again later; that
+ * costs a memcpy, where waiting for writeback that might be in progress
+ * would cost a lot more.
+ */
+int xiafs_stage_inode(struct inode *inode)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(inode->i_sb);
+	struct buffer_head *bh;
+
+	bh = xiafs_update_inode(inode);
+	if (!bh)
+		return -EIO;
+	set_bit(bh->b_blocknr - xiafs_inode_block(sbi, 1), sbi->s_itable_dirty);
+	brelse(bh);
+	return 0;
+}
+
+/*
+ * Group commit for fsync. Callers stage what they need written and then
+ * come here to have it written and the disk cache flushed. Whoever gets
+ * s_commit_mutex first writes out everything staged so far and flushes
+ * once; anybody who had staged their changes before that commit started
+ * finds them already done when they get the mutex, and goes home. While
+ * one commit is running the next batch queues up behind it, so the more
+ * fsyncs there are at once, the more of them share each write and flush.
+ */
+int xiafs_commit(struct super_block *sb)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	u64 seq;
+	int err;
+
+	/* Our changes have to be visible before we look at the counter. */
+	smp_mb();
+	seq = atomic64_read(&sbi->s_commit_start) + 1;
+
+	mutex_lock(&sbi->s_commit_mutex);
+	if (sbi->s_commit_done >= seq) {
+		mutex_unlock(&sbi->s_commit_mutex);
+		return 0;
+	}
+	seq = atomic64_inc_return(&sbi->s_commit_start);
+	err = xiafs_sync_metadata(sb);
+	if (!err)
+		err = blkdev_issue_flush(sb->s_bdev);
+	/* If it failed, let the next caller try again rather than claim
+	 * that everyone waiting got their data out. */
+	if (!err)
+		sbi->s_commit_done = seq;
+	mutex_unlock(&sbi->s_commit_mutex);
+	return err;
+}
+
+/*
+ * freeze_super() has already synced everything by the time we get here;
+ * this just makes sure none of our own metadata is still in flight before
+ * a snapshot is taken.
+ */
+static int xiafs_freeze_fs(struct super_block *sb)
+{
+	/* free deleted files' zones so the snapshot doesn't leak them */
+	xiafs_drain_orphans(sb);
+	return xiafs_sync_fs(sb, 1);
+}
+
+static int xiafs_unfreeze_fs(struct super_block *sb)
+{
+	xiafs_resume_orphans(sb);
+	return 0;
+}
+
 int xiafs_getattr(struct mnt_idmap *idmap, const struct path *path, struct kstat *stat, u32 request_mask, unsigned int flags)
 {
 	struct super_block *sb = path->dentry->d_sb;
 	struct inode *inode = d_inode(path->dentry);
 	generic_fillattr(&nop_mnt_idmap, request_mask, inode, stat);
-	stat->blocks = (sb->s_blocksize / 512) * xiafs_blocks(stat->size, sb);
+	if (xiafs_inode_is_fast_symlink(inode))
+		stat->blocks = 0;
+	else
+		stat->blocks = (sb->s_blocksize / 512) *
+			xiafs_blocks(stat->size, sb);
 	stat->blksize = sb->s_blocksize;
 	return 0;
 }
@@ -533,12 +899,60 @@ static int xiafs_get_tree(struct fs_context *fc)
 	return get_tree_bdev(fc, xiafs_fill_super);
 }
 
+static int xiafs_parse_param(struct fs_context *fc, struct fs_parameter *param)
+{
+	struct xiafs_fs_context *ctx = fc->fs_private;
+	struct fs_parse_result result;
+	int opt;
+
+	opt = fs_parse(fc, xiafs_fs_parameters, param, &result);
+	if (opt < 0)
+		return opt;
+
+	switch (opt) {
+	case Opt_inode_readahead_blks:
+		if (result.uint_32 > XIAFS_MAX_INODE_RA)
+			return invalfc(fc, "inode_readahead_blks must be at most %u",
+				       XIAFS_MAX_INODE_RA);
+		ctx->inode_ra = result.uint_32;
+		ctx->spec |= XIAFS_SPEC_INODE_RA;
+		break;
+	}
+	return 0;
+}
+
+static int xiafs_reconfigure(struct fs_context *fc)
+{
+	struct super_block *sb = fc->root->d_sb;
+
+	if ((fc->sb_flags & SB_RDONLY) && !sb_rdonly(sb))
+		xiafs_drain_orphans(sb);
+	sync_filesystem(sb);
+	xiafs_apply_options(xiafs_sb(sb), fc->fs_private, true);
+	return 0;
+}
+
+static void xiafs_free_fc(struct fs_context *fc)
+{
+	kfree(fc->fs_private);
+}
+
 static const struct fs_context_operations xiafs_context_ops = {
-	.get_tree = xiafs_get_tree,
+	.parse_param	= xiafs_parse_param,
+	.get_tree	= xiafs_get_tree,
+	.reconfigure	= xiafs_reconfigure,
+	.free		= xiafs_free_fc,
 };
 
 static int xiafs_init_fs_context(struct fs_context *fc)
 {
+	struct xiafs_fs_context *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+	ctx->inode_ra = XIAFS_DEF_INODE_RA;
+	fc->fs_private = ctx;
 	fc->ops = &xiafs_context_ops;
 	return 0;
 }
@@ -549,6 +963,7 @@ static struct file_system_type xiafs_fs_type = {
 	.kill_sb	= kill_block_super,
 	.fs_flags	= FS_REQUIRES_DEV,
 	.init_fs_context = xiafs_init_fs_context,
+	.parameters	= xiafs_fs_parameters,
 };
 
 static int __init init_xiafs_fs(void)
@@ -556,10 +971,17 @@ static int __init init_xiafs_fs(void)
 	int err = init_inodecache();
 	if (err)
 		goto out1;
-	err = register_filesystem(&xiafs_fs_type);
+	err = xiafs_init_sysfs();
 	if (err)
 		goto out;
+	xiafs_init_debugfs();
+	err = register_filesystem(&xiafs_fs_type);
+	if (err)
+		goto out_sysfs;
 	return 0;
+out_sysfs:
+	xiafs_exit_debugfs();
+	xiafs_exit_sysfs();
 out:
 	destroy_inodecache();
 out1:
@@ -569,6 +991,8 @@ out1:
 static void __exit exit_xiafs_fs(void)
 {
         unregister_filesystem(&xiafs_fs_type);
+	xiafs_exit_debugfs();
+	xiafs_exit_sysfs();
 	destroy_inodecache();
 }
 
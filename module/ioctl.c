@@ -0,0 +1,374 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * xiafs specific ioctls. Xiafs itself never had any; these are here to help
+ * look after a filesystem that's being actively used.
+ */
+
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/buffer_head.h>
+#include <linux/mount.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
+#include "xiafs.h"
+
+static long xiafs_ioc_compact_dir(struct file *filp, void __user *argp)
+{
+	struct inode *inode = file_inode(filp);
+	struct xiafs_dir_compact dc;
+	int err;
+
+	if (!S_ISDIR(inode->i_mode))
+		return -ENOTDIR;
+	if (!inode_owner_or_capable(file_mnt_idmap(filp), inode))
+		return -EACCES;
+
+	err = mnt_want_write_file(filp);
+	if (err)
+		return err;
+	inode_lock(inode);
+	err = xiafs_compact_dir(inode, &dc);
+	inode_unlock(inode);
+	mnt_drop_write_file(filp);
+	if (err)
+		return err;
+
+	if (copy_to_user(argp, &dc, sizeof(dc)))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Filling in struct xiafs_stat, either from an inode that's in core or
+ * straight from its inode table entry. The numbers are the same ones
+ * xiafs_getattr() hands out.
+ */
+static void xiafs_stat_inode(struct inode *inode, struct xiafs_stat *xs)
+{
+	struct super_block *sb = inode->i_sb;
+
+	xs->xs_ino = inode->i_ino;
+	xs->xs_size = i_size_read(inode);
+	if (xiafs_inode_is_fast_symlink(inode))
+		xs->xs_blocks = 0;
+	else
+		xs->xs_blocks = (sb->s_blocksize / 512) *
+			xiafs_blocks(xs->xs_size, sb);
+	xs->xs_atime = inode_get_atime_sec(inode);
+	xs->xs_mtime = inode_get_mtime_sec(inode);
+	xs->xs_ctime = inode_get_ctime_sec(inode);
+	xs->xs_mode = inode->i_mode;
+	xs->xs_nlink = inode->i_nlink;
+	xs->xs_uid = from_kuid_munged(current_user_ns(), inode->i_uid);
+	xs->xs_gid = from_kgid_munged(current_user_ns(), inode->i_gid);
+}
+
+static void xiafs_stat_raw(struct super_block *sb, ino_t ino,
+		struct xiafs_inode *raw_inode, struct xiafs_stat *xs)
+{
+	xs->xs_ino = ino;
+	xs->xs_size = raw_inode->i_size;
+	if (xiafs_fast_symlink(sb, raw_inode->i_mode, xs->xs_size))
+		xs->xs_blocks = 0;
+	else
+		xs->xs_blocks = (sb->s_blocksize / 512) *
+			xiafs_blocks(xs->xs_size, sb);
+	xs->xs_atime = raw_inode->i_atime;
+	xs->xs_mtime = raw_inode->i_mtime;
+	xs->xs_ctime = raw_inode->i_ctime;
+	xs->xs_mode = raw_inode->i_mode;
+	xs->xs_nlink = raw_inode->i_nlinks;
+	xs->xs_uid = from_kuid_munged(current_user_ns(),
+			make_kuid(sb->s_user_ns, raw_inode->i_uid));
+	xs->xs_gid = from_kgid_munged(current_user_ns(),
+			make_kgid(sb->s_user_ns, raw_inode->i_gid));
+}
+
+/* How much of a READDIRPLUS buffer we're willing to fill in one go. */
+#define XIAFS_RDP_MAX_BUF	(256 * 1024)
+
+struct xiafs_rdp_ent {
+	u32 ino;
+	u32 off;		/* of its record in the buffer */
+	bool done;
+};
+
+struct xiafs_rdp {
+	struct dir_context ctx;
+	char *buf;
+	u32 size;
+	u32 used;
+	u32 count;
+	struct xiafs_rdp_ent *ents;
+};
+
+static bool xiafs_rdp_fill(struct dir_context *ctx, const char *name,
+		int namelen, loff_t offset, u64 ino, unsigned int d_type)
+{
+	struct xiafs_rdp *rdp = container_of(ctx, struct xiafs_rdp, ctx);
+	struct xiafs_direntplus *dp;
+	u32 reclen = XIAFS_DIRENTPLUS_LEN(namelen);
+
+	if (rdp->used + reclen > rdp->size)
+		return false;
+	dp = (struct xiafs_direntplus *)(rdp->buf + rdp->used);
+	dp->dp_stat.xs_ino = ino;
+	dp->dp_reclen = reclen;
+	dp->dp_name_len = namelen;
+	memcpy(dp->dp_name, name, namelen);
+	rdp->ents[rdp->count].ino = ino;
+	rdp->ents[rdp->count].off = rdp->used;
+	rdp->ents[rdp->count].done = false;
+	rdp->count++;
+	rdp->used += reclen;
+	return true;
+}
+
+static int xiafs_rdp_cmp(const void *a, const void *b)
+{
+	const struct xiafs_rdp_ent *x = a, *y = b;
+
+	if (x->ino != y->ino)
+		return x->ino < y->ino ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Fill in the attributes for everything readdir put in the buffer. Inodes
+ * that are in core are taken from there. For the rest, we go through the
+ * entries in inode number order, start reads for every inode table block
+ * we'll need up front, and then pick the inodes out of those blocks, so a
+ * directory costs about one read per inode table block it touches rather
+ * than one per entry.
+ */
+static int xiafs_rdp_stat(struct super_block *sb, struct xiafs_rdp *rdp)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	struct buffer_head *bh = NULL;
+	struct blk_plug plug;
+	sector_t block, last = 0;
+	u32 i;
+	int err = 0;
+
+	sort(rdp->ents, rdp->count, sizeof(*rdp->ents), xiafs_rdp_cmp, NULL);
+
+	blk_start_plug(&plug);
+	for (i = 0; i < rdp->count; i++) {
+		struct xiafs_rdp_ent *ent = &rdp->ents[i];
+		struct xiafs_direntplus *dp = (void *)(rdp->buf + ent->off);
+		struct inode *inode;
+
+		if (!ent->ino || ent->ino > sbi->s_ninodes) {
+			ent->done = true;
+			continue;
+		}
+		inode = ilookup(sb, ent->ino);
+		if (inode) {
+			xiafs_stat_inode(inode, &dp->dp_stat);
+			iput(inode);
+			ent->done = true;
+			continue;
+		}
+		block = xiafs_inode_block(sbi, ent->ino);
+		if (block != last)
+			sb_breadahead(sb, block);
+		last = block;
+	}
+	blk_finish_plug(&plug);
+
+	for (i = 0; i < rdp->count; i++) {
+		struct xiafs_rdp_ent *ent = &rdp->ents[i];
+		struct xiafs_direntplus *dp = (void *)(rdp->buf + ent->off);
+		struct xiafs_inode *raw_inode;
+
+		if (ent->done)
+			continue;
+		block = xiafs_inode_block(sbi, ent->ino);
+		if (!bh || bh->b_blocknr != block) {
+			brelse(bh);
+			bh = sb_bread(sb, block);
+			if (!bh) {
+				err = -EIO;
+				break;
+			}
+		}
+		raw_inode = (struct xiafs_inode *)bh->b_data +
+			(ent->ino - 1) % _XIAFS_INODES_PER_BLOCK;
+		xiafs_stat_raw(sb, ent->ino, raw_inode, &dp->dp_stat);
+	}
+	brelse(bh);
+	return err;
+}
+
+static long xiafs_ioc_readdirplus(struct file *filp, void __user *argp)
+{
+	struct inode *dir = file_inode(filp);
+	struct xiafs_readdirplus rp;
+	struct xiafs_rdp rdp = {
+		.ctx.actor = xiafs_rdp_fill,
+	};
+	int err;
+
+	if (copy_from_user(&rp, argp, sizeof(rp)))
+		return -EFAULT;
+	if (!S_ISDIR(dir->i_mode))
+		return -ENOTDIR;
+	/* stat(2) of the entries would need search permission too */
+	err = inode_permission(file_mnt_idmap(filp), dir, MAY_EXEC);
+	if (err)
+		return err;
+	if (rp.rp_bufsize < XIAFS_DIRENTPLUS_LEN(_XIAFS_NAME_LEN))
+		return -EINVAL;
+
+	rdp.size = min_t(u32, rp.rp_bufsize, XIAFS_RDP_MAX_BUF);
+	rdp.buf = kvzalloc(rdp.size, GFP_KERNEL);
+	rdp.ents = kvmalloc_array(rdp.size / XIAFS_DIRENTPLUS_LEN(1),
+			sizeof(*rdp.ents), GFP_KERNEL);
+	err = -ENOMEM;
+	if (!rdp.buf || !rdp.ents)
+		goto out;
+
+	rdp.ctx.pos = rp.rp_cookie;
+	err = -ENOENT;
+	inode_lock_shared(dir);
+	if (!IS_DEADDIR(dir))
+		err = do_xiafs_readdir(filp, &rdp.ctx);
+	inode_unlock_shared(dir);
+	if (err)
+		goto out;
+
+	err = xiafs_rdp_stat(dir->i_sb, &rdp);
+	if (err)
+		goto out;
+
+	err = -EFAULT;
+	if (copy_to_user(u64_to_user_ptr(rp.rp_buf), rdp.buf, rdp.used))
+		goto out;
+	rp.rp_cookie = rdp.ctx.pos;
+	rp.rp_count = rdp.count;
+	rp.rp_used = rdp.used;
+	rp.rp_flags = rdp.ctx.pos >= i_size_read(dir) ? XIAFS_RDP_EOF : 0;
+	if (copy_to_user(argp, &rp, sizeof(rp)))
+		goto out;
+	err = 0;
+out:
+	kvfree(rdp.ents);
+	kvfree(rdp.buf);
+	return err;
+}
+
+/* Most records one BULKSTAT call hands back, and how far ahead it reads. */
+#define XIAFS_BS_MAX		4096
+#define XIAFS_BS_RA		64
+
+/*
+ * Walk the imap from bs_ino, reading the inode table for the inodes that
+ * are in use. The table is read ahead XIAFS_BS_RA blocks at a time, so a
+ * full scan is one long sequential read. Nothing is brought into the inode
+ * cache; inodes that are already there are reported from the in-core copy,
+ * since that may be newer than what's on disk.
+ */
+static long xiafs_ioc_bulkstat(struct file *filp, void __user *argp)
+{
+	struct super_block *sb = file_inode(filp)->i_sb;
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	struct xiafs_bulkstat bs;
+	struct xiafs_stat *xs;
+	struct buffer_head *bh = NULL;
+	sector_t block, ra_end = 0, table_end;
+	unsigned long ino;
+	u32 n = 0, count;
+	int err = 0;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (copy_from_user(&bs, argp, sizeof(bs)))
+		return -EFAULT;
+	if (!bs.bs_count)
+		return -EINVAL;
+
+	count = min_t(u32, bs.bs_count, XIAFS_BS_MAX);
+	xs = kvmalloc_array(count, sizeof(*xs), GFP_KERNEL);
+	if (!xs)
+		return -ENOMEM;
+
+	table_end = xiafs_inode_block(sbi, sbi->s_ninodes) + 1;
+	ino = bs.bs_ino > sbi->s_ninodes ? 0 :
+		xiafs_next_inode(sb, max_t(u64, bs.bs_ino, 1));
+	while (ino && n < count) {
+		struct xiafs_inode *raw_inode;
+		struct inode *inode;
+
+		inode = ilookup(sb, ino);
+		if (inode) {
+			xiafs_stat_inode(inode, &xs[n++]);
+			iput(inode);
+			goto next;
+		}
+
+		block = xiafs_inode_block(sbi, ino);
+		if (!bh || bh->b_blocknr != block) {
+			brelse(bh);
+			if (block >= ra_end) {
+				struct blk_plug plug;
+				sector_t b;
+
+				ra_end = min_t(sector_t, block + XIAFS_BS_RA,
+					       table_end);
+				blk_start_plug(&plug);
+				for (b = block; b < ra_end; b++)
+					sb_breadahead(sb, b);
+				blk_finish_plug(&plug);
+			}
+			bh = sb_bread(sb, block);
+			if (!bh) {
+				err = -EIO;
+				break;
+			}
+		}
+		raw_inode = (struct xiafs_inode *)bh->b_data +
+			(ino - 1) % _XIAFS_INODES_PER_BLOCK;
+		xiafs_stat_raw(sb, ino, raw_inode, &xs[n++]);
+next:
+		ino = xiafs_next_inode(sb, ino + 1);
+		if (fatal_signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+	brelse(bh);
+	if (err && !n)
+		goto out;
+
+	err = -EFAULT;
+	if (copy_to_user(u64_to_user_ptr(bs.bs_buf), xs, n * sizeof(*xs)))
+		goto out;
+	bs.bs_flags = ino ? 0 : XIAFS_BS_EOF;
+	bs.bs_ino = ino ? ino : sbi->s_ninodes + 1;
+	bs.bs_count = n;
+	if (copy_to_user(argp, &bs, sizeof(bs)))
+		goto out;
+	err = 0;
+out:
+	kvfree(xs);
+	return err;
+}
+
+long xiafs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	void __user *argp = (void __user *)arg;
+
+	switch (cmd) {
+	case XIAFS_IOC_COMPACT_DIR:
+		return xiafs_ioc_compact_dir(filp, argp);
+	case XIAFS_IOC_READDIRPLUS:
+		return xiafs_ioc_readdirplus(filp, argp);
+	case XIAFS_IOC_BULKSTAT:
+		return xiafs_ioc_bulkstat(filp, argp);
+	default:
+		return -ENOTTY;
+	}
+}
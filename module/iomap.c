@@ -7,6 +7,7 @@
 
 #include <linux/buffer_head.h>
 #include "xiafs.h"
+#include "trace/events/xiafs.h"
 
 /* DEPTH = 3; direct, indirect, doubly indirect */
 #define DEPTH 3
@@ -72,6 +73,10 @@ cleanup:
 			brelse(partial->bh);
 			partial--;
 		}
+		trace_xiafs_iomap_begin(inode, offset, length, flags, iomap,
+					err);
+		xiafs_stat_inc(sb, XIAFS_STAT_IOMAP_CALLS);
+		xiafs_stat_add(sb, XIAFS_STAT_IOMAP_BYTES, iomap->length);
 out:
 		return err;
 	}
@@ -106,13 +111,18 @@ changed:
 }
 
 /*
- * xiafs_iomap_end ends up bieng a nop; since xiafs doesn't have any extents or
- * transactions to worry about, there isn't anything to update here. The on-disk
- * indirect blocks get dirtied in xiafs_iomap_begin.
+ * xiafs_iomap_end is nearly a nop; since xiafs doesn't have any extents or
+ * transactions to worry about, there isn't much to update here. The on-disk
+ * indirect blocks get dirtied in xiafs_iomap_begin. A buffered write past EOF
+ * has moved i_size, though, and that has to make it to disk.
  */
 static int xiafs_iomap_end(struct inode *inode, loff_t offset, loff_t length,
 	ssize_t written, unsigned flags, struct iomap *iomap)
 {
+	if (iomap->flags & IOMAP_F_SIZE_CHANGED) {
+		xiafs_layout_changed(inode);
+		mark_inode_dirty(inode);
+	}
 	return 0;
 }
 
@@ -0,0 +1,557 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit tests for the block mapping code in itree.c and the zone allocator
+ * it calls (block_to_path, get_branch, alloc_branch, splice_branch,
+ * xiafs_new_block, xiafs_free_block and count_used), for each of the
+ * three zone sizes. There's no disk: the superblock is made up, the zmap
+ * is a couple of buffers, and the indirect zones are kept in memory and
+ * handed to itree.c through the XIAFS_KUNIT_STUB hooks.
+ *
+ * The *_bench cases don't check much; they log how long the primitives
+ * take, in ns per call, so changes to them can be measured. They're
+ * marked slow, so kunit.filter="speed>slow" leaves them out.
+ *
+ * Included at the end of itree.c when built with XIAFS_KUNIT_TEST=y.
+ */
+
+#include <kunit/test.h>
+#include <linux/backing-dev.h>
+#include <linux/xarray.h>
+#include "bitmap.h"
+
+#define XIAFS_TEST_ZMAP_ZONES	2
+#define XIAFS_TEST_FIRSTDATA	64
+
+struct xiafs_test {
+	struct super_block sb;
+	struct xiafs_sb_info sbi;
+	struct xiafs_inode_info ei;
+	struct super_operations sops;
+	struct buffer_head *zmap[XIAFS_TEST_ZMAP_ZONES];
+	struct xarray zones;		/* zone number -> buffer_head */
+	bool fail_reads;
+};
+
+static const int xiafs_test_zshifts[] = { 0, 1, 2 };
+
+static void xiafs_test_zshift_desc(const int *zshift, char *desc)
+{
+	snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%dKB zones", 1 << *zshift);
+}
+
+KUNIT_ARRAY_PARAM(xiafs_test_zshift, xiafs_test_zshifts, xiafs_test_zshift_desc);
+
+/* A zone's worth of zeroes, dirty already so mark_buffer_dirty() is a no-op. */
+static struct buffer_head *xiafs_test_bh(struct xiafs_test *t)
+{
+	struct buffer_head *bh = alloc_buffer_head(GFP_KERNEL);
+
+	if (!bh)
+		return NULL;
+	bh->b_data = kzalloc(t->sb.s_blocksize, GFP_KERNEL);
+	if (!bh->b_data) {
+		free_buffer_head(bh);
+		return NULL;
+	}
+	bh->b_size = t->sb.s_blocksize;
+	set_buffer_uptodate(bh);
+	set_buffer_dirty(bh);
+	return bh;
+}
+
+static void xiafs_test_free_bh(struct buffer_head *bh)
+{
+	kfree(bh->b_data);
+	free_buffer_head(bh);
+}
+
+static struct buffer_head *xiafs_test_getblk(struct super_block *sb,
+		sector_t nr)
+{
+	struct xiafs_test *t = container_of(sb, struct xiafs_test, sb);
+	struct buffer_head *bh = xa_load(&t->zones, nr);
+
+	if (!bh) {
+		bh = xiafs_test_bh(t);
+		if (!bh)
+			return NULL;
+		if (xa_err(xa_store(&t->zones, nr, bh, GFP_KERNEL))) {
+			xiafs_test_free_bh(bh);
+			return NULL;
+		}
+	}
+	get_bh(bh);
+	return bh;
+}
+
+static struct buffer_head *xiafs_test_bread(struct super_block *sb,
+		sector_t nr)
+{
+	struct xiafs_test *t = container_of(sb, struct xiafs_test, sb);
+
+	if (t->fail_reads)
+		return NULL;
+	return xiafs_test_getblk(sb, nr);
+}
+
+static void xiafs_test_dirty_indirect(struct inode *inode,
+		struct buffer_head *bh)
+{
+	/* nothing to write back to */
+}
+
+static void xiafs_test_cleanup(void *data)
+{
+	struct xiafs_test *t = data;
+	struct buffer_head *bh;
+	unsigned long nr;
+	int i;
+
+	xa_for_each(&t->zones, nr, bh)
+		xiafs_test_free_bh(bh);
+	xa_destroy(&t->zones);
+	for (i = 0; i < XIAFS_TEST_ZMAP_ZONES; i++)
+		if (t->zmap[i])
+			xiafs_test_free_bh(t->zmap[i]);
+	free_percpu(t->sbi.s_stats);
+}
+
+/*
+ * A file system of two zmap zones' worth of data zones, every one of
+ * them free, and an empty regular file on it.
+ */
+static struct xiafs_test *xiafs_test_setup(struct kunit *test)
+{
+	int zshift = *(const int *)test->param_value;
+	struct super_block *sb;
+	struct xiafs_sb_info *sbi;
+	struct inode *inode;
+	struct xiafs_test *t;
+	unsigned long addrs;
+	int i;
+
+	t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, t);
+	xa_init(&t->zones);
+	KUNIT_ASSERT_EQ(test, 0,
+			kunit_add_action_or_reset(test, xiafs_test_cleanup, t));
+
+	sb = &t->sb;
+	sbi = &t->sbi;
+	sbi->s_zone_shift = zshift;
+	sb->s_fs_info = sbi;
+	sb->s_op = &t->sops;
+	sb->s_bdi = &noop_backing_dev_info;
+	sb->s_blocksize = XIAFS_ZSIZE(sbi);
+	sb->s_blocksize_bits = XIAFS_ZSIZE_BITS(sbi);
+	sb->s_maxbytes = MAX_LFS_FILESIZE;
+	sb->s_time_gran = 1;
+	sb->s_time_max = S32_MAX;
+	strscpy(sb->s_id, "xiafs-test", sizeof(sb->s_id));
+
+	/* as mkxfs works them out */
+	addrs = XIAFS_ADDRS_PER_Z(sbi);
+	sbi->s_max_size = zshift == 2 ? 0xffffffff :
+		((addrs + 1) * addrs + DIRECT) * XIAFS_ZSIZE(sbi);
+	sbi->s_zmap_zones = XIAFS_TEST_ZMAP_ZONES;
+	sbi->s_firstdatazone = XIAFS_TEST_FIRSTDATA;
+	/* bit 0 of the zmap isn't a zone; every other bit is */
+	sbi->s_nzones = sbi->s_firstdatazone - 1 +
+		(XIAFS_TEST_ZMAP_ZONES << XIAFS_BITS_PER_Z_BITS(sbi));
+	sbi->s_ndatazones = sbi->s_nzones - sbi->s_firstdatazone;
+	sbi->s_zmap_buf = t->zmap;
+	sbi->s_stats = alloc_percpu(struct xiafs_stats);
+	KUNIT_ASSERT_NOT_NULL(test, sbi->s_stats);
+	for (i = 0; i < XIAFS_TEST_ZMAP_ZONES; i++) {
+		t->zmap[i] = xiafs_test_bh(t);
+		KUNIT_ASSERT_NOT_NULL(test, t->zmap[i]);
+	}
+	xiafs_set_bit(0, t->zmap[0]->b_data);
+
+	inode = &t->ei.vfs_inode;
+	inode->i_sb = sb;
+	inode->i_ino = 12;
+	inode->i_mode = S_IFREG | 0644;
+	inode->i_blkbits = sb->s_blocksize_bits;
+	spin_lock_init(&inode->i_lock);
+
+	kunit_activate_static_stub(test, xiafs_bread, xiafs_test_bread);
+	kunit_activate_static_stub(test, xiafs_getblk, xiafs_test_getblk);
+	kunit_activate_static_stub(test, xiafs_dirty_indirect,
+				   xiafs_test_dirty_indirect);
+	return t;
+}
+
+/* The pointers in an indirect zone that's been handed out. */
+static block_t *xiafs_test_zone(struct kunit *test, struct xiafs_test *t,
+		unsigned long nr)
+{
+	struct buffer_head *bh = xa_load(&t->zones, nr);
+
+	KUNIT_ASSERT_NOT_NULL(test, bh);
+	return (block_t *)bh->b_data;
+}
+
+/* Every get_branch() and alloc_branch() reference should be dropped. */
+static void xiafs_test_check_refs(struct kunit *test, struct xiafs_test *t)
+{
+	struct buffer_head *bh;
+	unsigned long nr;
+
+	xa_for_each(&t->zones, nr, bh)
+		KUNIT_EXPECT_EQ_MSG(test, atomic_read(&bh->b_count), 0,
+				    "zone %lu", nr);
+}
+
+/* What get_block() does: find the block, allocating it if need be. */
+static unsigned long xiafs_test_map(struct kunit *test, struct inode *inode,
+		long block)
+{
+	int offsets[DEPTH];
+	Indirect chain[DEPTH], *partial;
+	int depth, err, left;
+	unsigned long nr;
+
+	depth = block_to_path(inode, block, offsets);
+	KUNIT_ASSERT_GT(test, depth, 0);
+	partial = get_branch(inode, depth, offsets, chain, &err);
+	if (partial) {
+		KUNIT_ASSERT_EQ(test, err, 0);
+		left = (chain + depth) - partial;
+		KUNIT_ASSERT_EQ(test, 0, alloc_branch(inode, left,
+				offsets + (partial - chain), partial));
+		KUNIT_ASSERT_EQ(test, 0,
+				splice_branch(inode, chain, partial, left));
+	}
+	partial = chain + depth - 1;
+	nr = block_to_cpu(partial->key);
+	while (partial > chain) {
+		brelse(partial->bh);
+		partial--;
+	}
+	return nr;
+}
+
+static void xiafs_test_block_to_path(struct kunit *test)
+{
+	struct xiafs_test *t = xiafs_test_setup(test);
+	struct inode *inode = &t->ei.vfs_inode;
+	long a = XIAFS_ADDRS_PER_Z(&t->sbi), limit;
+	int off[DEPTH];
+
+	KUNIT_EXPECT_EQ(test, block_to_path(inode, 0, off), 1);
+	KUNIT_EXPECT_EQ(test, off[0], 0);
+	KUNIT_EXPECT_EQ(test, block_to_path(inode, DIRECT - 1, off), 1);
+	KUNIT_EXPECT_EQ(test, off[0], DIRECT - 1);
+
+	KUNIT_EXPECT_EQ(test, block_to_path(inode, DIRECT, off), 2);
+	KUNIT_EXPECT_EQ(test, off[0], 8);
+	KUNIT_EXPECT_EQ(test, off[1], 0);
+	KUNIT_EXPECT_EQ(test, block_to_path(inode, DIRECT + a - 1, off), 2);
+	KUNIT_EXPECT_EQ(test, off[0], 8);
+	KUNIT_EXPECT_EQ(test, off[1], a - 1);
+
+	KUNIT_EXPECT_EQ(test, block_to_path(inode, DIRECT + a, off), 3);
+	KUNIT_EXPECT_EQ(test, off[0], 9);
+	KUNIT_EXPECT_EQ(test, off[1], 0);
+	KUNIT_EXPECT_EQ(test, off[2], 0);
+	KUNIT_EXPECT_EQ(test, block_to_path(inode, DIRECT + 2 * a + 2, off), 3);
+	KUNIT_EXPECT_EQ(test, off[0], 9);
+	KUNIT_EXPECT_EQ(test, off[1], 1);
+	KUNIT_EXPECT_EQ(test, off[2], 2);
+
+	/* With 4KB zones s_max_size stops short of what the tree can map. */
+	limit = min_t(long, DIRECT + a + a * a,
+		      t->sbi.s_max_size / t->sb.s_blocksize);
+	KUNIT_EXPECT_EQ(test, block_to_path(inode, limit - 1, off), 3);
+	KUNIT_EXPECT_EQ(test, off[0], 9);
+	KUNIT_EXPECT_EQ(test, block_to_path(inode, limit, off), 0);
+	KUNIT_EXPECT_EQ(test, block_to_path(inode, -1, off), 0);
+}
+
+static void xiafs_test_new_block(struct kunit *test)
+{
+	struct xiafs_test *t = xiafs_test_setup(test);
+	struct inode *inode = &t->ei.vfs_inode;
+	struct xiafs_sb_info *sbi = &t->sbi;
+	unsigned long bpz = XIAFS_BITS_PER_Z(sbi);
+	int first = sbi->s_firstdatazone;
+	blkcnt_t per_zone = 2 << XIAFS_ZSHIFT(sbi);
+
+	KUNIT_EXPECT_EQ(test, xiafs_count_free_blocks(sbi), 2 * bpz - 1);
+	KUNIT_EXPECT_EQ(test, xiafs_new_block(inode), first);
+	KUNIT_EXPECT_EQ(test, xiafs_new_block(inode), first + 1);
+	KUNIT_EXPECT_EQ(test, inode->i_blocks, 2 * per_zone);
+	KUNIT_EXPECT_EQ(test, xiafs_count_free_blocks(sbi), 2 * bpz - 3);
+
+	/* first fit: a zone just freed is the next one handed out */
+	xiafs_free_block(inode, first);
+	KUNIT_EXPECT_EQ(test, inode->i_blocks, per_zone);
+	KUNIT_EXPECT_EQ(test, xiafs_count_free_blocks(sbi), 2 * bpz - 2);
+	KUNIT_EXPECT_EQ(test, xiafs_new_block(inode), first);
+
+	/* on to the second zmap zone once the first is full */
+	memset(t->zmap[0]->b_data, 0xff, t->sb.s_blocksize);
+	KUNIT_EXPECT_EQ(test, xiafs_new_block(inode), first - 1 + (int)bpz);
+
+	/* the last bit is the last zone */
+	memset(t->zmap[1]->b_data, 0xff, t->sb.s_blocksize);
+	xiafs_test_and_clear_bit(bpz - 1, t->zmap[1]->b_data);
+	KUNIT_EXPECT_EQ(test, xiafs_count_free_blocks(sbi), 1);
+	KUNIT_EXPECT_EQ(test, xiafs_new_block(inode), (int)sbi->s_nzones - 1);
+	KUNIT_EXPECT_EQ(test, xiafs_count_free_blocks(sbi), 0);
+	KUNIT_EXPECT_EQ(test, xiafs_new_block(inode), 0);
+
+	/* zones outside the data area can't be freed */
+	xiafs_free_block(inode, first - 1);
+	xiafs_free_block(inode, sbi->s_nzones);
+	KUNIT_EXPECT_EQ(test, xiafs_count_free_blocks(sbi), 0);
+	xiafs_free_block(inode, sbi->s_nzones - 1);
+	KUNIT_EXPECT_EQ(test, xiafs_count_free_blocks(sbi), 1);
+}
+
+static void xiafs_test_count_used(struct kunit *test)
+{
+	struct xiafs_test *t = xiafs_test_setup(test);
+	struct xiafs_sb_info *sbi = &t->sbi;
+	unsigned long bpz = XIAFS_BITS_PER_Z(sbi), bit, used = 0;
+
+	/* every third bit of the first zmap zone, and all of the second */
+	for (bit = 0; bit < bpz; bit += 3) {
+		xiafs_set_bit(bit, t->zmap[0]->b_data);
+		used++;
+	}
+	memset(t->zmap[1]->b_data, 0xff, t->sb.s_blocksize);
+	used += bpz;
+	KUNIT_EXPECT_EQ(test, xiafs_count_free_blocks(sbi), 2 * bpz - used);
+}
+
+static void xiafs_test_get_branch(struct kunit *test)
+{
+	struct xiafs_test *t = xiafs_test_setup(test);
+	struct inode *inode = &t->ei.vfs_inode;
+	long a = XIAFS_ADDRS_PER_Z(&t->sbi);
+	block_t *idata = i_data(inode), *ind;
+	unsigned long first = t->sbi.s_firstdatazone;
+	Indirect chain[DEPTH];
+	int off[DEPTH], err;
+
+	/* direct: a hole, then a zone */
+	KUNIT_ASSERT_EQ(test, block_to_path(inode, 3, off), 1);
+	KUNIT_EXPECT_PTR_EQ(test, get_branch(inode, 1, off, chain, &err),
+			    chain);
+	KUNIT_EXPECT_EQ(test, err, 0);
+	idata[3] = cpu_to_block(first + 5);
+	KUNIT_EXPECT_NULL(test, get_branch(inode, 1, off, chain, &err));
+	KUNIT_EXPECT_EQ(test, block_to_cpu(chain[0].key), first + 5);
+
+	/* indirect: a hole in the indirect zone, then a zone */
+	idata[8] = cpu_to_block(first + 10);
+	KUNIT_ASSERT_EQ(test, block_to_path(inode, DIRECT + 7, off), 2);
+	KUNIT_EXPECT_PTR_EQ(test, get_branch(inode, 2, off, chain, &err),
+			    chain + 1);
+	KUNIT_EXPECT_EQ(test, err, 0);
+	brelse(chain[1].bh);
+	ind = xiafs_test_zone(test, t, first + 10);
+	ind[7] = cpu_to_block(first + 11);
+	KUNIT_EXPECT_NULL(test, get_branch(inode, 2, off, chain, &err));
+	KUNIT_EXPECT_EQ(test, block_to_cpu(chain[1].key), first + 11);
+	KUNIT_EXPECT_PTR_EQ(test, chain[1].p, ind + 7);
+	brelse(chain[1].bh);
+
+	/* double indirect */
+	idata[9] = cpu_to_block(first + 20);
+	KUNIT_ASSERT_EQ(test, block_to_path(inode, DIRECT + 2 * a + 2, off), 3);
+	KUNIT_EXPECT_PTR_EQ(test, get_branch(inode, 3, off, chain, &err),
+			    chain + 1);
+	brelse(chain[1].bh);
+	xiafs_test_zone(test, t, first + 20)[1] = cpu_to_block(first + 21);
+	KUNIT_EXPECT_PTR_EQ(test, get_branch(inode, 3, off, chain, &err),
+			    chain + 2);
+	brelse(chain[1].bh);
+	brelse(chain[2].bh);
+	xiafs_test_zone(test, t, first + 21)[2] = cpu_to_block(first + 22);
+	KUNIT_EXPECT_NULL(test, get_branch(inode, 3, off, chain, &err));
+	KUNIT_EXPECT_EQ(test, block_to_cpu(chain[2].key), first + 22);
+	brelse(chain[1].bh);
+	brelse(chain[2].bh);
+
+	/* an indirect zone that can't be read */
+	t->fail_reads = true;
+	KUNIT_EXPECT_PTR_EQ(test, get_branch(inode, 3, off, chain, &err),
+			    chain);
+	KUNIT_EXPECT_EQ(test, err, -EIO);
+	t->fail_reads = false;
+
+	xiafs_test_check_refs(test, t);
+}
+
+static void xiafs_test_alloc_splice(struct kunit *test)
+{
+	struct xiafs_test *t = xiafs_test_setup(test);
+	struct inode *inode = &t->ei.vfs_inode;
+	struct xiafs_sb_info *sbi = &t->sbi;
+	long a = XIAFS_ADDRS_PER_Z(sbi), block = DIRECT + a;
+	blkcnt_t per_zone = 2 << XIAFS_ZSHIFT(sbi);
+	unsigned long first = sbi->s_firstdatazone, nfree;
+	Indirect chain[DEPTH], *partial;
+	int off[DEPTH], err;
+
+	/* a whole double indirect branch: the two indirect zones and data */
+	KUNIT_EXPECT_EQ(test, xiafs_test_map(test, inode, block), first + 2);
+	KUNIT_EXPECT_EQ(test, block_to_cpu(i_data(inode)[9]), first);
+	KUNIT_EXPECT_EQ(test, block_to_cpu(xiafs_test_zone(test, t, first)[0]),
+			first + 1);
+	KUNIT_EXPECT_EQ(test,
+			block_to_cpu(xiafs_test_zone(test, t, first + 1)[0]),
+			first + 2);
+	KUNIT_EXPECT_EQ(test, inode->i_blocks, 3 * per_zone);
+
+	/* found again without allocating anything */
+	KUNIT_EXPECT_EQ(test, xiafs_test_map(test, inode, block), first + 2);
+	KUNIT_EXPECT_EQ(test, inode->i_blocks, 3 * per_zone);
+
+	/* the next second level indirect zone grows off the same first one */
+	KUNIT_EXPECT_EQ(test, xiafs_test_map(test, inode, block + a), first + 4);
+	KUNIT_EXPECT_EQ(test, block_to_cpu(xiafs_test_zone(test, t, first)[1]),
+			first + 3);
+
+	/*
+	 * Someone else got the slot in between: splice_branch() has to back
+	 * off and give the zones back.
+	 */
+	nfree = xiafs_count_free_blocks(sbi);
+	KUNIT_ASSERT_EQ(test, block_to_path(inode, block + 2 * a, off), 3);
+	partial = get_branch(inode, 3, off, chain, &err);
+	KUNIT_ASSERT_PTR_EQ(test, partial, chain + 1);
+	KUNIT_ASSERT_EQ(test, 0, alloc_branch(inode, 2, off + 1, partial));
+	KUNIT_EXPECT_EQ(test, xiafs_count_free_blocks(sbi), nfree - 2);
+	*partial->p = cpu_to_block(first + 100);
+	KUNIT_EXPECT_EQ(test, splice_branch(inode, chain, partial, 2), -EAGAIN);
+	KUNIT_EXPECT_EQ(test, xiafs_count_free_blocks(sbi), nfree);
+	brelse(chain[1].bh);
+
+	/* and alloc_branch() gives back what it got when it runs out */
+	memset(t->zmap[0]->b_data, 0xff, t->sb.s_blocksize);
+	memset(t->zmap[1]->b_data, 0xff, t->sb.s_blocksize);
+	xiafs_test_and_clear_bit(1000, t->zmap[1]->b_data);
+	xiafs_test_and_clear_bit(2000, t->zmap[1]->b_data);
+	KUNIT_ASSERT_EQ(test, block_to_path(inode, block + 4 * a, off), 3);
+	KUNIT_EXPECT_EQ(test, alloc_branch(inode, 3, off, chain), -ENOSPC);
+	KUNIT_EXPECT_EQ(test, xiafs_count_free_blocks(sbi), 2);
+
+	xiafs_test_check_refs(test, t);
+}
+
+static void xiafs_test_bench_mapping(struct kunit *test)
+{
+	struct xiafs_test *t = xiafs_test_setup(test);
+	struct inode *inode = &t->ei.vfs_inode;
+	long a = XIAFS_ADDRS_PER_Z(&t->sbi), nblocks = DIRECT + a + 4 * a;
+	long block, limit, n = 0;
+	Indirect chain[DEPTH], *partial;
+	int off[DEPTH], depth, err, i;
+	u64 start, ns;
+
+	/* every 7th block, so all three depths get their share */
+	limit = min_t(long, DIRECT + a + a * a,
+		      t->sbi.s_max_size / t->sb.s_blocksize);
+	start = ktime_get_ns();
+	while (n < 4000000) {
+		for (block = 0; block < limit; block += 7, n++)
+			block_to_path(inode, block, off);
+		cond_resched();
+	}
+	ns = ktime_get_ns() - start;
+	kunit_info(test, "block_to_path: %llu ns/call\n", div64_u64(ns, n));
+
+	start = ktime_get_ns();
+	for (block = 0; block < nblocks; block++)
+		xiafs_test_map(test, inode, block);
+	ns = ktime_get_ns() - start;
+	kunit_info(test, "get_branch+alloc_branch+splice_branch: %llu ns/block over %ld blocks\n",
+		   div64_u64(ns, nblocks), nblocks);
+
+	n = 0;
+	start = ktime_get_ns();
+	for (i = 0; i < 20; i++) {
+		for (block = 0; block < nblocks; block++, n++) {
+			depth = block_to_path(inode, block, off);
+			partial = get_branch(inode, depth, off, chain, &err);
+			for (partial = chain + depth - 1; partial > chain;
+			     partial--)
+				brelse(partial->bh);
+		}
+		cond_resched();
+	}
+	ns = ktime_get_ns() - start;
+	kunit_info(test, "block_to_path+get_branch of a mapped block: %llu ns/call\n",
+		   div64_u64(ns, n));
+	xiafs_test_check_refs(test, t);
+}
+
+static void xiafs_test_bench_alloc(struct kunit *test)
+{
+	struct xiafs_test *t = xiafs_test_setup(test);
+	struct inode *inode = &t->ei.vfs_inode;
+	struct xiafs_sb_info *sbi = &t->sbi;
+	unsigned long bpz = XIAFS_BITS_PER_Z(sbi);
+	int fill, i, nr;
+	u64 start, ns;
+
+	/* the free zone is at the start, in the middle, then at the end */
+	for (fill = 0; fill < 3; fill++) {
+		memset(t->zmap[0]->b_data, 0, t->sb.s_blocksize);
+		memset(t->zmap[1]->b_data, 0, t->sb.s_blocksize);
+		if (fill > 0)
+			memset(t->zmap[0]->b_data, 0xff, t->sb.s_blocksize);
+		if (fill > 1) {
+			memset(t->zmap[1]->b_data, 0xff, t->sb.s_blocksize);
+			xiafs_test_and_clear_bit(bpz - 1, t->zmap[1]->b_data);
+		}
+		xiafs_set_bit(0, t->zmap[0]->b_data);
+
+		start = ktime_get_ns();
+		for (i = 0; i < 100000; i++) {
+			nr = xiafs_new_block(inode);
+			xiafs_free_block(inode, nr);
+		}
+		ns = ktime_get_ns() - start;
+		kunit_info(test, "xiafs_new_block+xiafs_free_block, %s: %llu ns/pair\n",
+			   fill == 0 ? "empty zmap" : fill == 1 ?
+			   "first zmap zone full" : "only the last zone free",
+			   div64_u64(ns, i));
+		cond_resched();
+	}
+
+	start = ktime_get_ns();
+	for (i = 0; i < 10000; i++)
+		xiafs_count_free_blocks(sbi);
+	ns = ktime_get_ns() - start;
+	kunit_info(test, "count_used over %lu bits: %llu ns/call\n",
+		   2 * bpz, div64_u64(ns, i));
+}
+
+static struct kunit_case xiafs_itree_test_cases[] = {
+	KUNIT_CASE_PARAM(xiafs_test_block_to_path,
+			 xiafs_test_zshift_gen_params),
+	KUNIT_CASE_PARAM(xiafs_test_new_block, xiafs_test_zshift_gen_params),
+	KUNIT_CASE_PARAM(xiafs_test_count_used, xiafs_test_zshift_gen_params),
+	KUNIT_CASE_PARAM(xiafs_test_get_branch, xiafs_test_zshift_gen_params),
+	KUNIT_CASE_PARAM(xiafs_test_alloc_splice,
+			 xiafs_test_zshift_gen_params),
+	KUNIT_CASE_PARAM_ATTR(xiafs_test_bench_mapping,
+			      xiafs_test_zshift_gen_params,
+			      { .speed = KUNIT_SPEED_SLOW }),
+	KUNIT_CASE_PARAM_ATTR(xiafs_test_bench_alloc,
+			      xiafs_test_zshift_gen_params,
+			      { .speed = KUNIT_SPEED_SLOW }),
+	{}
+};
+
+static struct kunit_suite xiafs_itree_test_suite = {
+	.name = "xiafs-itree",
+	.test_cases = xiafs_itree_test_cases,
+};
+
+kunit_test_suites(&xiafs_itree_test_suite);
@@ -10,6 +10,7 @@
 
 #include <linux/buffer_head.h>
 #include "xiafs.h"
+#include "trace/events/xiafs.h"
 
 enum {DIRECT = 8, DEPTH = 3};
 
@@ -23,7 +24,7 @@ int block_to_path(struct inode * inode, long block, int *offsets)
 	if (block < 0) {
 		printk("XIAFS-fs: block_to_path: block %ld < 0 on dev %pg\n",
 			block, sb->s_bdev);
-	} else if ((u64)block * BLOCK_SIZE >= sb->s_maxbytes) {
+	} else if ((u64)block << sb->s_blocksize_bits >= sb->s_maxbytes) {
 		return 0;
 	} else if (block >= (xiafs_sb(inode->i_sb)->s_max_size/sb->s_blocksize)) {
 		if (printk_ratelimit())
@@ -59,6 +60,28 @@ int block_to_path(struct inode * inode, long block, int *offsets)
 
 static DEFINE_RWLOCK(pointers_lock);
 
+/*
+ * The indirect zones get read, got and dirtied through these, so that the
+ * KUnit tests (itree-test.c) can hand out zones from memory instead.
+ */
+static struct buffer_head *xiafs_bread(struct super_block *sb, sector_t nr)
+{
+	XIAFS_KUNIT_STUB(xiafs_bread, sb, nr);
+	return sb_bread(sb, nr);
+}
+
+static struct buffer_head *xiafs_getblk(struct super_block *sb, sector_t nr)
+{
+	XIAFS_KUNIT_STUB(xiafs_getblk, sb, nr);
+	return sb_getblk(sb, nr);
+}
+
+static void xiafs_dirty_indirect(struct inode *inode, struct buffer_head *bh)
+{
+	XIAFS_KUNIT_STUB(xiafs_dirty_indirect, inode, bh);
+	mmb_mark_buffer_dirty(bh, &xiafs_i(inode)->i_metadata_bhs);
+}
+
 static inline void add_chain(Indirect *p, struct buffer_head *bh, block_t *v)
 {
 	p->key = *(p->p = v);
@@ -87,6 +110,7 @@ inline Indirect *get_branch(struct inode *inode,
 	struct super_block *sb = inode->i_sb;
 	Indirect *p = chain;
 	struct buffer_head *bh;
+	u64 locked;
 
 	*err = 0;
 	/* i_data is not going away, no lock needed */
@@ -94,21 +118,24 @@ inline Indirect *get_branch(struct inode *inode,
 	if (!p->key)
 		goto no_block;
 	while (--depth) {
-		bh = sb_bread(sb, block_to_cpu(p->key));
+		xiafs_stat_inc(sb, XIAFS_STAT_INDIRECT_READS);
+		bh = xiafs_bread(sb, block_to_cpu(p->key));
 		if (!bh)
 			goto failure;
-		read_lock(&pointers_lock);
+		locked = xiafs_read_lock(&pointers_lock,
+					 XIAFS_LOCK_GET_BRANCH);
 		if (!verify_chain(chain, p))
 			goto changed;
 		add_chain(++p, bh, (block_t *)bh->b_data + *++offsets);
-		read_unlock(&pointers_lock);
+		xiafs_read_unlock(&pointers_lock, XIAFS_LOCK_GET_BRANCH,
+				  locked);
 		if (!p->key)
 			goto no_block;
 	}
 	return NULL;
 
 changed:
-	read_unlock(&pointers_lock);
+	xiafs_read_unlock(&pointers_lock, XIAFS_LOCK_GET_BRANCH, locked);
 	brelse(bh);
 	*err = -EAGAIN;
 	goto no_block;
@@ -135,7 +162,7 @@ int alloc_branch(struct inode *inode,
 		if (!nr)
 			break;
 		branch[n].key = cpu_to_block(nr);
-		bh = sb_getblk(inode->i_sb, parent);
+		bh = xiafs_getblk(inode->i_sb, parent);
 		lock_buffer(bh);
 		memset(bh->b_data, 0, bh->b_size);
 		branch[n].bh = bh;
@@ -143,7 +170,7 @@ int alloc_branch(struct inode *inode,
 		*branch[n].p = branch[n].key;
 		set_buffer_uptodate(bh);
 		unlock_buffer(bh);
-		mmb_mark_buffer_dirty(bh, &xiafs_i(inode)->i_metadata_bhs);
+		xiafs_dirty_indirect(inode, bh);
 		parent = nr;
 	}
 	if (n == num)
@@ -163,9 +190,10 @@ int splice_branch(struct inode *inode,
 				     Indirect *where,
 				     int num)
 {
+	u64 locked;
 	int i;
 
-	write_lock(&pointers_lock);
+	locked = xiafs_write_lock(&pointers_lock, XIAFS_LOCK_SPLICE_BRANCH);
 
 	/* Verify that place we are splicing to is still there and vacant */
 	if (!verify_chain(chain, where-1) || *where->p)
@@ -173,7 +201,7 @@ int splice_branch(struct inode *inode,
 
 	*where->p = where->key;
 
-	write_unlock(&pointers_lock);
+	xiafs_write_unlock(&pointers_lock, XIAFS_LOCK_SPLICE_BRANCH, locked);
 
 	/* We are done with atomic stuff, now do the rest of housekeeping */
 
@@ -181,13 +209,13 @@ int splice_branch(struct inode *inode,
 
 	/* had we spliced it onto indirect block? */
 	if (where->bh)
-		mmb_mark_buffer_dirty(where->bh, &xiafs_i(inode)->i_metadata_bhs);
+		xiafs_dirty_indirect(inode, where->bh);
 
 	mark_inode_dirty(inode);
 	return 0;
 
 changed:
-	write_unlock(&pointers_lock);
+	xiafs_write_unlock(&pointers_lock, XIAFS_LOCK_SPLICE_BRANCH, locked);
 	for (i = 1; i < num; i++)
 		bforget(where[i].bh);
 	for (i = 0; i < num; i++)
@@ -273,6 +301,7 @@ static Indirect *find_shared(struct inode *inode,
 				block_t *top)
 {
 	Indirect *partial, *p;
+	u64 locked;
 	int k, err;
 
 	*top = 0;
@@ -280,11 +309,12 @@ static Indirect *find_shared(struct inode *inode,
 		;
 	partial = get_branch(inode, k, offsets, chain, &err);
 
-	write_lock(&pointers_lock);
+	locked = xiafs_write_lock(&pointers_lock, XIAFS_LOCK_FIND_SHARED);
 	if (!partial)
 		partial = chain + k-1;
 	if (!partial->key && *partial->p) {
-		write_unlock(&pointers_lock);
+		xiafs_write_unlock(&pointers_lock, XIAFS_LOCK_FIND_SHARED,
+				   locked);
 		goto no_top;
 	}
 	for (p=partial;p>chain && all_zeroes((block_t*)p->bh->b_data,p->p);p--)
@@ -295,7 +325,7 @@ static Indirect *find_shared(struct inode *inode,
 		*top = *p->p;
 		*p->p = 0;
 	}
-	write_unlock(&pointers_lock);
+	xiafs_write_unlock(&pointers_lock, XIAFS_LOCK_FIND_SHARED, locked);
 
 	while(partial > p)
 	{
@@ -330,6 +360,7 @@ static void free_branches(struct inode *inode, block_t *p, block_t *q, int depth
 			if (!nr)
 				continue;
 			*p = 0;
+			xiafs_stat_inc(inode->i_sb, XIAFS_STAT_INDIRECT_READS);
 			bh = sb_bread(inode->i_sb, nr);
 			if (!bh)
 				continue;
@@ -433,10 +464,18 @@ void xiafs_truncate(struct inode * inode)
 {
 	if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) || S_ISLNK(inode->i_mode)))
 		return;
+	if (xiafs_inode_is_fast_symlink(inode))
+		return;
+	trace_xiafs_truncate_enter(inode);
 	truncate(inode);
+	trace_xiafs_truncate_exit(inode);
 }
 
 unsigned xiafs_blocks(loff_t size, struct super_block *sb)
 {
 	return nblocks(size, sb);
 }
+
+#ifdef XIAFS_KUNIT_TEST
+#include "itree-test.c"
+#endif
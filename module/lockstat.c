@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Contention accounting for bitmap_lock (bitmap.c) and pointers_lock
+ * (itree.c), the two locks every xiafs mount shares, without needing a
+ * lock_stat kernel.
+ *
+ * It's off unless the lock_stats module parameter is set, and while it's
+ * off the lock wrappers in xiafs.h cost one patched-out jump. While it's
+ * on, each acquisition tries the lock first, and only if that fails does
+ * it count as contended and time the wait; hold times are from getting
+ * the lock to letting it go. The counts are per call site and per cpu,
+ * and <debugfs>/xiafs/lock_stats adds them up.
+ */
+
+#include <linux/moduleparam.h>
+#include <linux/sched/clock.h>
+#include "xiafs.h"
+
+DEFINE_STATIC_KEY_FALSE(xiafs_lock_stats_on);
+DEFINE_PER_CPU(struct xiafs_lock_stats, xiafs_lock_stats);
+
+static int xiafs_lock_stats_set(const char *val, const struct kernel_param *kp)
+{
+	bool on;
+	int err;
+
+	err = kstrtobool(val, &on);
+	if (err)
+		return err;
+	if (on)
+		static_branch_enable(&xiafs_lock_stats_on);
+	else
+		static_branch_disable(&xiafs_lock_stats_on);
+	return 0;
+}
+
+static int xiafs_lock_stats_get(char *buf, const struct kernel_param *kp)
+{
+	return sprintf(buf, "%c\n",
+		       static_key_enabled(&xiafs_lock_stats_on) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops xiafs_lock_stats_ops = {
+	.set	= xiafs_lock_stats_set,
+	.get	= xiafs_lock_stats_get,
+};
+
+module_param_cb(lock_stats, &xiafs_lock_stats_ops, NULL, 0644);
+MODULE_PARM_DESC(lock_stats,
+	"Count acquisitions, contention, wait and hold times of the global "
+	"bitmap and block pointer locks (default off)");
+
+/*
+ * We may have moved to another cpu between reading the clock and getting
+ * the lock, and local_clock() only promises to be close across cpus.
+ */
+static inline u64 xiafs_lock_since(u64 start)
+{
+	s64 d = local_clock() - start;
+
+	return d > 0 ? d : 0;
+}
+
+static void xiafs_lock_acquired(enum xiafs_lock_site site, u64 start,
+		bool contended)
+{
+	struct xiafs_lock_stat *ls = this_cpu_ptr(&xiafs_lock_stats.ls[site]);
+
+	ls->acquired++;
+	if (contended) {
+		ls->contended++;
+		ls->wait_ns += xiafs_lock_since(start);
+	}
+}
+
+/*
+ * The slow halves of xiafs_spin_lock() and friends. Each returns when
+ * the lock was got, which the unlock side needs back; the lock is held
+ * with preemption off, so this_cpu_ptr() is safe to use from here on.
+ */
+u64 xiafs_lock_stat_spin(spinlock_t *lock, enum xiafs_lock_site site)
+{
+	u64 start = local_clock();
+	bool contended = !spin_trylock(lock);
+
+	if (contended)
+		spin_lock(lock);
+	xiafs_lock_acquired(site, start, contended);
+	return local_clock() ? : 1;
+}
+
+u64 xiafs_lock_stat_read(rwlock_t *lock, enum xiafs_lock_site site)
+{
+	u64 start = local_clock();
+	bool contended = !read_trylock(lock);
+
+	if (contended)
+		read_lock(lock);
+	xiafs_lock_acquired(site, start, contended);
+	return local_clock() ? : 1;
+}
+
+u64 xiafs_lock_stat_write(rwlock_t *lock, enum xiafs_lock_site site)
+{
+	u64 start = local_clock();
+	bool contended = !write_trylock(lock);
+
+	if (contended)
+		write_lock(lock);
+	xiafs_lock_acquired(site, start, contended);
+	return local_clock() ? : 1;
+}
+
+/* Called with the lock still held, just before it's let go. */
+void xiafs_lock_stat_release(enum xiafs_lock_site site, u64 since)
+{
+	this_cpu_add(xiafs_lock_stats.ls[site].hold_ns,
+		     xiafs_lock_since(since));
+}
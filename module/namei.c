@@ -19,6 +19,7 @@
 #include <linux/pagemap.h>
 #include <linux/buffer_head.h>
 #include <linux/namei.h>
+#include <linux/slab.h>
 
 static int add_nondir(struct dentry *dentry, struct inode *inode)
 {
@@ -35,21 +36,29 @@ static int add_nondir(struct dentry *dentry, struct inode *inode)
 static struct dentry *xiafs_lookup(struct inode * dir, struct dentry *dentry, unsigned int flags)
 {
 	struct inode * inode = NULL;
+	struct dentry *ret = NULL;
+	u64 start = ktime_get_ns();
 	ino_t ino;
 
 	dentry->d_op = dir->i_sb->s_root->d_op;
 
-	if (dentry->d_name.len > _XIAFS_NAME_LEN)
-		return ERR_PTR(-ENAMETOOLONG);
+	if (dentry->d_name.len > _XIAFS_NAME_LEN) {
+		ret = ERR_PTR(-ENAMETOOLONG);
+		goto out;
+	}
 
 	ino = xiafs_inode_by_name(dentry);
 	if (ino) {
 		inode = xiafs_iget(dir->i_sb, ino);
-		if (IS_ERR(inode))
-			return ERR_CAST(inode);
+		if (IS_ERR(inode)) {
+			ret = ERR_CAST(inode);
+			goto out;
+		}
 	}
 	d_add(dentry, inode);
-	return NULL;
+out:
+	xiafs_lat_record(dir->i_sb, XIAFS_LAT_LOOKUP, start);
+	return ret;
 }
 
 static int xiafs_mknod(struct mnt_idmap *idmap, struct inode * dir, struct dentry *dentry, umode_t mode, dev_t rdev)
@@ -74,7 +83,11 @@ static int xiafs_mknod(struct mnt_idmap *idmap, struct inode * dir, struct dentr
 static int xiafs_create(struct mnt_idmap *idmap, struct inode * dir, struct dentry *dentry, umode_t mode,
 		bool excl)
 {
-	return xiafs_mknod(&nop_mnt_idmap, dir, dentry, mode, 0);
+	u64 start = ktime_get_ns();
+	int err = xiafs_mknod(&nop_mnt_idmap, dir, dentry, mode, 0);
+
+	xiafs_lat_record(dir->i_sb, XIAFS_LAT_CREATE, start);
+	return err;
 }
 
 /* Just as the initial iomap implementation for minix was taken from the xiafs
@@ -131,6 +144,9 @@ static int __page_symlink(struct inode *inode, const char *symname, int len)
 
 	}
 
+	/* Cache the target now; xiafs_get_link fills it in later if this fails */
+	inode->i_link = kmemdup(symname, len, GFP_KERNEL);
+
 	mark_inode_dirty(inode);
 	brelse(bh);
 
@@ -159,9 +175,17 @@ static int xiafs_symlink(struct mnt_idmap *idmap, struct inode * dir, struct den
 		goto out;
 
 	xiafs_set_inode(inode, 0);
-	err = __page_symlink(inode, symname, i);
-	if (err)
-		goto out_fail;
+	if (xiafs_fast_symlink(dir->i_sb, mode, i - 1)) {
+		/* xiafs_new_inode() left i_zone zeroed */
+		memcpy(xiafs_i(inode)->i_zone, symname, i);
+		inode->i_size = i - 1;
+		inode->i_link = (char *)xiafs_i(inode)->i_zone;
+		mark_inode_dirty(inode);
+	} else {
+		err = __page_symlink(inode, symname, i);
+		if (err)
+			goto out_fail;
+	}
 
 	err = add_nondir(dentry, inode);
 out:
@@ -191,6 +215,7 @@ static struct dentry *xiafs_mkdir(struct mnt_idmap *idmap, struct inode * dir,
 		struct dentry *dentry, umode_t mode)
 {
 	struct inode * inode;
+	u64 start = ktime_get_ns();
 	int err = -EMLINK;
 
 	if (dir->i_nlink >= _XIAFS_MAX_LINK)
@@ -219,6 +244,7 @@ static struct dentry *xiafs_mkdir(struct mnt_idmap *idmap, struct inode * dir,
 
 	d_instantiate(dentry, inode);
 out:
+	xiafs_lat_record(dir->i_sb, XIAFS_LAT_MKDIR, start);
 	return ERR_PTR(err);
 
 out_fail:
@@ -230,7 +256,8 @@ out_dir:
 	goto out;
 }
 
-static int xiafs_unlink(struct inode * dir, struct dentry *dentry)
+/* unlink, less the timing, so rmdir doesn't show up as an unlink */
+static int xiafs_remove_entry(struct inode * dir, struct dentry *dentry)
 {
 	int err = -ENOENT;
 	struct inode * inode = dentry->d_inode;
@@ -254,13 +281,22 @@ end_unlink:
 	return err;
 }
 
+static int xiafs_unlink(struct inode * dir, struct dentry *dentry)
+{
+	u64 start = ktime_get_ns();
+	int err = xiafs_remove_entry(dir, dentry);
+
+	xiafs_lat_record(dir->i_sb, XIAFS_LAT_UNLINK, start);
+	return err;
+}
+
 static int xiafs_rmdir(struct inode * dir, struct dentry *dentry)
 {
 	struct inode * inode = dentry->d_inode;
 	int err = -ENOTEMPTY;
 
 	if (xiafs_empty_dir(inode)) {
-		err = xiafs_unlink(dir, dentry);
+		err = xiafs_remove_entry(dir, dentry);
 		if (!err) {
 			inode_dec_link_count(dir);
 			inode_dec_link_count(inode);
@@ -269,7 +305,7 @@ static int xiafs_rmdir(struct inode * dir, struct dentry *dentry)
 	return err;
 }
 
-static int xiafs_rename(struct mnt_idmap *idmap, struct inode * old_dir, struct dentry *old_dentry,
+static int do_xiafs_rename(struct inode * old_dir, struct dentry *old_dentry,
 			   struct inode * new_dir, struct dentry *new_dentry,
 			   unsigned int flags)
 {
@@ -277,36 +313,50 @@ static int xiafs_rename(struct mnt_idmap *idmap, struct inode * old_dir, struct
 	struct inode * new_inode = new_dentry->d_inode;
 	struct folio * dir_folio = NULL;
 	struct xiafs_direct * dir_de = NULL;
-	struct folio * old_folio;
-	struct xiafs_direct * old_de;
-	struct xiafs_direct * old_de_pre;
-	int err = -ENOENT;
+	struct xiafs_dir_loc old, new = { };
+	bool same_dir = old_dir == new_dir;
+	int err;
 
-	old_de = xiafs_find_entry(old_dentry, &old_folio, &old_de_pre);
-	if (!old_de)
-		goto out;
+	if (flags & ~RENAME_NOREPLACE)
+		return -EINVAL;
 
 	if (S_ISDIR(old_inode->i_mode)) {
-		err = -EIO;
 		dir_de = xiafs_dotdot(old_inode, &dir_folio);
 		if (!dir_de)
-			goto out_old;
+			return -EIO;
 	}
 
-	if (new_inode) {
-		struct folio * new_folio;
-		struct xiafs_direct * new_de;
+	/*
+	 * Within one directory, find the old and new names in a single pass.
+	 * Everything below only dirties the directories; they are synced
+	 * once at the end if they need to be.
+	 */
+	if (same_dir && new_inode)
+		err = xiafs_find_entries(old_dir, &old_dentry->d_name, &old,
+				&new_dentry->d_name, &new);
+	else
+		err = xiafs_find_entries(old_dir, &old_dentry->d_name, &old,
+				NULL, NULL);
+	if (err)
+		goto out_dir;
 
+	if (new_inode) {
 		err = -ENOTEMPTY;
 		if (dir_de && !xiafs_empty_dir(new_inode))
-			goto out_dir;
+			goto out_old;
 
-		err = -ENOENT;
-		new_de = xiafs_find_entry(new_dentry, &new_folio, NULL);
-		if (!new_de)
-			goto out_dir;
+		if (!same_dir) {
+			err = xiafs_find_entries(new_dir, &new_dentry->d_name,
+					&new, NULL, NULL);
+			if (err)
+				goto out_old;
+		}
 		inode_inc_link_count(old_inode);
-		xiafs_set_link(new_de, new_folio, old_inode);
+		err = __xiafs_set_link(new.de, new.folio, old_inode);
+		if (err) {
+			inode_dec_link_count(old_inode);
+			goto out_old;
+		}
 		inode_set_ctime_current(new_inode);
 
 		if (dir_de)
@@ -316,34 +366,68 @@ static int xiafs_rename(struct mnt_idmap *idmap, struct inode * old_dir, struct
 		if (dir_de) {
 			err = -EMLINK;
 			if (new_dir->i_nlink >= _XIAFS_MAX_LINK)
-				goto out_dir;
+				goto out_old;
+		}
+		/* If the new name fits where the old one is, just rename
+		 * the entry. */
+		if (same_dir && !__xiafs_rename_entry(old.de, old.folio,
+					&new_dentry->d_name)) {
+			xiafs_put_entries(&old, NULL);
+			goto out_sync;
 		}
 		inode_inc_link_count(old_inode);
-		err = xiafs_add_link(new_dentry, old_inode);
+		err = __xiafs_add_link(new_dentry, old_inode);
 		if (err) {
 			inode_dec_link_count(old_inode);
-			goto out_dir;
+			goto out_old;
 		}
 		if (dir_de)
 			inode_inc_link_count(new_dir);
 	}
 
-	xiafs_delete_entry(old_de, old_de_pre, old_folio);
+	err = __xiafs_delete_entry(old.de, old.de_pre, old.folio);
+	if (err)
+		goto out_old;
 	inode_dec_link_count(old_inode);
 
 	if (dir_de) {
-		xiafs_set_link(dir_de, dir_folio, new_dir);
+		if (!same_dir) {
+			err = __xiafs_set_link(dir_de, dir_folio, new_dir);
+			if (err)
+				goto out_old;
+		}
 		inode_dec_link_count(old_dir);
 	}
-	return 0;
-
-out_dir:
-	if (dir_de) {
-		folio_release_kmap(old_folio, dir_de);
+	xiafs_put_entries(&old, &new);
+
+out_sync:
+	if (dir_de)
+		folio_release_kmap(dir_folio, dir_de);
+	err = xiafs_handle_dirsync(new_dir);
+	if (!err && !same_dir) {
+		err = xiafs_handle_dirsync(old_dir);
+		if (!err && dir_de)
+			err = xiafs_handle_dirsync(old_inode);
 	}
+	return err;
+
 out_old:
-	folio_release_kmap(old_folio, old_de);
-out:
+	xiafs_put_entries(&old, &new);
+out_dir:
+	if (dir_de)
+		folio_release_kmap(dir_folio, dir_de);
+	return err;
+}
+
+static int xiafs_rename(struct mnt_idmap *idmap, struct inode * old_dir, struct dentry *old_dentry,
+			   struct inode * new_dir, struct dentry *new_dentry,
+			   unsigned int flags)
+{
+	u64 start = ktime_get_ns();
+	int err = do_xiafs_rename(old_dir, old_dentry, new_dir, new_dentry,
+				  flags);
+
+	xiafs_lat_record(old_dir->i_sb, XIAFS_LAT_RENAME, start);
 	return err;
 }
 
@@ -362,11 +446,33 @@ static void xiafs_free_link(void *bh)
  * requires for old-timey ext4 slow links.
  */
 
+/*
+ * Keep a copy of the target hanging off i_link, which the VFS will use
+ * directly from then on without calling ->get_link. That lets RCU path walk
+ * follow the link without dropping out to ref-walk for the block read, and
+ * saves the buffer lookup on every later resolution. The copy is freed in
+ * xiafs_free_in_core_inode.
+ */
+static const char *xiafs_cache_link(struct inode *inode, struct buffer_head *bh)
+{
+	char *link;
+
+	link = kmemdup_nul(bh->b_data, min_t(loff_t, inode->i_size,
+				inode->i_sb->s_blocksize - 1), GFP_KERNEL);
+	if (!link)
+		return NULL;
+	/* lost a race with another reader, use theirs */
+	if (cmpxchg(&inode->i_link, NULL, link))
+		kfree(link);
+	return inode->i_link;
+}
+
 const char *xiafs_get_link(struct dentry *dentry, struct inode *inode,
 		struct delayed_call *callback)
 {
 	struct super_block *sb = inode->i_sb;
 	struct buffer_head *bh;
+	const char *link;
 	sector_t blk;
 
 	blk = block_to_cpu(*(i_data(inode)));
@@ -388,6 +494,11 @@ const char *xiafs_get_link(struct dentry *dentry, struct inode *inode,
 			pr_err("bad symlink on inode %llu", inode->i_ino);
 			return ERR_PTR(-EFSCORRUPTED);
 		}
+		link = xiafs_cache_link(inode, bh);
+		if (link) {
+			brelse(bh);
+			return link;
+		}
 	}
 
 	set_delayed_call(callback, xiafs_free_link, bh);
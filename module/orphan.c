@@ -0,0 +1,300 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Deferred freeing of the zones of deleted files.
+ *
+ * Freeing a big file's zones means reading every one of its indirect
+ * zones, which used to happen right in evict, so the last unlink (or
+ * close) of a large file sat there until it was done. Now evict just
+ * takes a copy of the file's zone pointers and leaves it on a per-mount
+ * list, and a worker frees them in the background, a batch at a time,
+ * stopping partway through a big file when the batch is used up. Until
+ * then the zones are counted as free by statfs, and an allocation that
+ * comes up empty frees whatever's queued itself (waiting for the worker
+ * if it has a file in hand) before giving up.
+ *
+ * The inode itself is freed straight away, so if the machine goes down
+ * with anything still queued, the zones are left marked in use without
+ * an owner; xfsck finds and frees them.
+ */
+
+#include <linux/buffer_head.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include "xiafs.h"
+#include "trace/events/xiafs.h"
+
+/*
+ * Zones freed per run of the worker before it gives the disk a rest. A run
+ * stops between single indirect zones, so it can go over by up to one of
+ * those and its pointers.
+ */
+#define XIAFS_FREE_BATCH	8192
+#define XIAFS_FREE_DELAY	(HZ / 50)
+
+struct xiafs_orphan {
+	struct list_head o_list;
+	unsigned long	o_ino;		/* for messages only */
+	unsigned long	o_pending;	/* still in s_free_pending */
+	int		o_slot;		/* next of o_zone[] to free, */
+	unsigned int	o_idx;		/* and where in the double indirect
+					 * zone, if that's the one */
+	block_t		o_zone[_XIAFS_NUM_BLOCK_POINTERS];
+};
+
+static unsigned long xiafs_free_one(struct super_block *sb,
+		struct xiafs_orphan *o, block_t nr)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+
+	if (!xiafs_free_zone(sb, nr))
+		return 0;
+	trace_xiafs_free_block(sb, o->o_ino, nr);
+	if (o->o_pending) {
+		o->o_pending--;
+		atomic_long_dec(&sbi->s_free_pending);
+	}
+	return 1;
+}
+
+static unsigned long xiafs_free_tree(struct super_block *sb,
+		struct xiafs_orphan *o, block_t nr, int depth)
+{
+	struct buffer_head *bh;
+	unsigned long freed = 0;
+	block_t *p;
+
+	if (depth) {
+		xiafs_stat_inc(sb, XIAFS_STAT_INDIRECT_READS);
+		bh = sb_bread(sb, nr);
+		if (bh) {
+			for (p = (block_t *)bh->b_data;
+			     p < (block_t *)(bh->b_data + bh->b_size); p++)
+				if (*p)
+					freed += xiafs_free_tree(sb, o,
+						block_to_cpu(*p), depth - 1);
+			bforget(bh);
+		} else
+			printk("XIAFS-fs: can't read indirect zone %u of "
+			       "deleted inode %lu on %s, zones leaked\n",
+			       nr, o->o_ino, sb->s_id);
+		cond_resched();
+	}
+	return freed + xiafs_free_one(sb, o, nr);
+}
+
+/*
+ * Free the double indirect tree a single indirect zone at a time from
+ * o_idx on, until at least `budget' zones have gone. The double indirect
+ * zone itself goes last, and o_zone[9] is cleared when it has.
+ */
+static unsigned long xiafs_free_dind(struct super_block *sb,
+		struct xiafs_orphan *o, unsigned long budget)
+{
+	block_t nr = o->o_zone[9];
+	unsigned long freed = 0;
+	struct buffer_head *bh;
+	unsigned int n;
+	block_t *p;
+
+	xiafs_stat_inc(sb, XIAFS_STAT_INDIRECT_READS);
+	bh = sb_bread(sb, nr);
+	if (bh) {
+		p = (block_t *)bh->b_data;
+		n = bh->b_size / sizeof(block_t);
+		for (; o->o_idx < n && freed < budget; o->o_idx++)
+			if (p[o->o_idx])
+				freed += xiafs_free_tree(sb, o,
+					block_to_cpu(p[o->o_idx]), 1);
+		if (o->o_idx < n) {
+			/* still ours, so it'll be the same next time */
+			brelse(bh);
+			return freed;
+		}
+		bforget(bh);
+	} else
+		printk("XIAFS-fs: can't read indirect zone %u of "
+		       "deleted inode %lu on %s, zones leaked\n",
+		       nr, o->o_ino, sb->s_id);
+	o->o_zone[9] = 0;
+	return freed + xiafs_free_one(sb, o, nr);
+}
+
+/*
+ * Free what an orphan holds, carrying on from where the last call left
+ * off, until it's all gone or *budget zones have been freed; *budget is
+ * reduced by what was. Returns true, and frees the orphan, once it's done.
+ */
+static bool xiafs_free_orphan(struct super_block *sb,
+		struct xiafs_orphan *o, unsigned long *budget)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	unsigned long freed = 0;
+	int i;
+
+	while (o->o_slot < _XIAFS_NUM_BLOCK_POINTERS && freed < *budget) {
+		i = o->o_slot;
+		if (i == 9 && o->o_zone[9]) {
+			freed += xiafs_free_dind(sb, o, *budget - freed);
+			if (o->o_zone[9])
+				break;
+		} else if (o->o_zone[i])
+			freed += xiafs_free_tree(sb, o, o->o_zone[i], i == 8);
+		o->o_slot++;
+	}
+	*budget -= min(freed, *budget);
+	if (o->o_slot < _XIAFS_NUM_BLOCK_POINTERS)
+		return false;
+	/* in case i_blocks overstated it */
+	atomic_long_sub(o->o_pending, &sbi->s_free_pending);
+	kfree(o);
+	return true;
+}
+
+static struct xiafs_orphan *xiafs_pop_orphan(struct xiafs_sb_info *sbi)
+{
+	struct xiafs_orphan *o;
+
+	spin_lock(&sbi->s_orphan_lock);
+	o = list_first_entry_or_null(&sbi->s_orphans, struct xiafs_orphan,
+				     o_list);
+	if (o)
+		list_del(&o->o_list);
+	spin_unlock(&sbi->s_orphan_lock);
+	return o;
+}
+
+/* Put back one that's only partly freed, to be carried on with first. */
+static void xiafs_push_orphan(struct xiafs_sb_info *sbi,
+		struct xiafs_orphan *o)
+{
+	spin_lock(&sbi->s_orphan_lock);
+	list_add(&o->o_list, &sbi->s_orphans);
+	spin_unlock(&sbi->s_orphan_lock);
+}
+
+static void xiafs_orphan_work(struct work_struct *work)
+{
+	struct xiafs_sb_info *sbi = container_of(to_delayed_work(work),
+			struct xiafs_sb_info, s_orphan_work);
+	struct super_block *sb = sbi->s_sb;
+	unsigned long budget = XIAFS_FREE_BATCH;
+	struct xiafs_orphan *o;
+
+	/* Frozen; xiafs_unfreeze_fs() starts us again. */
+	if (!sb_start_intwrite_trylock(sb))
+		return;
+	while (budget && (o = xiafs_pop_orphan(sbi)))
+		if (!xiafs_free_orphan(sb, o, &budget))
+			xiafs_push_orphan(sbi, o);
+	sb_end_intwrite(sb);
+
+	if (!list_empty_careful(&sbi->s_orphans))
+		queue_delayed_work(sbi->s_orphan_wq, &sbi->s_orphan_work,
+				   XIAFS_FREE_DELAY);
+}
+
+/*
+ * Called from evict for a file whose last link is gone. Small files, and
+ * anything else without an indirect zone, are quick enough to free right
+ * here; returns false for those and the caller truncates as usual.
+ * Otherwise the zone pointers are handed to the worker and the in-core
+ * inode let go of them.
+ */
+bool xiafs_defer_free(struct inode *inode)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(inode->i_sb);
+	block_t *idata = i_data(inode);
+	struct xiafs_orphan *o;
+
+	if (!S_ISREG(inode->i_mode) || (!idata[8] && !idata[9]))
+		return false;
+	o = kmalloc(sizeof(*o), GFP_NOFS);
+	if (!o)
+		return false;
+
+	o->o_ino = inode->i_ino;
+	o->o_slot = 0;
+	o->o_idx = 0;
+	o->o_pending = inode->i_blocks >> (1 + XIAFS_ZSHIFT(sbi));
+	memcpy(o->o_zone, idata, sizeof(o->o_zone));
+	memset(idata, 0, sizeof(o->o_zone));
+	inode->i_blocks = 0;
+
+	atomic_long_add(o->o_pending, &sbi->s_free_pending);
+	spin_lock(&sbi->s_orphan_lock);
+	list_add_tail(&o->o_list, &sbi->s_orphans);
+	spin_unlock(&sbi->s_orphan_lock);
+	queue_delayed_work(sbi->s_orphan_wq, &sbi->s_orphan_work, 0);
+	return true;
+}
+
+/*
+ * Free everything queued right now, in the caller's context. An orphan
+ * the worker has off the list can't be got at, so if zones are still
+ * pending once the list is empty, wait for the worker's run to end; it
+ * puts back what it didn't finish, and we carry on with that. Returns
+ * whether any zones were freed meanwhile, by us or the worker.
+ */
+bool xiafs_flush_orphans(struct super_block *sb)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	long before = atomic_long_read(&sbi->s_free_pending);
+	unsigned long budget;
+	struct xiafs_orphan *o;
+	bool any = false;
+
+	for (;;) {
+		while ((o = xiafs_pop_orphan(sbi))) {
+			budget = ULONG_MAX;
+			xiafs_free_orphan(sb, o, &budget);
+			any = true;
+		}
+		if (!atomic_long_read(&sbi->s_free_pending))
+			break;
+		flush_delayed_work(&sbi->s_orphan_work);
+		if (list_empty_careful(&sbi->s_orphans))
+			break;
+	}
+	return any || atomic_long_read(&sbi->s_free_pending) < before;
+}
+
+/* Stop the worker and free everything it had left; for unmount and such. */
+void xiafs_drain_orphans(struct super_block *sb)
+{
+	cancel_delayed_work_sync(&xiafs_sb(sb)->s_orphan_work);
+	xiafs_flush_orphans(sb);
+}
+
+/* Kick the worker again if anything is waiting for it. */
+void xiafs_resume_orphans(struct super_block *sb)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+
+	if (!list_empty_careful(&sbi->s_orphans))
+		queue_delayed_work(sbi->s_orphan_wq, &sbi->s_orphan_work, 0);
+}
+
+int xiafs_orphan_init(struct super_block *sb)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+
+	sbi->s_sb = sb;
+	spin_lock_init(&sbi->s_orphan_lock);
+	INIT_LIST_HEAD(&sbi->s_orphans);
+	atomic_long_set(&sbi->s_free_pending, 0);
+	INIT_DELAYED_WORK(&sbi->s_orphan_work, xiafs_orphan_work);
+	sbi->s_orphan_wq = alloc_workqueue("xiafs-free/%s",
+			WQ_MEM_RECLAIM | WQ_UNBOUND, 1, sb->s_id);
+	return sbi->s_orphan_wq ? 0 : -ENOMEM;
+}
+
+void xiafs_orphan_destroy(struct super_block *sb)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+
+	if (!sbi->s_orphan_wq)
+		return;
+	xiafs_drain_orphans(sb);
+	destroy_workqueue(sbi->s_orphan_wq);
+	sbi->s_orphan_wq = NULL;
+}
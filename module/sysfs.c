@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * /sys/fs/xiafs/<dev>/stats: what a mounted xiafs has been up to since it
+ * was mounted. The counters are per cpu so counting costs next to nothing
+ * on the paths being counted; reading them adds up every cpu's share.
+ */
+
+#include <linux/kobject.h>
+#include <linux/slab.h>
+#include <linux/sysfs.h>
+#include "xiafs.h"
+
+static struct kset *xiafs_kset;
+
+/* in enum xiafs_stat_item order */
+static const char * const xiafs_stat_names[XIAFS_NR_STATS] = {
+	"blocks_allocated",
+	"blocks_freed",
+	"zmap_bytes_scanned",
+	"inodes_allocated",
+	"inodes_freed",
+	"imap_bytes_scanned",
+	"lookups",
+	"lookup_entries_scanned",
+	"add_links",
+	"add_link_entries_scanned",
+	"dirsync_flushes",
+	"indirect_block_reads",
+	"iomap_calls",
+	"iomap_bytes_mapped",
+	"inode_table_reads",
+	"inode_table_writes",
+};
+
+static void xiafs_stats_sum(struct xiafs_sb_info *sbi, u64 *sum)
+{
+	int cpu, i;
+
+	memset(sum, 0, sizeof(u64) * XIAFS_NR_STATS);
+	for_each_possible_cpu(cpu) {
+		struct xiafs_stats *st = per_cpu_ptr(sbi->s_stats, cpu);
+
+		for (i = 0; i < XIAFS_NR_STATS; i++)
+			sum[i] += READ_ONCE(st->st[i]);
+	}
+}
+
+/*
+ * One "name value" pair per line: the raw counters, then a few averages
+ * worked out from them (in hundredths, so they stay integers).
+ */
+static ssize_t stats_show(struct kobject *kobj, struct kobj_attribute *attr,
+		char *buf)
+{
+	struct xiafs_sb_info *sbi = container_of(kobj, struct xiafs_sb_info,
+						 s_kobj);
+	static const struct {
+		const char *name;
+		enum xiafs_stat_item num, den;
+	} avgs[] = {
+		{ "zmap_bytes_per_alloc_x100",
+		  XIAFS_STAT_ZMAP_SCANNED, XIAFS_STAT_BLOCKS_ALLOC },
+		{ "imap_bytes_per_alloc_x100",
+		  XIAFS_STAT_IMAP_SCANNED, XIAFS_STAT_INODES_ALLOC },
+		{ "entries_per_lookup_x100",
+		  XIAFS_STAT_LOOKUP_SCANNED, XIAFS_STAT_LOOKUPS },
+		{ "entries_per_add_link_x100",
+		  XIAFS_STAT_ADD_SCANNED, XIAFS_STAT_ADD_LINKS },
+		{ "iomap_avg_mapped_bytes_x100",
+		  XIAFS_STAT_IOMAP_BYTES, XIAFS_STAT_IOMAP_CALLS },
+	};
+	u64 sum[XIAFS_NR_STATS];
+	ssize_t len = 0;
+	int i;
+
+	xiafs_stats_sum(sbi, sum);
+	for (i = 0; i < XIAFS_NR_STATS; i++)
+		len += sysfs_emit_at(buf, len, "%s %llu\n",
+				     xiafs_stat_names[i], sum[i]);
+	for (i = 0; i < ARRAY_SIZE(avgs); i++)
+		len += sysfs_emit_at(buf, len, "%s %llu\n", avgs[i].name,
+			sum[avgs[i].den] ?
+			div64_u64(sum[avgs[i].num] * 100, sum[avgs[i].den]) : 0);
+	return len;
+}
+
+static struct kobj_attribute xiafs_attr_stats = __ATTR_RO(stats);
+
+static struct attribute *xiafs_attrs[] = {
+	&xiafs_attr_stats.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(xiafs);
+
+static void xiafs_sb_release(struct kobject *kobj)
+{
+	struct xiafs_sb_info *sbi = container_of(kobj, struct xiafs_sb_info,
+						 s_kobj);
+
+	complete(&sbi->s_kobj_unregister);
+}
+
+static const struct kobj_type xiafs_sb_ktype = {
+	.default_groups	= xiafs_groups,
+	.sysfs_ops	= &kobj_sysfs_ops,
+	.release	= xiafs_sb_release,
+};
+
+/*
+ * Set up the counters and the sysfs directory for a mount. The counters
+ * have to be there before the first iget.
+ */
+int xiafs_register_sysfs(struct super_block *sb)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+	int err;
+
+	sbi->s_stats = alloc_percpu(struct xiafs_stats);
+	if (!sbi->s_stats)
+		return -ENOMEM;
+
+	init_completion(&sbi->s_kobj_unregister);
+	sbi->s_kobj.kset = xiafs_kset;
+	err = kobject_init_and_add(&sbi->s_kobj, &xiafs_sb_ktype, NULL,
+				   "%s", sb->s_id);
+	if (err) {
+		kobject_put(&sbi->s_kobj);
+		wait_for_completion(&sbi->s_kobj_unregister);
+		free_percpu(sbi->s_stats);
+		sbi->s_stats = NULL;
+	}
+	return err;
+}
+
+void xiafs_unregister_sysfs(struct super_block *sb)
+{
+	struct xiafs_sb_info *sbi = xiafs_sb(sb);
+
+	if (!sbi->s_stats)
+		return;
+	kobject_del(&sbi->s_kobj);
+	kobject_put(&sbi->s_kobj);
+	wait_for_completion(&sbi->s_kobj_unregister);
+	free_percpu(sbi->s_stats);
+	sbi->s_stats = NULL;
+}
+
+int __init xiafs_init_sysfs(void)
+{
+	xiafs_kset = kset_create_and_add("xiafs", NULL, fs_kobj);
+	return xiafs_kset ? 0 : -ENOMEM;
+}
+
+void xiafs_exit_sysfs(void)
+{
+	kset_unregister(xiafs_kset);
+}
@@ -0,0 +1,283 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Tracepoints for xiafs, for telling where the time goes with perf or
+ * bpftrace. inode.c defines them.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM xiafs
+
+#if !defined(_TRACE_XIAFS_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_XIAFS_H
+
+#include <linux/tracepoint.h>
+#include <linux/iomap.h>
+
+#define show_iomap_type(type)					\
+	__print_symbolic(type,					\
+		{ IOMAP_HOLE,		"HOLE" },		\
+		{ IOMAP_DELALLOC,	"DELALLOC" },		\
+		{ IOMAP_MAPPED,		"MAPPED" },		\
+		{ IOMAP_UNWRITTEN,	"UNWRITTEN" },		\
+		{ IOMAP_INLINE,		"INLINE" })
+
+TRACE_EVENT(xiafs_iomap_begin,
+	TP_PROTO(struct inode *inode, loff_t offset, loff_t length,
+		 unsigned int flags, const struct iomap *iomap, int err),
+
+	TP_ARGS(inode, offset, length, flags, iomap, err),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(u64,		ino)
+		__field(loff_t,		offset)
+		__field(loff_t,		length)
+		__field(u64,		mapped)
+		__field(u64,		addr)
+		__field(unsigned int,	flags)
+		__field(u16,		type)
+		__field(bool,		alloc)
+		__field(int,		err)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= inode->i_sb->s_dev;
+		__entry->ino	= inode->i_ino;
+		__entry->offset	= offset;
+		__entry->length	= length;
+		__entry->mapped	= iomap->length;
+		__entry->addr	= iomap->addr;
+		__entry->flags	= flags;
+		__entry->type	= iomap->type;
+		__entry->alloc	= iomap->flags & IOMAP_F_NEW;
+		__entry->err	= err;
+	),
+
+	TP_printk("dev %d:%d ino %llu pos %lld len %lld flags 0x%x "
+		  "mapped %llu type %s addr 0x%llx alloc %d err %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->offset, __entry->length, __entry->flags,
+		  __entry->mapped, show_iomap_type(__entry->type),
+		  __entry->addr, __entry->alloc, __entry->err)
+);
+
+TRACE_EVENT(xiafs_new_block,
+	TP_PROTO(struct inode *inode, unsigned long zone, unsigned long scanned),
+
+	TP_ARGS(inode, zone, scanned),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(u64,		ino)
+		__field(unsigned long,	zone)
+		__field(unsigned long,	scanned)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= inode->i_sb->s_dev;
+		__entry->ino	= inode->i_ino;
+		__entry->zone	= zone;
+		__entry->scanned = scanned;
+	),
+
+	TP_printk("dev %d:%d ino %llu zone %lu bits scanned %lu",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->zone, __entry->scanned)
+);
+
+/* ino is that of the file the zone belonged to, deferred frees included */
+TRACE_EVENT(xiafs_free_block,
+	TP_PROTO(struct super_block *sb, u64 ino, unsigned long zone),
+
+	TP_ARGS(sb, ino, zone),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(u64,		ino)
+		__field(unsigned long,	zone)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= sb->s_dev;
+		__entry->ino	= ino;
+		__entry->zone	= zone;
+	),
+
+	TP_printk("dev %d:%d ino %llu zone %lu",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->zone)
+);
+
+TRACE_EVENT(xiafs_new_inode,
+	TP_PROTO(const struct inode *dir, const struct inode *inode),
+
+	TP_ARGS(dir, inode),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(u64,		dir)
+		__field(u64,		ino)
+		__field(umode_t,	mode)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= dir->i_sb->s_dev;
+		__entry->dir	= dir->i_ino;
+		__entry->ino	= inode->i_ino;
+		__entry->mode	= inode->i_mode;
+	),
+
+	TP_printk("dev %d:%d dir %llu ino %llu mode 0%o",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->dir,
+		  __entry->ino, __entry->mode)
+);
+
+TRACE_EVENT(xiafs_free_inode,
+	TP_PROTO(const struct inode *inode),
+
+	TP_ARGS(inode),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(u64,		ino)
+		__field(umode_t,	mode)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= inode->i_sb->s_dev;
+		__entry->ino	= inode->i_ino;
+		__entry->mode	= inode->i_mode;
+	),
+
+	TP_printk("dev %d:%d ino %llu mode 0%o",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->mode)
+);
+
+DECLARE_EVENT_CLASS(xiafs_dir_scan,
+	TP_PROTO(struct inode *dir, const struct qstr *name,
+		 unsigned int scanned, int ret),
+
+	TP_ARGS(dir, name, scanned, ret),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(u64,		dir)
+		__field(u64,		size)
+		__field(unsigned int,	scanned)
+		__field(int,		ret)
+		__string(name,		name->name)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= dir->i_sb->s_dev;
+		__entry->dir	= dir->i_ino;
+		__entry->size	= dir->i_size;
+		__entry->scanned = scanned;
+		__entry->ret	= ret;
+		__assign_str(name);
+	),
+
+	TP_printk("dev %d:%d dir %llu size %llu name %s entries scanned %u "
+		  "ret %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->dir,
+		  __entry->size, __get_str(name), __entry->scanned,
+		  __entry->ret)
+);
+
+/* ret is 1 if the name was found, 0 if not */
+DEFINE_EVENT(xiafs_dir_scan, xiafs_find_entry,
+	TP_PROTO(struct inode *dir, const struct qstr *name,
+		 unsigned int scanned, int ret),
+	TP_ARGS(dir, name, scanned, ret));
+
+/* ret is 0 or an error */
+DEFINE_EVENT(xiafs_dir_scan, xiafs_add_link,
+	TP_PROTO(struct inode *dir, const struct qstr *name,
+		 unsigned int scanned, int ret),
+	TP_ARGS(dir, name, scanned, ret));
+
+TRACE_EVENT(xiafs_iget,
+	TP_PROTO(struct super_block *sb, u64 ino, bool cached),
+
+	TP_ARGS(sb, ino, cached),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(u64,		ino)
+		__field(bool,		cached)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= sb->s_dev;
+		__entry->ino	= ino;
+		__entry->cached	= cached;
+	),
+
+	TP_printk("dev %d:%d ino %llu %s",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->cached ? "hit" : "miss")
+);
+
+TRACE_EVENT(xiafs_write_inode,
+	TP_PROTO(struct inode *inode, struct writeback_control *wbc),
+
+	TP_ARGS(inode, wbc),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(u64,		ino)
+		__field(int,		sync_mode)
+		__field(bool,		for_sync)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= inode->i_sb->s_dev;
+		__entry->ino	= inode->i_ino;
+		__entry->sync_mode = wbc->sync_mode;
+		__entry->for_sync = wbc->for_sync;
+	),
+
+	TP_printk("dev %d:%d ino %llu sync_mode %d for_sync %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->sync_mode, __entry->for_sync)
+);
+
+DECLARE_EVENT_CLASS(xiafs_truncate_class,
+	TP_PROTO(struct inode *inode),
+
+	TP_ARGS(inode),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(u64,		ino)
+		__field(loff_t,		size)
+		__field(blkcnt_t,	blocks)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= inode->i_sb->s_dev;
+		__entry->ino	= inode->i_ino;
+		__entry->size	= inode->i_size;
+		__entry->blocks	= inode->i_blocks;
+	),
+
+	TP_printk("dev %d:%d ino %llu size %lld blocks %llu",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->size, (unsigned long long)__entry->blocks)
+);
+
+DEFINE_EVENT(xiafs_truncate_class, xiafs_truncate_enter,
+	TP_PROTO(struct inode *inode),
+	TP_ARGS(inode));
+
+DEFINE_EVENT(xiafs_truncate_class, xiafs_truncate_exit,
+	TP_PROTO(struct inode *inode),
+	TP_ARGS(inode));
+
+#endif /* _TRACE_XIAFS_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH trace/events
+#include <trace/define_trace.h>
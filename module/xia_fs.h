@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#ifndef _XIA_FS_H
+#define _XIA_FS_H
+
+/*
+ * The xiafs on-disk format and ioctl interface, shared by the module and
+ * the tools in programs/ (which build with -I../module). Only fixed size
+ * types in here, so it means the same thing on both sides.
+ *
+ * Adapted from:
+ * include/linux/xia_fs.h
+ *
+ * Copyright (C) Q. Frank Xia, 1993.
+ *
+ * Based on Linus' minix_fs.h.
+ * Copyright (C) Linus Torvalds, 1991, 1992.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#include <linux/fs.h>		/* BLOCK_SIZE */
+
+#define _XIAFS_SUPER_MAGIC 0x012FD16D
+#define _XIAFS_ROOT_INO 1
+#define _XIAFS_BAD_INO  2
+#define _XIAFS_MAX_LINK 64000
+/* I think this is the equivalent of s_dirsize in the minix stuff */
+#define _XIAFS_DIR_SIZE 12
+#define _XIAFS_NUM_BLOCK_POINTERS 10
+
+#define _XIAFS_NAME_LEN 248
+
+#define _XIAFS_INODES_PER_BLOCK ((BLOCK_SIZE)/(sizeof(struct xiafs_inode)))
+
+struct xiafs_inode {		/* 64 bytes */
+    __u16   i_mode;
+    __u16  i_nlinks;
+    __u16    i_uid;
+    __u16    i_gid;
+    __u32   i_size;		/* 8 */
+    __u32   i_ctime;
+    __u32   i_atime;
+    __u32   i_mtime;
+    __u32  i_zone[_XIAFS_NUM_BLOCK_POINTERS];
+};
+
+/*
+ * linux super-block data on disk
+ */
+struct xiafs_super_block {
+    __u8   s_boot_segment[512];	/*  1st sector reserved for boot */
+    __u32  s_zone_size;		/*  0: the name says it		 */
+    __u32  s_nzones;			/*  1: volume size, zone aligned */
+    __u32  s_ninodes;			/*  2: # of inodes		 */
+    __u32  s_ndatazones;		/*  3: # of data zones		 */
+    __u32  s_imap_zones;		/*  4: # of imap zones           */
+    __u32  s_zmap_zones;		/*  5: # of zmap zones		 */
+    __u32  s_firstdatazone;		/*  6: first data zone           */
+    __u32  s_zone_shift;		/*  7: z size = 1KB << z shift   */
+    __u32  s_max_size;			/*  8: max size of a single file */
+    __u32  s_features;		/*  9: XIAFS_FEATURE_*		 */
+    __u32  s_reserved1;		/* 10: 				 */
+    __u32  s_reserved2;		/* 11:				 */
+    __u32  s_reserved3;		/* 12:				 */
+    __u32  s_firstkernzone;		/* 13: first kernel zone	 */
+    __u32  s_kernzones;		/* 14: kernel size in zones	 */
+    __u32  s_magic;			/* 15: magic number for xiafs    */
+};
+
+/*
+ * s_features bits. Zero on file systems made before there were any; a
+ * kernel refuses to mount one with bits it doesn't know about.
+ *
+ * XIAFS_FEATURE_FAST_SYMLINK: symlinks whose target (with its NUL) fits in
+ * i_zone keep it there instead of in a data zone. Such an inode has no
+ * zones, and the block count normally kept in the top bytes of i_zone[0..2]
+ * is implied to be zero.
+ */
+#define XIAFS_FEATURE_FAST_SYMLINK	0x1
+#define XIAFS_FEATURE_ALL		XIAFS_FEATURE_FAST_SYMLINK
+
+#define _XIAFS_FAST_SYMLINK_SIZE	(_XIAFS_NUM_BLOCK_POINTERS * 4)
+
+struct xiafs_direct {
+    __u32   d_ino;
+    __u16   d_rec_len;
+    __u8    d_name_len;
+    char    d_name[_XIAFS_NAME_LEN+1];
+};
+
+/*
+ * xiafs specific ioctls.
+ */
+
+/* XIAFS_IOC_COMPACT_DIR: pack a directory's entries and drop dead zones */
+struct xiafs_dir_compact {
+    __u64   dc_old_size;	/* directory size before, in bytes */
+    __u64   dc_new_size;	/* and after */
+    __u64   dc_reclaimed;	/* bytes of zones given back */
+    __u32   dc_live;		/* live entries kept */
+    __u32   dc_dead;		/* dead records dropped */
+};
+
+#define XIAFS_IOC_COMPACT_DIR	_IOR('x', 1, struct xiafs_dir_compact)
+
+/* What the bulk metadata ioctls return for each inode. */
+struct xiafs_stat {
+    __u64   xs_ino;
+    __u64   xs_size;
+    __u64   xs_blocks;		/* in 512 byte units, as stat(2) */
+    __s64   xs_atime;
+    __s64   xs_mtime;
+    __s64   xs_ctime;
+    __u32   xs_mode;
+    __u32   xs_nlink;
+    __u32   xs_uid;
+    __u32   xs_gid;
+};
+
+/*
+ * XIAFS_IOC_READDIRPLUS: read directory entries starting at rp_cookie
+ * along with each entry's attributes. The buffer at rp_buf is filled with
+ * xiafs_direntplus records, dp_reclen bytes apart. rp_cookie is updated to
+ * where the next call should carry on from.
+ */
+struct xiafs_direntplus {
+    struct xiafs_stat dp_stat;
+    __u16   dp_reclen;		/* length of this record */
+    __u8    dp_name_len;
+    __u8    dp_pad;
+    char    dp_name[];		/* NUL terminated */
+};
+
+#define XIAFS_DIRENTPLUS_LEN(namelen) \
+	((sizeof(struct xiafs_direntplus) + (namelen) + 1 + 7) & ~7)
+
+struct xiafs_readdirplus {
+    __u64   rp_cookie;		/* in: where to start, out: where to resume */
+    __u64   rp_buf;		/* user buffer */
+    __u32   rp_bufsize;		/* its size, at least XIAFS_DIRENTPLUS_LEN(248) */
+    __u32   rp_count;		/* out: records returned */
+    __u32   rp_used;		/* out: bytes of rp_buf used */
+    __u32   rp_flags;		/* out: XIAFS_RDP_EOF */
+};
+
+#define XIAFS_RDP_EOF		0x1	/* nothing left after rp_cookie */
+
+#define XIAFS_IOC_READDIRPLUS	_IOWR('x', 2, struct xiafs_readdirplus)
+
+/*
+ * XIAFS_IOC_BULKSTAT: attributes for up to bs_count allocated inodes from
+ * inode bs_ino on, read straight out of the inode table. Needs
+ * CAP_SYS_ADMIN; issue it on the root of the file system.
+ */
+struct xiafs_bulkstat {
+    __u64   bs_ino;		/* in: first inode, out: where to resume */
+    __u64   bs_buf;		/* user array of struct xiafs_stat */
+    __u32   bs_count;		/* in: its length, out: records returned */
+    __u32   bs_flags;		/* out: XIAFS_BS_EOF */
+};
+
+#define XIAFS_BS_EOF		0x1	/* no allocated inodes after bs_ino */
+
+#define XIAFS_IOC_BULKSTAT	_IOWR('x', 3, struct xiafs_bulkstat)
+
+#endif  /* _XIA_FS_H */
@@ -11,30 +11,20 @@
  * kernels.
  */
 
-/*
- * Adapted from:
- * include/linux/xia_fs.h
- *
- * Copyright (C) Q. Frank Xia, 1993.
- *
- * Based on Linus' minix_fs.h.
- * Copyright (C) Linus Torvalds, 1991, 1992.
- */
-
 #include <linux/fs.h>
 #include <linux/iomap.h>
-
-#define _XIAFS_SUPER_MAGIC 0x012FD16D
-#define _XIAFS_ROOT_INO 1
-#define _XIAFS_BAD_INO  2
-#define _XIAFS_MAX_LINK 64000
-/* I think this is the equivalent of s_dirsize in the minix stuff */
-#define _XIAFS_DIR_SIZE 12
-#define _XIAFS_NUM_BLOCK_POINTERS 10
-
-#define _XIAFS_NAME_LEN 248
-
-#define _XIAFS_INODES_PER_BLOCK ((BLOCK_SIZE)/(sizeof(struct xiafs_inode)))
+#include <linux/completion.h>
+#include <linux/kobject.h>
+#include <linux/percpu.h>
+#include <linux/jump_label.h>
+#include <linux/spinlock.h>
+#ifdef XIAFS_KUNIT_TEST
+#include <kunit/static_stub.h>
+#endif
+#include <linux/timekeeping.h>
+
+/* the on-disk format and ioctls, shared with programs/ */
+#include "xia_fs.h"
 
 /* TODO: these probably don't need to be a special typedefs anymore. */
 typedef u32 block_t;	/* 32 bit, host order */
@@ -44,48 +34,6 @@ typedef struct {
 	struct buffer_head *bh;
 } Indirect;
 
-struct xiafs_inode {		/* 64 bytes */
-    __u16   i_mode;
-    __u16  i_nlinks;
-    __u16    i_uid;
-    __u16    i_gid;
-    __u32   i_size;		/* 8 */
-    __u32   i_ctime;
-    __u32   i_atime;
-    __u32   i_mtime;
-    __u32  i_zone[_XIAFS_NUM_BLOCK_POINTERS];
-};
-
-/*
- * linux super-block data on disk
- */
-struct xiafs_super_block {
-    u_char  s_boot_segment[512];	/*  1st sector reserved for boot */
-    __u32  s_zone_size;		/*  0: the name says it		 */
-    __u32  s_nzones;			/*  1: volume size, zone aligned */ 
-    __u32  s_ninodes;			/*  2: # of inodes		 */
-    __u32  s_ndatazones;		/*  3: # of data zones		 */
-    __u32  s_imap_zones;		/*  4: # of imap zones           */
-    __u32  s_zmap_zones;		/*  5: # of zmap zones		 */
-    __u32  s_firstdatazone;		/*  6: first data zone           */
-    __u32  s_zone_shift;		/*  7: z size = 1KB << z shift   */
-    __u32  s_max_size;			/*  8: max size of a single file */
-    __u32  s_reserved0;		/*  9: reserved			 */
-    __u32  s_reserved1;		/* 10: 				 */
-    __u32  s_reserved2;		/* 11:				 */
-    __u32  s_reserved3;		/* 12:				 */
-    __u32  s_firstkernzone;		/* 13: first kernel zone	 */
-    __u32  s_kernzones;		/* 14: kernel size in zones	 */
-    __u32  s_magic;			/* 15: magic number for xiafs    */
-};
-
-struct xiafs_direct {
-    __u32   d_ino;
-    u_short d_rec_len;
-    u_char  d_name_len;
-    char    d_name[_XIAFS_NAME_LEN+1];
-};
-
 /*
  * Adapted from:
  * include/linux/xia_fs_i.h
@@ -99,9 +47,19 @@ struct xiafs_direct {
 struct xiafs_inode_info {               /* for data zone pointers */
     __u32  i_zone[_XIAFS_NUM_BLOCK_POINTERS];
     struct mapping_metadata_bhs i_metadata_bhs;
+    int    i_dir_entries;	/* live entries in a directory, . and ..
+				 * included; -1 until someone counts them */
+    unsigned long i_flags;	/* XIAFS_I_* */
     struct inode vfs_inode;
 };
 
+/*
+ * XIAFS_I_LAYOUT: blocks have been allocated or freed, or the size has
+ * changed, since the inode's metadata was last synced. Without it,
+ * fdatasync only has to write data.
+ */
+#define XIAFS_I_LAYOUT		0
+
 /*
  * Adapted from:
  * include/linux/xia_fs_sb.h
@@ -124,12 +82,129 @@ struct xiafs_sb_info {
     u_long   s_firstdatazone;
     u_long   s_zone_shift;
     u_long   s_max_size;                                /*  32 bytes */
+    u_long   s_features;			/* XIAFS_FEATURE_* */
     struct buffer_head ** s_imap_buf; /*  32 bytes */
     struct buffer_head ** s_zmap_buf; /* 128 bytes */
     u_char   s_imap_cached;                     /* flag for cached imap */
     u_char   s_zmap_cached;                     /* flag for cached imap */
+    u_int    s_inode_ra;		/* inode table readahead, in blocks */
+    sector_t s_inode_ra_last;		/* table block of the last iget miss */
+    sector_t s_inode_ra_end;		/* end of what's been read ahead */
+    u_long   s_itable_blocks;		/* size of the inode table */
+    u_long * s_itable_dirty;		/* table blocks left for sync_fs */
+    struct mutex s_commit_mutex;	/* fsync group commit, see */
+    atomic64_t s_commit_start;		/* xiafs_commit() */
+    u64      s_commit_done;
+    struct super_block *s_sb;
+    spinlock_t s_orphan_lock;		/* deleted files whose zones */
+    struct list_head s_orphans;		/* are still to be freed, see */
+    atomic_long_t s_free_pending;	/* orphan.c; and how many zones */
+    struct workqueue_struct *s_orphan_wq;
+    struct delayed_work s_orphan_work;
+    struct xiafs_stats __percpu *s_stats;	/* see sysfs.c */
+    struct kobject s_kobj;		/* /sys/fs/xiafs/<dev> */
+    struct completion s_kobj_unregister;
+    struct xiafs_latency __percpu *s_latency;	/* see debugfs.c */
+    struct dentry *s_debugfs;		/* <debugfs>/xiafs/<dev> */
+    unsigned long s_debug_ino;		/* inode for its extents file */
 };
 
+/*
+ * Per-mount event counters, shown in /sys/fs/xiafs/<dev>/stats. Keep
+ * xiafs_stat_names in sysfs.c in the same order.
+ */
+enum xiafs_stat_item {
+	XIAFS_STAT_BLOCKS_ALLOC,
+	XIAFS_STAT_BLOCKS_FREED,
+	XIAFS_STAT_ZMAP_SCANNED,	/* bytes of zmap looked at */
+	XIAFS_STAT_INODES_ALLOC,
+	XIAFS_STAT_INODES_FREED,
+	XIAFS_STAT_IMAP_SCANNED,	/* bytes of imap looked at */
+	XIAFS_STAT_LOOKUPS,
+	XIAFS_STAT_LOOKUP_SCANNED,	/* dir entries looked at */
+	XIAFS_STAT_ADD_LINKS,
+	XIAFS_STAT_ADD_SCANNED,		/* dir entries looked at */
+	XIAFS_STAT_DIRSYNC,
+	XIAFS_STAT_INDIRECT_READS,
+	XIAFS_STAT_IOMAP_CALLS,
+	XIAFS_STAT_IOMAP_BYTES,		/* bytes mapped by them */
+	XIAFS_STAT_ITABLE_READS,
+	XIAFS_STAT_ITABLE_WRITES,
+	XIAFS_NR_STATS
+};
+
+struct xiafs_stats {
+	u64 st[XIAFS_NR_STATS];
+};
+
+/*
+ * Latency histograms of the operations below, in <debugfs>/xiafs/<dev>/
+ * latency. Bucket b counts calls that took from 2^(b-1) up to 2^b ns; the
+ * last one takes everything slower. Keep xiafs_lat_names in debugfs.c in
+ * the same order.
+ */
+enum xiafs_lat_op {
+	XIAFS_LAT_LOOKUP,
+	XIAFS_LAT_CREATE,
+	XIAFS_LAT_UNLINK,
+	XIAFS_LAT_RENAME,
+	XIAFS_LAT_MKDIR,
+	XIAFS_LAT_READDIR,
+	XIAFS_LAT_FSYNC,
+	XIAFS_LAT_TRUNCATE,
+	XIAFS_NR_LAT_OPS
+};
+
+#define XIAFS_LAT_BUCKETS	36	/* the last starts at 2^34ns, ~17s */
+
+struct xiafs_latency {
+	u64 lh[XIAFS_NR_LAT_OPS][XIAFS_LAT_BUCKETS];
+};
+
+/*
+ * Where bitmap_lock and pointers_lock get taken, for the contention
+ * accounting in lockstat.c. Keep xiafs_lock_site_names in debugfs.c in
+ * the same order.
+ */
+enum xiafs_lock_site {
+	XIAFS_LOCK_NEW_BLOCK,
+	XIAFS_LOCK_FREE_BLOCK,
+	XIAFS_LOCK_NEW_INODE,
+	XIAFS_LOCK_FREE_INODE,
+	XIAFS_LOCK_GET_BRANCH,
+	XIAFS_LOCK_SPLICE_BRANCH,
+	XIAFS_LOCK_FIND_SHARED,
+	XIAFS_NR_LOCK_SITES
+};
+
+struct xiafs_lock_stat {
+	u64 acquired;
+	u64 contended;		/* of those, how many had to wait */
+	u64 wait_ns;
+	u64 hold_ns;
+};
+
+struct xiafs_lock_stats {
+	struct xiafs_lock_stat ls[XIAFS_NR_LOCK_SITES];
+};
+
+DECLARE_STATIC_KEY_FALSE(xiafs_lock_stats_on);
+DECLARE_PER_CPU(struct xiafs_lock_stats, xiafs_lock_stats);
+
+/*
+ * Lets the KUnit tests swap out a function for one of their own while
+ * they run; nothing at all unless the tests are built in.
+ */
+#ifdef XIAFS_KUNIT_TEST
+#define XIAFS_KUNIT_STUB(fn, args...)	KUNIT_STATIC_STUB_REDIRECT(fn, ##args)
+#else
+#define XIAFS_KUNIT_STUB(fn, args...)	do { } while (0)
+#endif
+
+/* Default and largest inode_readahead_blks= mount option. */
+#define XIAFS_DEF_INODE_RA	32
+#define XIAFS_MAX_INODE_RA	4096
+
 /*
  *  Adapted from:
  *  linux/fs/xiafs/xiafs_mac.h
@@ -176,6 +251,115 @@ static inline struct xiafs_inode_info *xiafs_i(struct inode *inode)
         return list_entry(inode, struct xiafs_inode_info, vfs_inode);
 }
 
+static inline void xiafs_stat_add(struct super_block *sb,
+		enum xiafs_stat_item item, u64 n)
+{
+	this_cpu_add(xiafs_sb(sb)->s_stats->st[item], n);
+}
+
+static inline void xiafs_stat_inc(struct super_block *sb,
+		enum xiafs_stat_item item)
+{
+	xiafs_stat_add(sb, item, 1);
+}
+
+/* Count an operation that started at `start', a ktime_get_ns() value. */
+static inline void xiafs_lat_record(struct super_block *sb,
+		enum xiafs_lat_op op, u64 start)
+{
+	unsigned int b = fls64(ktime_get_ns() - start);
+
+	if (b >= XIAFS_LAT_BUCKETS)
+		b = XIAFS_LAT_BUCKETS - 1;
+	this_cpu_inc(xiafs_sb(sb)->s_latency->lh[op][b]);
+}
+
+u64 xiafs_lock_stat_spin(spinlock_t *lock, enum xiafs_lock_site site);
+u64 xiafs_lock_stat_read(rwlock_t *lock, enum xiafs_lock_site site);
+u64 xiafs_lock_stat_write(rwlock_t *lock, enum xiafs_lock_site site);
+void xiafs_lock_stat_release(enum xiafs_lock_site site, u64 since);
+
+/*
+ * Lock wrappers for the global locks. The lock side returns a cookie the
+ * unlock side wants back: when the lock was got if lock_stats is on, or 0
+ * if it was off (including when it was switched on in between).
+ */
+static inline u64 xiafs_spin_lock(spinlock_t *lock, enum xiafs_lock_site site)
+{
+	if (static_branch_unlikely(&xiafs_lock_stats_on))
+		return xiafs_lock_stat_spin(lock, site);
+	spin_lock(lock);
+	return 0;
+}
+
+static inline void xiafs_spin_unlock(spinlock_t *lock,
+		enum xiafs_lock_site site, u64 since)
+{
+	if (since)
+		xiafs_lock_stat_release(site, since);
+	spin_unlock(lock);
+}
+
+static inline u64 xiafs_read_lock(rwlock_t *lock, enum xiafs_lock_site site)
+{
+	if (static_branch_unlikely(&xiafs_lock_stats_on))
+		return xiafs_lock_stat_read(lock, site);
+	read_lock(lock);
+	return 0;
+}
+
+static inline void xiafs_read_unlock(rwlock_t *lock,
+		enum xiafs_lock_site site, u64 since)
+{
+	if (since)
+		xiafs_lock_stat_release(site, since);
+	read_unlock(lock);
+}
+
+static inline u64 xiafs_write_lock(rwlock_t *lock, enum xiafs_lock_site site)
+{
+	if (static_branch_unlikely(&xiafs_lock_stats_on))
+		return xiafs_lock_stat_write(lock, site);
+	write_lock(lock);
+	return 0;
+}
+
+static inline void xiafs_write_unlock(rwlock_t *lock,
+		enum xiafs_lock_site site, u64 since)
+{
+	if (since)
+		xiafs_lock_stat_release(site, since);
+	write_unlock(lock);
+}
+
+static inline void xiafs_layout_changed(struct inode *inode)
+{
+	set_bit(XIAFS_I_LAYOUT, &xiafs_i(inode)->i_flags);
+}
+
+/*
+ * Whether a symlink of the given size keeps its target in i_zone. The size
+ * alone decides it on a file system with the feature, since symlinks are
+ * never resized.
+ */
+static inline bool xiafs_fast_symlink(struct super_block *sb, umode_t mode,
+		loff_t size)
+{
+	return S_ISLNK(mode) &&
+	       (xiafs_sb(sb)->s_features & XIAFS_FEATURE_FAST_SYMLINK) &&
+	       size < _XIAFS_FAST_SYMLINK_SIZE;
+}
+
+/*
+ * The same for an inode in core. Going by i_link rather than i_size keeps
+ * this right in evict, after i_size has been zeroed.
+ */
+static inline bool xiafs_inode_is_fast_symlink(struct inode *inode)
+{
+	return S_ISLNK(inode->i_mode) &&
+	       inode->i_link == (char *)xiafs_i(inode)->i_zone;
+}
+
 /* moved from itree.c since it's also used by iomap.c */
 static inline unsigned long block_to_cpu(block_t n)
 {
@@ -206,36 +390,82 @@ static inline void print_mem(void const *vp, size_t n){
 
 #ifdef __KERNEL__
 
+/*
+ * A directory entry found by xiafs_find_entries(): the folio it's in
+ * (mapped and referenced), the entry, and the live entry before it on the
+ * same page that xiafs_delete_entry() wants.
+ */
+struct xiafs_dir_loc {
+	struct folio *folio;
+	struct xiafs_direct *de;
+	struct xiafs_direct *de_pre;
+};
+
 struct inode * xiafs_new_inode(const struct inode *dir, umode_t mode, int *error);
 void xiafs_free_inode(struct inode *inode);
 unsigned long xiafs_count_free_inodes(struct xiafs_sb_info *sbi);
 int xiafs_prepare_chunk(struct folio *folio, loff_t pos, unsigned len);
 
 void xiafs_set_inode(struct inode *, dev_t);
+int __xiafs_add_link(struct dentry*, struct inode*);
 int xiafs_add_link(struct dentry*, struct inode*);
 ino_t xiafs_inode_by_name(struct dentry*);
 int xiafs_make_empty(struct inode*, struct inode*);
 struct xiafs_direct *xiafs_find_entry(struct dentry*, struct folio**, struct xiafs_direct**);
+int xiafs_find_entries(struct inode*, const struct qstr*, struct xiafs_dir_loc*,
+		const struct qstr*, struct xiafs_dir_loc*);
+void xiafs_put_entries(struct xiafs_dir_loc*, struct xiafs_dir_loc*);
+int __xiafs_delete_entry(struct xiafs_direct*, struct xiafs_direct*, struct folio*);
 int xiafs_delete_entry(struct xiafs_direct*, struct xiafs_direct*, struct folio*);
 struct xiafs_direct *xiafs_dotdot(struct inode*, struct folio**);
+int __xiafs_set_link(struct xiafs_direct*, struct folio*, struct inode*);
 int xiafs_set_link(struct xiafs_direct*, struct folio*, struct inode*);
+int __xiafs_rename_entry(struct xiafs_direct*, struct folio*, const struct qstr*);
+int xiafs_handle_dirsync(struct inode*);
 int xiafs_empty_dir(struct inode*);
+int xiafs_readdir(struct file *, struct dir_context *);
+int do_xiafs_readdir(struct file *, struct dir_context *);
+int xiafs_compact_dir(struct inode *, struct xiafs_dir_compact *);
 const char *xiafs_get_link(struct dentry *dentry, struct inode *inode,
 		struct delayed_call *callback);
 
 void xiafs_truncate(struct inode *);
+int xiafs_stage_inode(struct inode *);
+int xiafs_commit(struct super_block *);
 struct inode * xiafs_iget(struct super_block *, unsigned long);
 int xiafs_getattr(struct mnt_idmap *, const struct path *path, struct kstat *stat, u32 request_mask, unsigned int flags);
 int xiafs_setattr(struct mnt_idmap *idmap, struct dentry *dentry, struct iattr *attr);
 
 int xiafs_fsync(struct file *file, loff_t start, loff_t end, int datasync);
+long xiafs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
 int xiafs_new_block(struct inode * inode);
 unsigned long xiafs_count_free_blocks(struct xiafs_sb_info * sbi);
 void xiafs_free_block(struct inode *inode, unsigned long block);
+bool xiafs_free_zone(struct super_block *sb, unsigned long block);
 int xiafs_get_block(struct inode *inode, sector_t block, struct buffer_head *bh_result, int create);
 struct xiafs_inode * xiafs_raw_inode(struct super_block *sb, ino_t ino, struct buffer_head **bh);
+sector_t xiafs_inode_block(struct xiafs_sb_info *sbi, ino_t ino);
+void xiafs_inode_readahead(struct super_block *sb, ino_t ino);
+unsigned long xiafs_next_inode(struct super_block *sb, unsigned long ino);
 unsigned xiafs_blocks(loff_t size, struct super_block *sb);
 
+bool xiafs_defer_free(struct inode *inode);
+bool xiafs_flush_orphans(struct super_block *sb);
+void xiafs_drain_orphans(struct super_block *sb);
+void xiafs_resume_orphans(struct super_block *sb);
+int xiafs_orphan_init(struct super_block *sb);
+void xiafs_orphan_destroy(struct super_block *sb);
+
+int xiafs_register_sysfs(struct super_block *sb);
+void xiafs_unregister_sysfs(struct super_block *sb);
+int __init xiafs_init_sysfs(void);
+void xiafs_exit_sysfs(void);
+
+int xiafs_register_debugfs(struct super_block *sb);
+void xiafs_unregister_debugfs(struct super_block *sb);
+void __init xiafs_init_debugfs(void);
+void xiafs_exit_debugfs(void);
+
 /* Formerly static functions from itree.c that are now used in more than one
  * place.
  */
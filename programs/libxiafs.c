@@ -0,0 +1,881 @@
+/*
+ * libxiafs.c - reading and writing xiafs file systems from user space
+ */
+/*
+ * See libxiafs.h for how it's used. The layout is worked out the way
+ * mkxfs does it: zone 0 has the boot sector and the superblock, then come
+ * the imap, the zmap, the inode table, the zones kept for a kernel image
+ * if any, and the data zones. Bit n of the imap is inode n, and bit n of
+ * the zmap is zone n + s_firstdatazone - 1; bit 0 of each is never used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libxiafs.h"
+
+#if BLOCK_SIZE != 1024
+#error "only block size 1024 supported"
+#endif
+
+#define ZHASH		128		/* cache hash buckets */
+
+struct zslot {
+  uint32_t nr;				/* NO_ZONE if empty */
+  int next;				/* in its hash chain, or -1 */
+  int dirty;
+  uint64_t used;			/* when it was last looked at */
+  unsigned char *data;
+};
+
+struct xiafs_zcache {
+  int hash[ZHASH];
+  struct zslot slot[XIAFS_ZCACHE_ZONES];
+  uint64_t clock;
+  unsigned char *data;
+};
+
+#define NO_ZONE		UINT32_MAX
+
+/*------------------------------------------------------------------------
+ * zone I/O
+ */
+static int rw_zones(int fd, int zone_shift, uint32_t nr, uint32_t count,
+		    void *buf, int write)
+{
+  size_t len=(size_t)count << (BLOCK_SIZE_BITS + zone_shift);
+  off_t pos=(off_t)nr << (BLOCK_SIZE_BITS + zone_shift);
+  unsigned char *p=buf;
+  ssize_t n;
+
+  while (len) {
+    if (write)
+      n=pwrite(fd, p, len, pos);
+    else
+      n=pread(fd, p, len, pos);
+    if (n < 0) {
+      if (errno == EINTR)
+	continue;
+      return -1;
+    }
+    if (!n) {				/* past the end of the device */
+      errno=EIO;
+      return -1;
+    }
+    p += n;
+    pos += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int xiafs_read_zones(int fd, int zone_shift, uint32_t nr, uint32_t count,
+		     void *buf)
+{
+  return rw_zones(fd, zone_shift, nr, count, buf, 0);
+}
+
+int xiafs_write_zones(int fd, int zone_shift, uint32_t nr, uint32_t count,
+		      const void *buf)
+{
+  return rw_zones(fd, zone_shift, nr, count, (void *)buf, 1);
+}
+
+/*------------------------------------------------------------------------
+ * the zone cache, for when the device isn't mmapped
+ */
+static struct xiafs_zcache *zcache_new(uint32_t zone_size)
+{
+  struct xiafs_zcache *zc;
+  int i;
+
+  if (!(zc=calloc(1, sizeof(*zc))))
+    return NULL;
+  if (!(zc->data=malloc((size_t)XIAFS_ZCACHE_ZONES * zone_size))) {
+    free(zc);
+    return NULL;
+  }
+  for (i=0; i < ZHASH; i++)
+    zc->hash[i]=-1;
+  for (i=0; i < XIAFS_ZCACHE_ZONES; i++) {
+    zc->slot[i].nr=NO_ZONE;
+    zc->slot[i].next=-1;
+    zc->slot[i].data=zc->data + (size_t)i * zone_size;
+  }
+  return zc;
+}
+
+static struct zslot *zcache_find(struct xiafs_zcache *zc, uint32_t nr)
+{
+  int i;
+
+  for (i=zc->hash[nr & (ZHASH-1)]; i >= 0; i=zc->slot[i].next)
+    if (zc->slot[i].nr == nr)
+      return &zc->slot[i];
+  return NULL;
+}
+
+static int zcache_writeback(struct xiafs_fs *fs, struct zslot *s)
+{
+  if (!s->dirty)
+    return 0;
+  if (xiafs_write_zones(fs->fd, fs->zone_shift, s->nr, 1, s->data))
+    return -1;
+  s->dirty=0;
+  return 0;
+}
+
+/* The least recently used slot, emptied and unhashed. */
+static struct zslot *zcache_evict(struct xiafs_fs *fs)
+{
+  struct xiafs_zcache *zc=fs->cache;
+  struct zslot *s=&zc->slot[0];
+  int i, *ip;
+
+  for (i=1; i < XIAFS_ZCACHE_ZONES; i++)
+    if (zc->slot[i].used < s->used)
+      s=&zc->slot[i];
+  if (s->nr == NO_ZONE)
+    return s;
+  if (zcache_writeback(fs, s))
+    return NULL;
+  for (ip=&zc->hash[s->nr & (ZHASH-1)]; *ip >= 0; ip=&zc->slot[*ip].next)
+    if (&zc->slot[*ip] == s) {
+      *ip=s->next;
+      break;
+    }
+  s->nr=NO_ZONE;
+  s->next=-1;
+  return s;
+}
+
+static struct zslot *zcache_get(struct xiafs_fs *fs, uint32_t nr, int read)
+{
+  struct xiafs_zcache *zc=fs->cache;
+  struct zslot *s;
+  int b;
+
+  if ((s=zcache_find(zc, nr))) {
+    s->used=++zc->clock;
+    return s;
+  }
+  if (!(s=zcache_evict(fs)))
+    return NULL;
+  if (read && xiafs_read_zones(fs->fd, fs->zone_shift, nr, 1, s->data))
+    return NULL;
+  b=nr & (ZHASH-1);
+  s->nr=nr;
+  s->next=zc->hash[b];
+  zc->hash[b]=s - zc->slot;
+  s->used=++zc->clock;
+  return s;
+}
+
+/*------------------------------------------------------------------------
+ * zones
+ */
+void *xiafs_zone(struct xiafs_fs *fs, uint32_t nr)
+{
+  struct zslot *s;
+
+  if (nr >= fs->nzones) {
+    errno=EINVAL;
+    return NULL;
+  }
+  if (fs->map)
+    return fs->map + ((size_t)nr << (BLOCK_SIZE_BITS + fs->zone_shift));
+  if (!(s=zcache_get(fs, nr, 1)))
+    return NULL;
+  return s->data;
+}
+
+void xiafs_zone_dirty(struct xiafs_fs *fs, uint32_t nr)
+{
+  struct zslot *s;
+
+  if (fs->map || !(fs->flags & XIAFS_OPEN_RDWR))
+    return;
+  if ((s=zcache_find(fs->cache, nr)))
+    s->dirty=1;
+}
+
+int xiafs_read_zone(struct xiafs_fs *fs, uint32_t nr, void *buf)
+{
+  void *p;
+
+  if (!(p=xiafs_zone(fs, nr)))
+    return -1;
+  memcpy(buf, p, fs->zone_size);
+  return 0;
+}
+
+int xiafs_write_zone(struct xiafs_fs *fs, uint32_t nr, const void *buf)
+{
+  struct zslot *s;
+
+  if (!(fs->flags & XIAFS_OPEN_RDWR)) {
+    errno=EBADF;
+    return -1;
+  }
+  if (nr >= fs->nzones) {
+    errno=EINVAL;
+    return -1;
+  }
+  if (fs->map) {
+    memcpy(fs->map + ((size_t)nr << (BLOCK_SIZE_BITS + fs->zone_shift)),
+	   buf, fs->zone_size);
+    return 0;
+  }
+  if (!(s=zcache_get(fs, nr, 0)))	/* no need to read what's replaced */
+    return -1;
+  memcpy(s->data, buf, fs->zone_size);
+  s->dirty=1;
+  return 0;
+}
+
+/*------------------------------------------------------------------------
+ * opening and closing
+ */
+void xiafs_geometry(struct xiafs_super_block *sp, uint32_t zones,
+		    uint32_t kern_zones, int zone_shift)
+{
+  uint32_t zone_size=BLOCK_SIZE << zone_shift;
+  uint32_t bits_per_zone=BLOCK_SIZE << (3 + zone_shift);
+  uint32_t addrs=BLOCK_SIZE >> (2 - zone_shift);
+  uint32_t inode_zones;
+
+  memset(sp, 0, sizeof(*sp));
+  inode_zones=((zones - kern_zones) >> (2 + zone_shift))
+    / _XIAFS_INODES_PER_BLOCK + 1;
+  sp->s_zone_size=zone_size;
+  sp->s_nzones=zones;
+  sp->s_ninodes=inode_zones * _XIAFS_INODES_PER_BLOCK << zone_shift;
+  sp->s_imap_zones=sp->s_ninodes / bits_per_zone + 1;
+  sp->s_zmap_zones=(zones - kern_zones) / bits_per_zone + 1;
+  sp->s_firstkernzone=kern_zones ?
+    1 + sp->s_imap_zones + sp->s_zmap_zones + inode_zones : 0;
+  sp->s_firstdatazone=1 + sp->s_imap_zones + sp->s_zmap_zones + inode_zones
+    + kern_zones;
+  sp->s_ndatazones=zones - sp->s_firstdatazone;
+  sp->s_zone_shift=zone_shift;
+  sp->s_max_size=zone_shift == 2 ? 0xffffffff :
+    ((addrs + 1) * addrs + 8) * zone_size;
+  sp->s_magic=_XIAFS_SUPER_MAGIC;
+}
+
+uint32_t xiafs_inode_zones(const struct xiafs_super_block *sp)
+{
+  return sp->s_ninodes / (_XIAFS_INODES_PER_BLOCK << sp->s_zone_shift);
+}
+
+/* Enough of a superblock that nothing here goes off the end of anything. */
+static int setup(struct xiafs_fs *fs)
+{
+  struct xiafs_super_block *sp=&fs->sb;
+  uint64_t bits;
+
+  if (sp->s_magic != _XIAFS_SUPER_MAGIC || sp->s_zone_shift > 2 ||
+      sp->s_zone_size != BLOCK_SIZE << sp->s_zone_shift) {
+    errno=EINVAL;			/* not xiafs, or not one we know */
+    return -1;
+  }
+  fs->zone_shift=sp->s_zone_shift;
+  fs->zone_size=sp->s_zone_size;
+  fs->addrs_per_zone=fs->zone_size / sizeof(uint32_t);
+  fs->inodes_per_zone=fs->zone_size / sizeof(struct xiafs_inode);
+  fs->nzones=sp->s_nzones;
+  fs->ninodes=sp->s_ninodes;
+  fs->firstdatazone=sp->s_firstdatazone;
+  fs->imap_start=1;
+  fs->zmap_start=fs->imap_start + sp->s_imap_zones;
+  fs->inode_start=fs->zmap_start + sp->s_zmap_zones;
+  fs->inode_zones=(fs->ninodes + fs->inodes_per_zone - 1) /
+    fs->inodes_per_zone;
+  fs->max_zones=8 + fs->addrs_per_zone +
+    fs->addrs_per_zone * fs->addrs_per_zone;
+
+  bits=(uint64_t)fs->zone_size * 8;
+  if (fs->nzones > XIAFS_ZONE_MASK + 1 || !fs->ninodes ||
+      (uint64_t)fs->inode_start + fs->inode_zones > fs->firstdatazone ||
+      fs->firstdatazone > fs->nzones ||
+      sp->s_imap_zones * bits <= fs->ninodes ||
+      sp->s_zmap_zones * bits <= fs->nzones - fs->firstdatazone) {
+    errno=EUCLEAN;
+    return -1;
+  }
+  fs->ndatazones=fs->nzones - fs->firstdatazone;
+  return 0;
+}
+
+/*
+ * Open a file system on fd, which has to be open for writing too with
+ * XIAFS_OPEN_RDWR. It's closed by xiafs_close(), but left alone if this
+ * fails.
+ */
+struct xiafs_fs *xiafs_fdopen(int fd, int flags)
+{
+  struct xiafs_fs *fs;
+  unsigned char buf[BLOCK_SIZE];
+  off_t size;
+  void *map;
+
+  if (!(fs=calloc(1, sizeof(*fs))))
+    return NULL;
+  fs->fd=fd;
+  fs->flags=flags;
+  if (xiafs_read_zones(fd, 0, 0, 1, buf))
+    goto fail;
+  memcpy(&fs->sb, buf, sizeof(fs->sb));
+  if (setup(fs))
+    goto fail;
+
+  fs->map_size=(size_t)fs->nzones << (BLOCK_SIZE_BITS + fs->zone_shift);
+  size=lseek(fd, 0, SEEK_END);		/* st_size is 0 for a device */
+  if (!(flags & XIAFS_OPEN_NOMMAP) && size >= (off_t)fs->map_size) {
+    map=mmap(NULL, fs->map_size,
+	     PROT_READ | (flags & XIAFS_OPEN_RDWR ? PROT_WRITE : 0),
+	     MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED) {
+      fs->map=map;
+      return fs;
+    }
+  }
+  fs->map_size=0;
+  if (!(fs->cache=zcache_new(fs->zone_size)))
+    goto fail;
+  return fs;
+
+fail:
+  free(fs);
+  return NULL;
+}
+
+struct xiafs_fs *xiafs_open(const char *path, int flags)
+{
+  struct xiafs_fs *fs;
+  int fd, err;
+
+  if ((fd=open(path, flags & XIAFS_OPEN_RDWR ? O_RDWR : O_RDONLY)) < 0)
+    return NULL;
+  if (!(fs=xiafs_fdopen(fd, flags))) {
+    err=errno;
+    close(fd);
+    errno=err;
+  }
+  return fs;
+}
+
+int xiafs_flush(struct xiafs_fs *fs)
+{
+  int i, err=0;
+
+  if (!(fs->flags & XIAFS_OPEN_RDWR))
+    return 0;
+  if (fs->map)
+    return msync(fs->map, fs->map_size, MS_SYNC);
+  for (i=0; i < XIAFS_ZCACHE_ZONES; i++)
+    if (fs->cache->slot[i].nr != NO_ZONE &&
+	zcache_writeback(fs, &fs->cache->slot[i]))
+      err=-1;
+  if (!err)
+    err=fsync(fs->fd);
+  return err;
+}
+
+int xiafs_close(struct xiafs_fs *fs)
+{
+  int err, e;
+
+  err=xiafs_flush(fs);
+  e=errno;
+  if (fs->map)
+    munmap(fs->map, fs->map_size);
+  if (fs->cache) {
+    free(fs->cache->data);
+    free(fs->cache);
+  }
+  if (close(fs->fd) && !err) {
+    err=-1;
+    e=errno;
+  }
+  free(fs);
+  errno=e;
+  return err;
+}
+
+/*------------------------------------------------------------------------
+ * bitmaps
+ */
+
+/* The byte with bit nr of the map starting at zone start, and its mask. */
+static unsigned char *map_byte(struct xiafs_fs *fs, uint32_t start,
+			       uint32_t nr, unsigned char *mask)
+{
+  unsigned char *p;
+  int k=BLOCK_SIZE_BITS + 3 + fs->zone_shift;
+
+  if (!(p=xiafs_zone(fs, start + (nr >> k))))
+    return NULL;
+  *mask=1 << (nr & 7);
+  return p + ((nr & ((1u << k) - 1)) >> 3);
+}
+
+static int test_bit(struct xiafs_fs *fs, uint32_t start, uint32_t nr)
+{
+  unsigned char *p, mask;
+
+  if (!(p=map_byte(fs, start, nr, &mask)))
+    return -1;
+  return !!(*p & mask);
+}
+
+static int change_bit(struct xiafs_fs *fs, uint32_t start, uint32_t nr,
+		      int set)
+{
+  unsigned char *p, mask;
+  int old;
+
+  if (!(fs->flags & XIAFS_OPEN_RDWR)) {
+    errno=EBADF;
+    return -1;
+  }
+  if (!(p=map_byte(fs, start, nr, &mask)))
+    return -1;
+  old=!!(*p & mask);
+  if (old != !!set) {
+    *p ^= mask;
+    xiafs_zone_dirty(fs, start + (nr >> (BLOCK_SIZE_BITS + 3 + fs->zone_shift)));
+  }
+  return old;
+}
+
+/* Set bits among the first nbits of the map starting at zone start. */
+static int64_t count_bits(struct xiafs_fs *fs, uint32_t start, uint64_t nbits)
+{
+  uint64_t w, total=0;
+  uint32_t zone, len, i;
+  unsigned char *p;
+
+  for (zone=start; nbits; zone++) {
+    if (!(p=xiafs_zone(fs, zone)))
+      return -1;
+    len=nbits < (uint64_t)fs->zone_size * 8 ? nbits / 8 : fs->zone_size;
+    for (i=0; i + 8 <= len; i += 8) {
+      memcpy(&w, p + i, 8);
+      total += __builtin_popcountll(w);
+    }
+    for (; i < len; i++)
+      total += __builtin_popcount(p[i]);
+    nbits -= (uint64_t)len * 8;
+    if (len < fs->zone_size && nbits) {	/* the last few bits */
+      total += __builtin_popcount(p[len] & ((1 << nbits) - 1));
+      nbits=0;
+    }
+  }
+  return total;
+}
+
+int xiafs_zone_used(struct xiafs_fs *fs, uint32_t zone)
+{
+  if (zone < fs->firstdatazone || zone >= fs->nzones) {
+    errno=EINVAL;
+    return -1;
+  }
+  return test_bit(fs, fs->zmap_start, zone - fs->firstdatazone + 1);
+}
+
+int xiafs_set_zone_used(struct xiafs_fs *fs, uint32_t zone, int used)
+{
+  if (zone < fs->firstdatazone || zone >= fs->nzones) {
+    errno=EINVAL;
+    return -1;
+  }
+  return change_bit(fs, fs->zmap_start, zone - fs->firstdatazone + 1, used);
+}
+
+int xiafs_inode_used(struct xiafs_fs *fs, uint32_t ino)
+{
+  if (!ino || ino > fs->ninodes) {
+    errno=EINVAL;
+    return -1;
+  }
+  return test_bit(fs, fs->imap_start, ino);
+}
+
+int xiafs_set_inode_used(struct xiafs_fs *fs, uint32_t ino, int used)
+{
+  if (!ino || ino > fs->ninodes) {
+    errno=EINVAL;
+    return -1;
+  }
+  return change_bit(fs, fs->imap_start, ino, used);
+}
+
+/* Both are 0 if the map can't be read. */
+uint32_t xiafs_free_zones(struct xiafs_fs *fs)
+{
+  int64_t used=count_bits(fs, fs->zmap_start, (uint64_t)fs->ndatazones + 1);
+
+  if (used < 0)
+    return 0;
+  used -= test_bit(fs, fs->zmap_start, 0);
+  return used > fs->ndatazones ? 0 : fs->ndatazones - used;
+}
+
+uint32_t xiafs_free_inodes(struct xiafs_fs *fs)
+{
+  int64_t used=count_bits(fs, fs->imap_start, (uint64_t)fs->ninodes + 1);
+
+  if (used < 0)
+    return 0;
+  used -= test_bit(fs, fs->imap_start, 0);
+  return used > fs->ninodes ? 0 : fs->ninodes - used;
+}
+
+/*------------------------------------------------------------------------
+ * inodes
+ */
+struct xiafs_inode *xiafs_inode(struct xiafs_fs *fs, uint32_t ino)
+{
+  struct xiafs_inode *ip;
+
+  if (!ino || ino > fs->ninodes) {
+    errno=EINVAL;
+    return NULL;
+  }
+  if (!(ip=xiafs_zone(fs, fs->inode_start + (ino-1) / fs->inodes_per_zone)))
+    return NULL;
+  return ip + (ino-1) % fs->inodes_per_zone;
+}
+
+void xiafs_inode_dirty(struct xiafs_fs *fs, uint32_t ino)
+{
+  if (ino && ino <= fs->ninodes)
+    xiafs_zone_dirty(fs, fs->inode_start + (ino-1) / fs->inodes_per_zone);
+}
+
+uint32_t xiafs_inode_blocks(const struct xiafs_inode *ip)
+{
+  return ((ip->i_zone[0] >> 24) & 0xff) | ((ip->i_zone[1] >> 16) & 0xff00) |
+    ((ip->i_zone[2] >> 8) & 0xff0000);
+}
+
+void xiafs_set_inode_blocks(struct xiafs_inode *ip, uint32_t blocks)
+{
+  ip->i_zone[0]=(ip->i_zone[0] & XIAFS_ZONE_MASK) | (blocks << 24);
+  ip->i_zone[1]=(ip->i_zone[1] & XIAFS_ZONE_MASK) |
+    ((blocks << 16) & 0xff000000);
+  ip->i_zone[2]=(ip->i_zone[2] & XIAFS_ZONE_MASK) |
+    ((blocks << 8) & 0xff000000);
+}
+
+int xiafs_fast_symlink(struct xiafs_fs *fs, const struct xiafs_inode *ip)
+{
+  return S_ISLNK(ip->i_mode) &&
+    (fs->sb.s_features & XIAFS_FEATURE_FAST_SYMLINK) &&
+    ip->i_size < _XIAFS_FAST_SYMLINK_SIZE;
+}
+
+void xiafs_inode_iter_init(struct xiafs_inode_iter *it, struct xiafs_fs *fs,
+			   int all)
+{
+  it->fs=fs;
+  it->ino=1;
+  it->all=all;
+}
+
+/* The next inode in use (or any, with all), NULL at the end or on error. */
+struct xiafs_inode *xiafs_inode_next(struct xiafs_inode_iter *it,
+				     uint32_t *ino)
+{
+  struct xiafs_fs *fs=it->fs;
+  unsigned char *p, mask;
+  struct xiafs_inode *ip;
+
+  errno=0;
+  while (it->ino <= fs->ninodes) {
+    if (!it->all) {
+      if (!(p=map_byte(fs, fs->imap_start, it->ino, &mask)))
+	return NULL;
+      if (!*p && !(it->ino & 7)) {	/* eight free ones */
+	it->ino += 8;
+	continue;
+      }
+      if (!(*p & mask)) {
+	it->ino++;
+	continue;
+      }
+    }
+    if (!(ip=xiafs_inode(fs, it->ino)))
+      return NULL;
+    *ino=it->ino++;
+    return ip;
+  }
+  return NULL;
+}
+
+/*------------------------------------------------------------------------
+ * block maps
+ */
+static int bad_zone(struct xiafs_fs *fs, uint32_t zone)
+{
+  return zone && (zone < fs->firstdatazone || zone >= fs->nzones);
+}
+
+void xiafs_bmap_init(struct xiafs_bmap_iter *it, struct xiafs_fs *fs,
+		     const struct xiafs_inode *ip, int flags)
+{
+  int i;
+
+  memset(it, 0, sizeof(*it));
+  it->fs=fs;
+  it->flags=flags;
+  for (i=0; i < _XIAFS_NUM_BLOCK_POINTERS; i++)
+    it->zone[i]=ip->i_zone[i] & XIAFS_ZONE_MASK;
+  if (!xiafs_fast_symlink(fs, ip)) {
+    it->nblocks=((uint64_t)ip->i_size + fs->zone_size - 1) >>
+      (BLOCK_SIZE_BITS + fs->zone_shift);
+    if (it->nblocks > fs->max_zones)
+      it->nblocks=fs->max_zones;
+  }
+}
+
+/* The pointers from ptrs[i] up to ptrs[end] that run on from ptrs[i]. */
+static void ptr_run(struct xiafs_fs *fs, const uint32_t *ptrs, uint32_t i,
+		    uint32_t end, uint32_t base, struct xiafs_run *p)
+{
+  uint32_t z=ptrs[i], n=1;
+
+  p->r_lblk=base + i;
+  p->r_zone=z;
+  p->r_flags=0;
+  if (bad_zone(fs, z))
+    p->r_flags=XIAFS_RUN_BAD;
+  else if (!z)
+    while (i + n < end && !ptrs[i + n])
+      n++;
+  else
+    while (i + n < end && ptrs[i + n] == z + n && z + n < fs->nzones)
+      n++;
+  p->r_len=n;
+}
+
+static void meta_run(struct xiafs_fs *fs, uint32_t zone, uint32_t lblk,
+		     struct xiafs_run *p)
+{
+  p->r_lblk=lblk;
+  p->r_zone=zone;
+  p->r_len=1;
+  p->r_flags=XIAFS_RUN_META | (bad_zone(fs, zone) ? XIAFS_RUN_BAD : 0);
+}
+
+/*
+ * The next piece of the file: a run out of one array of pointers, a hole
+ * where an indirect zone is missing, or the indirect zone itself.
+ */
+static int next_piece(struct xiafs_bmap_iter *it, struct xiafs_run *p)
+{
+  struct xiafs_fs *fs=it->fs;
+  uint32_t a=fs->addrs_per_zone, lblk=it->lblk, base, end, ind, g;
+  uint32_t *ptrs;
+
+  if (lblk >= it->nblocks)
+    return 0;
+  if (lblk < 8) {
+    ptr_run(fs, it->zone, lblk, it->nblocks < 8 ? it->nblocks : 8, 0, p);
+    goto data;
+  }
+  if (lblk < 8 + a) {
+    ind=it->zone[8];
+    if (!(it->meta & 1)) {
+      it->meta |= 1;
+      if (ind && (it->flags & XIAFS_BMAP_META)) {
+	meta_run(fs, ind, lblk, p);
+	return 1;
+      }
+    }
+    base=8;
+  } else {
+    if (!(it->meta & 2)) {
+      it->meta |= 2;
+      if (it->zone[9] && (it->flags & XIAFS_BMAP_META)) {
+	meta_run(fs, it->zone[9], lblk, p);
+	return 1;
+      }
+    }
+    if (!it->zone[9] || bad_zone(fs, it->zone[9])) {
+      p->r_lblk=lblk;			/* nothing more */
+      p->r_zone=0;
+      p->r_len=it->nblocks - lblk;
+      p->r_flags=0;
+      goto data;
+    }
+    if (!(ptrs=xiafs_zone(fs, it->zone[9])))
+      return -1;
+    g=(lblk - 8 - a) / a;
+    ind=ptrs[g];
+    if (it->group <= g) {
+      it->group=g + 1;
+      if (ind && (it->flags & XIAFS_BMAP_META)) {
+	meta_run(fs, ind, lblk, p);
+	return 1;
+      }
+    }
+    base=8 + a + g * a;
+  }
+  end=it->nblocks - base < a ? it->nblocks - base : a;
+  if (!ind || bad_zone(fs, ind)) {
+    p->r_lblk=lblk;
+    p->r_zone=0;
+    p->r_len=base + end - lblk;
+    p->r_flags=0;
+    goto data;
+  }
+  if (!(ptrs=xiafs_zone(fs, ind)))
+    return -1;
+  ptr_run(fs, ptrs, lblk - base, end, base, p);
+data:
+  it->lblk=p->r_lblk + p->r_len;
+  return 1;
+}
+
+static int next_wanted(struct xiafs_bmap_iter *it, struct xiafs_run *p)
+{
+  int r;
+
+  while ((r=next_piece(it, p)) > 0)
+    if (p->r_zone || (p->r_flags & XIAFS_RUN_BAD) ||
+	(it->flags & XIAFS_BMAP_HOLES))
+      break;
+  return r;
+}
+
+/*
+ * The next run of the file, as long as it can be made: zones next to each
+ * other on disk for zones next to each other in the file. Indirect zones
+ * and bad pointers come one at a time.
+ */
+int xiafs_bmap_next(struct xiafs_bmap_iter *it, struct xiafs_run *run)
+{
+  struct xiafs_run *n=&it->next;
+  int r;
+
+  if (!it->have_next && (r=next_wanted(it, n)) <= 0)
+    return r;
+  *run=*n;
+  it->have_next=0;
+  if (run->r_flags)
+    return 1;
+  while (next_wanted(it, n) > 0) {
+    if (n->r_flags || n->r_lblk != run->r_lblk + run->r_len ||
+	(run->r_zone ? n->r_zone != run->r_zone + run->r_len : n->r_zone)) {
+      it->have_next=1;
+      break;
+    }
+    run->r_len += n->r_len;
+  }
+  return 1;
+}
+
+/* The zone with file zone lblk in it: 0 for a hole, or a bad pointer. */
+uint32_t xiafs_bmap(struct xiafs_fs *fs, const struct xiafs_inode *ip,
+		    uint32_t lblk)
+{
+  uint32_t a=fs->addrs_per_zone, z, *ptrs;
+
+  if (xiafs_fast_symlink(fs, ip))
+    return 0;
+  if (lblk < 8)
+    z=ip->i_zone[lblk] & XIAFS_ZONE_MASK;
+  else if ((lblk -= 8) < a) {
+    z=ip->i_zone[8] & XIAFS_ZONE_MASK;
+    if (!z || bad_zone(fs, z) || !(ptrs=xiafs_zone(fs, z)))
+      return 0;
+    z=ptrs[lblk];
+  } else if ((lblk -= a) / a < a) {
+    z=ip->i_zone[9] & XIAFS_ZONE_MASK;
+    if (!z || bad_zone(fs, z) || !(ptrs=xiafs_zone(fs, z)))
+      return 0;
+    z=ptrs[lblk / a];
+    if (!z || bad_zone(fs, z) || !(ptrs=xiafs_zone(fs, z)))
+      return 0;
+    z=ptrs[lblk % a];
+  } else
+    return 0;
+  return bad_zone(fs, z) ? 0 : z;
+}
+
+/*------------------------------------------------------------------------
+ * directories
+ */
+void xiafs_dir_init(struct xiafs_dir_iter *it, struct xiafs_fs *fs,
+		    const struct xiafs_inode *ip, int all)
+{
+  memset(it, 0, sizeof(*it));
+  it->fs=fs;
+  it->all=all;
+  xiafs_bmap_init(&it->bmap, fs, ip, 0);
+}
+
+/*
+ * The next entry in use (or every record, with all), pointing into the
+ * directory's zone; it->zone and it->off say where it is. A record that
+ * doesn't fit in its zone fails with EUCLEAN, leaving it->zone and it->off
+ * on the bad record, and the next call goes on with the next zone. A bad
+ * zone pointer fails the same way, with it->zone 0.
+ */
+int xiafs_dir_next(struct xiafs_dir_iter *it, struct xiafs_direct **de)
+{
+  struct xiafs_fs *fs=it->fs;
+  struct xiafs_direct *d;
+  unsigned char *p;
+  uint32_t zone;
+  int r;
+
+  for (;;) {
+    if (it->idx >= it->run.r_len) {
+      if ((r=xiafs_bmap_next(&it->bmap, &it->run)) <= 0)
+	return r;
+      it->idx=0;
+      it->next=0;
+      if (it->run.r_flags & XIAFS_RUN_BAD) {
+	it->idx=it->run.r_len;
+	it->zone=it->off=0;
+	errno=EUCLEAN;
+	return -1;
+      }
+    }
+    if (it->next >= fs->zone_size) {
+      it->idx++;
+      it->next=0;
+      continue;
+    }
+    zone=it->run.r_zone + it->idx;
+    if (!(p=xiafs_zone(fs, zone)))
+      return -1;
+    d=(struct xiafs_direct *)(p + it->next);
+    if (d->d_rec_len < _XIAFS_DIR_SIZE ||
+	it->next + d->d_rec_len > fs->zone_size ||
+	(d->d_ino && (d->d_ino > fs->ninodes ||
+		      d->d_name_len + 8 > d->d_rec_len))) {
+      it->zone=zone;
+      it->off=it->next;
+      it->next=fs->zone_size;
+      errno=EUCLEAN;
+      return -1;
+    }
+    it->zone=zone;
+    it->off=it->next;
+    it->next += d->d_rec_len;
+    if (d->d_ino || it->all) {
+      *de=d;
+      return 1;
+    }
+  }
+}
@@ -0,0 +1,165 @@
+/*
+ * libxiafs.h - reading and writing xiafs file systems from user space
+ */
+/*
+ * A file system is opened with xiafs_open() and looked at a zone at a
+ * time. The whole device is mmapped when it can be, and then xiafs_zone()
+ * hands back a pointer straight into the mapping; otherwise zones are
+ * read with pread() into a small cache, and written back when they're
+ * pushed out of it or at xiafs_flush()/xiafs_close().
+ *
+ * Pointers returned by xiafs_zone(), xiafs_inode() and the iterators
+ * point at the zone itself, not a copy. They stay good until
+ * XIAFS_ZCACHE_ZONES other zones have been asked for (with mmap, until
+ * xiafs_close()). Change what they point at only on a file system opened
+ * with XIAFS_OPEN_RDWR, and then call xiafs_zone_dirty() or
+ * xiafs_inode_dirty() so the change gets written.
+ *
+ * Everything is in host order, as it is on disk. Functions returning int
+ * return -1 and set errno when something goes wrong; EUCLEAN means the
+ * file system itself is damaged.
+ */
+#ifndef _LIBXIAFS_H
+#define _LIBXIAFS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "xia_fs.h"
+
+/* i_zone[0..2] keep the inode's block count in their top byte */
+#define XIAFS_ZONE_MASK		0xffffff
+
+#define XIAFS_ZCACHE_ZONES	64	/* zones kept when not mmapped */
+
+/* xiafs_open() flags */
+#define XIAFS_OPEN_RDWR		0x1	/* we'll be changing things */
+#define XIAFS_OPEN_NOMMAP	0x2	/* pread() and pwrite() only */
+
+struct xiafs_zcache;
+
+struct xiafs_fs {
+  int fd;
+  int flags;			/* XIAFS_OPEN_* */
+  struct xiafs_super_block sb;	/* as it is on disk */
+  int zone_shift;
+  uint32_t zone_size;
+  uint32_t addrs_per_zone;	/* zone pointers in an indirect zone */
+  uint32_t inodes_per_zone;
+  uint32_t nzones;
+  uint32_t ninodes;
+  uint32_t ndatazones;
+  uint32_t firstdatazone;
+  uint32_t imap_start;		/* first zone of the imap, */
+  uint32_t zmap_start;		/* the zmap */
+  uint32_t inode_start;		/* and the inode table */
+  uint32_t inode_zones;
+  uint32_t max_zones;		/* most zones a file can have */
+  unsigned char *map;		/* the whole device, if mmapped */
+  size_t map_size;
+  struct xiafs_zcache *cache;	/* if not */
+};
+
+/*
+ * A stretch of a file: r_len zones from file zone r_lblk, at zones r_zone
+ * on, or a hole if r_zone is 0.
+ */
+struct xiafs_run {
+  uint32_t r_lblk;
+  uint32_t r_zone;
+  uint32_t r_len;
+  int r_flags;			/* XIAFS_RUN_* */
+};
+
+#define XIAFS_RUN_META		0x1	/* an indirect zone, not file data */
+#define XIAFS_RUN_BAD		0x2	/* a pointer outside the data zones */
+
+/* xiafs_bmap_init() flags */
+#define XIAFS_BMAP_META		0x1	/* return indirect zones as well */
+#define XIAFS_BMAP_HOLES	0x2	/* and holes */
+
+struct xiafs_bmap_iter {
+  struct xiafs_fs *fs;
+  uint32_t zone[_XIAFS_NUM_BLOCK_POINTERS];
+  uint32_t lblk;		/* next file zone to look at */
+  uint32_t nblocks;		/* zones in the file */
+  int flags;
+  int meta;			/* 1: i_zone[8] dealt with, 2: i_zone[9] */
+  uint32_t group;		/* second level indirect zones dealt with */
+  int have_next;
+  struct xiafs_run next;	/* looked at, not returned yet */
+};
+
+struct xiafs_inode_iter {
+  struct xiafs_fs *fs;
+  uint32_t ino;			/* next inode to look at */
+  int all;			/* free ones too */
+};
+
+struct xiafs_dir_iter {
+  struct xiafs_fs *fs;
+  struct xiafs_bmap_iter bmap;
+  struct xiafs_run run;		/* data zones being gone through */
+  uint32_t idx;			/* which of them */
+  uint32_t next;		/* offset of the next entry in it */
+  uint32_t zone;		/* zone of the entry returned last, */
+  uint32_t off;			/* and its offset in that zone */
+  int all;			/* unused entries too */
+};
+
+/* The file system */
+struct xiafs_fs *xiafs_open(const char *path, int flags);
+struct xiafs_fs *xiafs_fdopen(int fd, int flags);
+int xiafs_flush(struct xiafs_fs *fs);
+int xiafs_close(struct xiafs_fs *fs);
+
+/*
+ * The superblock mkxfs writes for zones zones of 1KB << zone_shift, with
+ * kern_zones of them kept for a kernel image; s_features is left 0.
+ */
+void xiafs_geometry(struct xiafs_super_block *sp, uint32_t zones,
+		    uint32_t kern_zones, int zone_shift);
+uint32_t xiafs_inode_zones(const struct xiafs_super_block *sp);
+
+/* Zones */
+void *xiafs_zone(struct xiafs_fs *fs, uint32_t nr);
+void xiafs_zone_dirty(struct xiafs_fs *fs, uint32_t nr);
+int xiafs_read_zone(struct xiafs_fs *fs, uint32_t nr, void *buf);
+int xiafs_write_zone(struct xiafs_fs *fs, uint32_t nr, const void *buf);
+int xiafs_read_zones(int fd, int zone_shift, uint32_t nr, uint32_t count,
+		     void *buf);
+int xiafs_write_zones(int fd, int zone_shift, uint32_t nr, uint32_t count,
+		      const void *buf);
+
+/* The bitmaps: 1 in use, 0 free, -1 not a data zone or inode */
+int xiafs_zone_used(struct xiafs_fs *fs, uint32_t zone);
+int xiafs_set_zone_used(struct xiafs_fs *fs, uint32_t zone, int used);
+int xiafs_inode_used(struct xiafs_fs *fs, uint32_t ino);
+int xiafs_set_inode_used(struct xiafs_fs *fs, uint32_t ino, int used);
+uint32_t xiafs_free_zones(struct xiafs_fs *fs);
+uint32_t xiafs_free_inodes(struct xiafs_fs *fs);
+
+/* Inodes */
+struct xiafs_inode *xiafs_inode(struct xiafs_fs *fs, uint32_t ino);
+void xiafs_inode_dirty(struct xiafs_fs *fs, uint32_t ino);
+uint32_t xiafs_inode_blocks(const struct xiafs_inode *ip);
+void xiafs_set_inode_blocks(struct xiafs_inode *ip, uint32_t blocks);
+int xiafs_fast_symlink(struct xiafs_fs *fs, const struct xiafs_inode *ip);
+
+void xiafs_inode_iter_init(struct xiafs_inode_iter *it, struct xiafs_fs *fs,
+			   int all);
+struct xiafs_inode *xiafs_inode_next(struct xiafs_inode_iter *it,
+				     uint32_t *ino);
+
+/* Where a file's zones are: 1 and a run, 0 at the end, or -1 */
+void xiafs_bmap_init(struct xiafs_bmap_iter *it, struct xiafs_fs *fs,
+		     const struct xiafs_inode *ip, int flags);
+int xiafs_bmap_next(struct xiafs_bmap_iter *it, struct xiafs_run *run);
+uint32_t xiafs_bmap(struct xiafs_fs *fs, const struct xiafs_inode *ip,
+		    uint32_t lblk);
+
+/* A directory's entries: 1 and an entry, 0 at the end, or -1 */
+void xiafs_dir_init(struct xiafs_dir_iter *it, struct xiafs_fs *fs,
+		    const struct xiafs_inode *ip, int all);
+int xiafs_dir_next(struct xiafs_dir_iter *it, struct xiafs_direct **de);
+
+#endif  /* _LIBXIAFS_H */
@@ -34,7 +34,7 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <linux/fs.h>
-#include "xiafs.h"
+#include "libxiafs.h"
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
@@ -49,16 +49,15 @@
 #define BITS_PER_ZONE_BITS	(BLOCK_SIZE_BITS + 3 + zone_shift)
 #define ADDR_PER_ZONE   	(BLOCK_SIZE >> (2 - zone_shift))
 
-#define NR_INODES	(INODE_ZONES * _XIAFS_INODES_PER_BLOCK << zone_shift)
-#define INODE_ZONES	(((zones - kern_zones) >> (2 + zone_shift)) \
-			 / _XIAFS_INODES_PER_BLOCK + 1)
-#define IMAP_ZONES 	(NR_INODES / BITS_PER_ZONE + 1)
-#define ZMAP_ZONES 	((zones - kern_zones) / BITS_PER_ZONE + 1)
+/* the layout, as xiafs_geometry() works it out */
+#define NR_INODES	(geom.s_ninodes)
+#define INODE_ZONES	(xiafs_inode_zones(&geom))
+#define IMAP_ZONES 	(geom.s_imap_zones)
+#define ZMAP_ZONES 	(geom.s_zmap_zones)
 #define FIRST_KERN_ZONE (1 + IMAP_ZONES + ZMAP_ZONES + INODE_ZONES)
-#define FIRST_DATA_ZONE (FIRST_KERN_ZONE + kern_zones)
-#define NR_DATA_ZONES	(zones - FIRST_DATA_ZONE)
-#define MAX_SIZE	(zone_shift == 2 ? 0xffffffff : \
-			 (((ADDR_PER_ZONE+1)*ADDR_PER_ZONE)+8) * ZONE_SIZE)
+#define FIRST_DATA_ZONE (geom.s_firstdatazone)
+#define NR_DATA_ZONES	(geom.s_ndatazones)
+#define MAX_SIZE	(geom.s_max_size)
 
 char *pgm;			/* program name */
 u_char *zone_buf;		/* main buffer */
@@ -67,6 +66,8 @@ uint32_t *dindz_buf;		/* double inderect zone buffer */
 int zones;			/* size of the file system in zones */
 int kern_zones=0;     		/* nr of reserved zones for kernal image */
 int zone_shift=0;		/* ZONE_SIZE = BLOCK_SIZE << zone_shfit */
+int features=0;			/* s_features */
+struct xiafs_super_block geom;	/* the superblock to be */
 int bad_zones=0;		/* # of bad zones */
 int *bad_zlist=(int *) 0;
 int dev;
@@ -77,7 +78,7 @@ int dev;
 void usage()
 {
   fprintf(stderr, 
-      "usage: mkxiafs [-c | -l path] [-k size] [-z size] device size\n");
+      "usage: mkxiafs [-c | -l path] [-k size] [-s] [-z size] device size\n");
   exit(1);
 }
 
@@ -92,17 +93,13 @@ void die(char *cp)
  */
 void rd_zone(int zone_nr, void *buffer)
 {
-  if (lseek(dev, zone_nr * ZONE_SIZE, SEEK_SET) < 0)
-    die("seek device failed");
-  if (read(dev, buffer, ZONE_SIZE) < 0)
+  if (xiafs_read_zones(dev, zone_shift, zone_nr, 1, buffer))
     die("read device failed");
 }
 
 void wt_zone(int zone_nr, void *buffer)
 {
-  if (lseek(dev, zone_nr * ZONE_SIZE, SEEK_SET) < 0)
-    die("seek device failed");
-  if (write(dev, buffer, ZONE_SIZE) < 0)
+  if (xiafs_write_zones(dev, zone_shift, zone_nr, 1, buffer))
     die("write device failed");
 }
 
@@ -208,7 +205,7 @@ void fatal_bad_ck()
     fprintf(stderr, "  %d", bad_zlist[i]);
   if (i != bad_zones)
     fprintf(stderr, " ...");
-  fprintf(stderr, "\nfirst data block:  %lu\n",(FIRST_DATA_ZONE+1)<<zone_shift);
+  fprintf(stderr, "\nfirst data block:  %u\n",(FIRST_DATA_ZONE+1)<<zone_shift);
   die("bad blocks in critical area");
 }
 
@@ -238,17 +235,8 @@ void do_sup_zone()
 
   memset(zone_buf, 0, ZONE_SIZE);
   sp=(struct xiafs_super_block *)zone_buf;
-  sp->s_zone_size=ZONE_SIZE;
-  sp->s_nzones=zones;
-  sp->s_ninodes=NR_INODES;
-  sp->s_ndatazones=NR_DATA_ZONES;
-  sp->s_imap_zones=IMAP_ZONES;
-  sp->s_zmap_zones=ZMAP_ZONES;
-  sp->s_firstdatazone=FIRST_DATA_ZONE;
-  sp->s_zone_shift=zone_shift;
-  sp->s_max_size=MAX_SIZE;
-  sp->s_firstkernzone=kern_zones ? FIRST_KERN_ZONE : 0;
-  sp->s_magic=_XIAFS_SUPER_MAGIC;
+  *sp=geom;
+  sp->s_features=features;
 
   wt_zone(0, zone_buf);
 }
@@ -496,12 +484,14 @@ void report()
 {
   printf("     zone size: %d KB\n", 1<<zone_shift);
   printf("    total size: %d zones\n", zones);
-  printf("        inodes: %lu\n", NR_INODES);
-  printf("    data zones: %lu\n", NR_DATA_ZONES);
+  printf("        inodes: %u\n", NR_INODES);
+  printf("    data zones: %u\n", NR_DATA_ZONES);
   printf("kernel reserve: %d zone%s\n", kern_zones, kern_zones < 2 ? "":"s");
-  printf(" max file size: %d MB\n", MAX_SIZE >> 20);
+  printf(" max file size: %u MB\n", MAX_SIZE >> 20);
+  if (features & XIAFS_FEATURE_FAST_SYMLINK)
+    printf("      features: fast symlinks\n");
   if (bad_zlist)
-    printf("     bad zones: %d ( %lu%% )\n", bad_zones, 
+    printf("     bad zones: %d ( %u%% )\n", bad_zones, 
 	   (bad_zones*100+NR_DATA_ZONES/2)/NR_DATA_ZONES);
 }
 
@@ -522,7 +512,7 @@ int main(int argc, char * argv[])
   pgm=argv[0];
   if (getuid())
     die("this program can only be run by root");
-  while ((opt=getopt(argc, argv, "ck:l:z:")) != EOF) {
+  while ((opt=getopt(argc, argv, "ck:l:sz:")) != EOF) {
     switch (opt) {
     case 'c':
       bad_ck=1;
@@ -537,6 +527,9 @@ int main(int argc, char * argv[])
     case 'l':
       bad_nr_file=optarg;
       break;
+    case 's':
+      features |= XIAFS_FEATURE_FAST_SYMLINK;
+      break;
     case 'z':
       zone_shift=strtol(optarg, &endp, 0);
       if (!isspace(*endp) && *endp)
@@ -568,6 +561,9 @@ int main(int argc, char * argv[])
 
   zones >>= zone_shift;
   kern_zones = (kern_zones + (1 << zone_shift) - 1 )>> zone_shift;
+  if (kern_zones >= zones)
+    die("device too small");
+  xiafs_geometry(&geom, zones, kern_zones, zone_shift);
 
   last_zone_test();
 
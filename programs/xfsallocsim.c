@@ -0,0 +1,704 @@
+/*
+ * xfsallocsim.c - replay zone allocation traces against a xiafs image
+ */
+/*
+ * Usage: xfsallocsim [-v] [-p policy,...] [-r zones] [-D major:minor]
+ *                    image [trace]
+ *
+ *	-v    print each policy's free run histogram too.
+ *	-p    policies to try, out of first, next, goal and resv
+ *	      (default all of them).
+ *	-r    reservation window size in zones for resv (default 8).
+ *	-D    only replay events for this device; otherwise the device of
+ *	      the first event is used.
+ *
+ * The zmap and imap are loaded from the image, along with which inode
+ * owns each zone in use, and the trace (from standard input if it isn't
+ * given, or is -) is replayed against a copy of them once per policy.
+ * The trace is perf script, trace-cmd report or trace_pipe text with the
+ * xiafs:xiafs_new_block, xiafs_free_block, xiafs_new_inode and
+ * xiafs_free_inode events in it; anything else is skipped. The image
+ * should be one the traced file system was copied from, or what it looked
+ * like when the trace started, or the zones freed won't be the ones the
+ * trace says.
+ *
+ * Each allocation the trace made is made again by the policy, and a free
+ * of a zone the trace handed out frees whatever zone the policy gave in
+ * its place. The policies:
+ *
+ *	first  the lowest free zone, as xiafs_new_block() does.
+ *	next   the lowest free zone after the one handed out last,
+ *	       wrapping around to the start.
+ *	goal   the zone after the file's last one if that's free, or the
+ *	       next free one after it; first for a file's first zone.
+ *	resv   goal, but a file that can't have the zone after its last one
+ *	       reserves a window of -r free zones and takes zones out of that
+ *	       until it's used up. Other files don't allocate from it. A file
+ *	       gives its window up when it frees a zone or its inode is freed,
+ *	       and all windows are given up when there's nothing else free.
+ *
+ * For each policy it prints the allocations made and failed, the zmap
+ * bits looked at per allocation (and bytes, as XIAFS_STAT_ZMAP_SCANNED
+ * counts them), how many allocations came straight after the file's
+ * previous zone, the extents (runs of adjacent zones) per file in the end
+ * for files the trace allocated zones to, and the free runs left over.
+ * Inode allocations are replayed first fit against the imap for all
+ * policies alike.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+#include "libxiafs.h"
+
+#define FREE_BUCKETS 24		/* free run histogram, 1 - 2^24-1 zones */
+
+enum { FIRST, NEXT, GOAL, RESV, NR_POLICIES };
+
+static const char *policy_names[NR_POLICIES] = {
+  "first", "next", "goal", "resv"
+};
+
+enum { NEW_BLOCK, FREE_BLOCK, NEW_INODE, FREE_INODE };
+
+struct event {
+  int type;
+  uint32_t ino;
+  uint32_t zone;		/* bit in the zmap for the block events */
+};
+
+struct file {
+  uint32_t last;		/* bit of the zone it was given last, or 0 */
+  uint32_t rstart, rend;	/* its reservation window, if rend */
+  uint32_t extents;
+  int touched;			/* the trace gave it zones */
+};
+
+struct sim {
+  int policy;
+  unsigned char *used;		/* the zmap */
+  unsigned char *busy;		/* used or reserved */
+  unsigned char *imap;
+  uint32_t *owner;		/* inode owning each zone in use */
+  uint32_t *xlate;		/* traced zone -> ours, 0 if the same */
+  struct file *files;		/* by inode number */
+  uint32_t cursor;		/* where next starts looking */
+  uint64_t allocs, failed, scanned, scanned_bytes, contig;
+  uint64_t agreed;		/* gave the zone the trace did */
+  uint64_t frees, stray;	/* frees of zones not in use here */
+  uint64_t ialloc, ifree, iscanned, iagreed;
+};
+
+char *pgm;			/* program name */
+int verbose=0;
+uint32_t resv_zones=8;
+
+struct xiafs_fs *fs;
+uint32_t nbits;			/* zmap bits that are zones, with bit 0 */
+uint32_t ninobits;		/* imap bits that are inodes, with bit 0 */
+unsigned char *zmap0, *imap0;	/* as loaded */
+uint32_t *owner0;
+
+struct event *events;
+size_t nevents, maxevents;
+unsigned long skipped, other_dev, trace_failed;
+
+void usage()
+{
+  fprintf(stderr,
+	  "usage: %s [-v] [-p policy,...] [-r zones] [-D major:minor] "
+	  "image [trace]\n", pgm);
+  exit(1);
+}
+
+void die(char *what, char *path)
+{
+  fprintf(stderr, "%s: %s %s: %s\n", pgm, what, path, strerror(errno));
+  exit(1);
+}
+
+static void *xmalloc(size_t size)
+{
+  void *p;
+
+  if (!(p=calloc(1, size))) {
+    fprintf(stderr, "%s: out of memory\n", pgm);
+    exit(1);
+  }
+  return p;
+}
+
+/*------------------------------------------------------------------------
+ * bitmaps, little endian bit order as on disk
+ */
+
+static int test_bit(const unsigned char *map, uint32_t b)
+{
+  return (map[b >> 3] >> (b & 7)) & 1;
+}
+
+static void set_bit(unsigned char *map, uint32_t b)
+{
+  map[b >> 3] |= 1 << (b & 7);
+}
+
+static void clear_bit(unsigned char *map, uint32_t b)
+{
+  map[b >> 3] &= ~(1 << (b & 7));
+}
+
+/* The first bit in [from, end) that is set (or clear), or end. */
+static uint32_t find_bit(const unsigned char *map, uint32_t from,
+			 uint32_t end, int set)
+{
+  uint64_t w, skip=set ? 0 : ~(uint64_t)0;
+  uint32_t b=from;
+
+  while (b < end) {
+    if (!(b & 63)) {
+      while (b + 64 <= end) {
+	memcpy(&w, map + (b >> 3), 8);
+	if (w != skip)
+	  break;
+	b += 64;
+      }
+    }
+    if (!(b & 7))
+      while (b + 8 <= end && map[b >> 3] == (unsigned char)skip)
+	b += 8;
+    if (b >= end)
+      break;
+    if (test_bit(map, b) == set)
+      return b;
+    b++;
+  }
+  return end;
+}
+
+/*------------------------------------------------------------------------
+ * loading the image and the trace
+ */
+
+static unsigned char *load_map(uint32_t start, uint32_t zones)
+{
+  unsigned char *map=xmalloc((size_t)zones * fs->zone_size);
+  uint32_t i;
+  void *z;
+
+  for (i=0; i < zones; i++) {
+    if (!(z=xiafs_zone(fs, start + i)))
+      return NULL;
+    memcpy(map + (size_t)i * fs->zone_size, z, fs->zone_size);
+  }
+  return map;
+}
+
+static void load_image(char *path)
+{
+  struct xiafs_inode_iter ii;
+  struct xiafs_bmap_iter bi;
+  struct xiafs_inode *ip;
+  struct xiafs_run r;
+  uint32_t ino, i;
+  int ret;
+
+  if (!(fs=xiafs_open(path, 0)))
+    die("can't open", path);
+  nbits=fs->ndatazones + 1;
+  ninobits=fs->ninodes + 1;
+  if (!(zmap0=load_map(fs->zmap_start, fs->sb.s_zmap_zones)) ||
+      !(imap0=load_map(fs->imap_start, fs->sb.s_imap_zones)))
+    die("can't read the bitmaps of", path);
+
+  owner0=xmalloc((size_t)nbits * sizeof(*owner0));
+  xiafs_inode_iter_init(&ii, fs, 0);
+  while ((ip=xiafs_inode_next(&ii, &ino))) {
+    xiafs_bmap_init(&bi, fs, ip, XIAFS_BMAP_META);
+    while ((ret=xiafs_bmap_next(&bi, &r)) > 0) {
+      if (r.r_flags & XIAFS_RUN_BAD)
+	continue;
+      for (i=0; i < r.r_len; i++)
+	owner0[r.r_zone + i - fs->firstdatazone + 1]=ino;
+    }
+    if (ret < 0)
+      fprintf(stderr, "%s: inode %u: %s, its zones are left unowned\n",
+	      pgm, ino, strerror(errno));
+  }
+  if (errno)
+    die("can't read the inodes of", path);
+}
+
+static void add_event(int type, unsigned long long ino, unsigned long zone)
+{
+  struct event *ev;
+
+  if (!ino || ino > fs->ninodes) {
+    skipped++;
+    return;
+  }
+  if (type == NEW_BLOCK || type == FREE_BLOCK) {
+    if (!zone && type == NEW_BLOCK) {	/* the file system was full */
+      trace_failed++;
+      return;
+    }
+    if (zone < fs->firstdatazone || zone >= fs->nzones) {
+      skipped++;
+      return;
+    }
+    zone -= fs->firstdatazone - 1;
+  }
+  if (nevents == maxevents) {
+    maxevents=maxevents ? maxevents * 2 : 4096;
+    if (!(events=realloc(events, maxevents * sizeof(*events)))) {
+      fprintf(stderr, "%s: out of memory\n", pgm);
+      exit(1);
+    }
+  }
+  ev=&events[nevents++];
+  ev->type=type;
+  ev->ino=ino;
+  ev->zone=zone;
+}
+
+static void load_trace(FILE *f, int want_dev, unsigned want_maj,
+		       unsigned want_min)
+{
+  static const char *names[]={
+    "xiafs_new_block:", "xiafs_free_block:",
+    "xiafs_new_inode:", "xiafs_free_inode:"
+  };
+  unsigned long long ino, dir;
+  unsigned long zone, scanned;
+  unsigned maj, min;
+  char line[1024], *p;
+  int type, n;
+
+  while (fgets(line, sizeof(line), f)) {
+    for (type=0; type < 4; type++)
+      if ((p=strstr(line, names[type])))
+	break;
+    if (type == 4)
+      continue;
+    p += strlen(names[type]);
+    zone=0;
+    switch (type) {
+    case NEW_BLOCK:
+      n=sscanf(p, " dev %u:%u ino %llu zone %lu bits scanned %lu",
+	       &maj, &min, &ino, &zone, &scanned) == 5;
+      break;
+    case FREE_BLOCK:
+      n=sscanf(p, " dev %u:%u ino %llu zone %lu",
+	       &maj, &min, &ino, &zone) == 4;
+      break;
+    case NEW_INODE:
+      n=sscanf(p, " dev %u:%u dir %llu ino %llu",
+	       &maj, &min, &dir, &ino) == 4;
+      break;
+    default:
+      n=sscanf(p, " dev %u:%u ino %llu", &maj, &min, &ino) == 3;
+    }
+    if (!n) {
+      skipped++;
+      continue;
+    }
+    if (!want_dev) {
+      want_dev=1;
+      want_maj=maj;
+      want_min=min;
+    }
+    if (maj != want_maj || min != want_min) {
+      other_dev++;
+      continue;
+    }
+    add_event(type, ino, zone);
+  }
+  if (ferror(f))
+    die("can't read", "the trace");
+}
+
+/*------------------------------------------------------------------------
+ * the policies
+ */
+
+static void sim_init(struct sim *s, int policy)
+{
+  size_t zbytes=(size_t)fs->sb.s_zmap_zones * fs->zone_size;
+  size_t ibytes=(size_t)fs->sb.s_imap_zones * fs->zone_size;
+
+  memset(s, 0, sizeof(*s));
+  s->policy=policy;
+  s->used=xmalloc(zbytes);
+  s->busy=xmalloc(zbytes);
+  s->imap=xmalloc(ibytes);
+  memcpy(s->used, zmap0, zbytes);
+  memcpy(s->busy, zmap0, zbytes);
+  memcpy(s->imap, imap0, ibytes);
+  s->owner=xmalloc((size_t)nbits * sizeof(*s->owner));
+  memcpy(s->owner, owner0, (size_t)nbits * sizeof(*s->owner));
+  s->xlate=xmalloc((size_t)nbits * sizeof(*s->xlate));
+  s->files=xmalloc((size_t)ninobits * sizeof(*s->files));
+  s->cursor=1;
+}
+
+static void sim_free(struct sim *s)
+{
+  free(s->used);
+  free(s->busy);
+  free(s->imap);
+  free(s->owner);
+  free(s->xlate);
+  free(s->files);
+}
+
+/* Give the zones of f's window it didn't use back. */
+static void unreserve(struct sim *s, struct file *f)
+{
+  uint32_t b;
+
+  for (b=f->rstart; b < f->rend; b++)
+    if (!test_bit(s->used, b))
+      clear_bit(s->busy, b);
+  f->rstart=f->rend=0;
+}
+
+static void unreserve_all(struct sim *s)
+{
+  uint32_t ino;
+
+  for (ino=1; ino < ninobits; ino++)
+    if (s->files[ino].rend)
+      unreserve(s, &s->files[ino]);
+}
+
+/* The first zone not busy from goal on, wrapping around, or 0. */
+static uint32_t find_from(struct sim *s, uint32_t goal)
+{
+  uint32_t b;
+
+  if ((b=find_bit(s->busy, goal, nbits, 0)) < nbits) {
+    s->scanned += b - goal + 1;
+    return b;
+  }
+  s->scanned += nbits - goal;
+  if ((b=find_bit(s->busy, 1, goal, 0)) < goal) {
+    s->scanned += b;
+    return b;
+  }
+  s->scanned += goal - 1;
+  return 0;
+}
+
+/* The start of want zones not busy from goal on, wrapping around, or 0. */
+static uint32_t find_run(struct sim *s, uint32_t goal, uint32_t want)
+{
+  uint32_t from=goal, end=nbits, b, e, stop;
+  int pass;
+
+  for (pass=0; pass < 2; pass++) {
+    for (b=from; b < end; b=e) {
+      b=find_bit(s->busy, b, end, 0);
+      stop=end - b > want ? b + want : end;
+      e=find_bit(s->busy, b, stop, 1);
+      if (e - b >= want) {
+	s->scanned += e - from;
+	return b;
+      }
+    }
+    s->scanned += end - from;
+    end=goal;
+    from=1;
+  }
+  return 0;
+}
+
+static uint32_t reserve(struct sim *s, struct file *f, uint32_t goal)
+{
+  uint32_t b, start;
+
+  if (f->rend) {
+    start=f->last >= f->rstart && f->last < f->rend ? f->last + 1 : f->rstart;
+    b=find_bit(s->used, start, f->rend, 0);
+    s->scanned += b < f->rend ? b - start + 1 : f->rend - start;
+    if (b < f->rend)
+      return b;
+    unreserve(s, f);
+  }
+  if ((b=find_run(s, goal, resv_zones))) {
+    f->rstart=b;
+    f->rend=b + resv_zones;
+    for (; b < f->rend; b++)
+      set_bit(s->busy, b);
+    return f->rstart;
+  }
+  if ((b=find_from(s, goal)))
+    return b;
+  unreserve_all(s);
+  return find_from(s, goal);
+}
+
+static void new_block(struct sim *s, struct event *ev)
+{
+  struct file *f=&s->files[ev->ino];
+  uint32_t b, goal=f->last && f->last + 1 < nbits ? f->last + 1 : 1;
+  uint64_t before=s->scanned;
+
+  switch (s->policy) {
+  case FIRST:
+    b=find_bit(s->busy, 0, nbits, 0);
+    s->scanned += b < nbits ? b + 1 : nbits;
+    if (b == nbits)
+      b=0;
+    break;
+  case NEXT:
+    b=find_from(s, s->cursor);
+    break;
+  case GOAL:
+    b=find_from(s, goal);
+    break;
+  default:
+    b=reserve(s, f, goal);
+  }
+  s->scanned_bytes += (s->scanned - before + 7) / 8;
+  if (!b) {
+    s->failed++;
+    return;
+  }
+  s->allocs++;
+  if (b == ev->zone)
+    s->agreed++;
+  if (f->last && b == f->last + 1)
+    s->contig++;
+  set_bit(s->used, b);
+  set_bit(s->busy, b);
+  s->owner[b]=ev->ino;
+  s->xlate[ev->zone]=b != ev->zone ? b : 0;
+  f->last=b;
+  f->touched=1;
+  s->cursor=b + 1 < nbits ? b + 1 : 1;
+}
+
+static void free_block(struct sim *s, struct event *ev)
+{
+  struct file *f=&s->files[ev->ino];
+  uint32_t b=s->xlate[ev->zone] ? s->xlate[ev->zone] : ev->zone;
+
+  s->xlate[ev->zone]=0;
+  if (f->rend)
+    unreserve(s, f);
+  if (!test_bit(s->used, b)) {
+    s->stray++;
+    return;
+  }
+  s->frees++;
+  clear_bit(s->used, b);
+  clear_bit(s->busy, b);
+  s->owner[b]=0;
+}
+
+/* First fit, as xiafs_new_inode() does, whatever the zone policy. */
+static void new_inode(struct sim *s, struct event *ev)
+{
+  struct file *f=&s->files[ev->ino];
+  uint32_t b=find_bit(s->imap, 0, ninobits, 0);
+
+  s->iscanned += b < ninobits ? b + 1 : ninobits;
+  if (b == ev->ino)
+    s->iagreed++;
+  s->ialloc++;
+  /* carry on with the trace's inode, so the imap stays like the trace's */
+  set_bit(s->imap, ev->ino);
+  if (f->rend)
+    unreserve(s, f);
+  memset(f, 0, sizeof(*f));
+}
+
+static void free_inode(struct sim *s, struct event *ev)
+{
+  struct file *f=&s->files[ev->ino];
+
+  s->ifree++;
+  clear_bit(s->imap, ev->ino);
+  if (f->rend)
+    unreserve(s, f);
+  f->last=0;
+}
+
+static void replay(struct sim *s)
+{
+  size_t i;
+
+  for (i=0; i < nevents; i++) {
+    switch (events[i].type) {
+    case NEW_BLOCK:
+      new_block(s, &events[i]);
+      break;
+    case FREE_BLOCK:
+      free_block(s, &events[i]);
+      break;
+    case NEW_INODE:
+      new_inode(s, &events[i]);
+      break;
+    default:
+      free_inode(s, &events[i]);
+    }
+  }
+}
+
+/*------------------------------------------------------------------------
+ * reporting
+ */
+
+static double ratio(uint64_t a, uint64_t b)
+{
+  return b ? (double)a / b : 0;
+}
+
+static void report(struct sim *s)
+{
+  uint64_t runs[FREE_BUCKETS]={ 0 }, zones[FREE_BUCKETS]={ 0 };
+  uint64_t nruns=0, total=0, extents=0, nfiles=0;
+  uint32_t pos=1, start, len, longest=0, b, o;
+  int k;
+
+  while ((start=find_bit(s->used, pos, nbits, 0)) < nbits) {
+    pos=find_bit(s->used, start, nbits, 1);
+    len=pos - start;
+    for (k=0; k < FREE_BUCKETS - 1 && (2UL << k) <= len; k++)
+      ;
+    runs[k]++;
+    zones[k] += len;
+    nruns++;
+    total += len;
+    if (len > longest)
+      longest=len;
+  }
+
+  for (b=1; b < nbits; b++) {
+    if (!test_bit(s->used, b) || !(o=s->owner[b]) || !s->files[o].touched)
+      continue;
+    if (!test_bit(s->used, b - 1) || s->owner[b - 1] != o) {
+      if (!s->files[o].extents++)
+	nfiles++;
+      extents++;
+    }
+  }
+
+  printf("%-6s %9llu %7llu %10.1f %11.1f %7.1f %12.2f %9llu %9u %8.1f\n",
+	 policy_names[s->policy], (unsigned long long)s->allocs,
+	 (unsigned long long)s->failed, ratio(s->scanned, s->allocs + s->failed),
+	 ratio(s->scanned_bytes, s->allocs + s->failed),
+	 100 * ratio(s->contig, s->allocs), ratio(extents, nfiles),
+	 (unsigned long long)nruns, longest, ratio(total, nruns));
+  if (!verbose)
+    return;
+  printf("\n  free run length: runs zones\n");
+  for (k=0; k < FREE_BUCKETS; k++)
+    if (runs[k])
+      printf("    %lu-%lu: %llu %llu\n", 1UL << k, (2UL << k) - 1,
+	     (unsigned long long)runs[k], (unsigned long long)zones[k]);
+  if (s->stray)
+    printf("  %llu frees of zones already free here\n",
+	   (unsigned long long)s->stray);
+  printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int policies[NR_POLICIES], npolicies=0, want_dev=0, opt, i;
+  unsigned want_maj=0, want_min=0;
+  double first_agreed=-1;
+  char *list=NULL, *p, *end;
+  struct sim s;
+  FILE *f=stdin;
+
+  pgm=argv[0];
+  while ((opt=getopt(argc, argv, "vp:r:D:")) != EOF) {
+    switch (opt) {
+    case 'v':
+      verbose=1;
+      break;
+    case 'p':
+      list=optarg;
+      break;
+    case 'r':
+      resv_zones=strtoul(optarg, &end, 0);
+      if (*end || !resv_zones)
+	usage();
+      break;
+    case 'D':
+      if (sscanf(optarg, "%u:%u", &want_maj, &want_min) != 2)
+	usage();
+      want_dev=1;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind >= argc || argc - optind > 2)
+    usage();
+
+  if (!list) {
+    for (i=0; i < NR_POLICIES; i++)
+      policies[npolicies++]=i;
+  } else {
+    for (p=strtok(list, ","); p; p=strtok(NULL, ",")) {
+      for (i=0; i < NR_POLICIES; i++)
+	if (!strcmp(p, policy_names[i]))
+	  break;
+      if (i == NR_POLICIES || npolicies == NR_POLICIES) {
+	fprintf(stderr, "%s: no policy %s\n", pgm, p);
+	usage();
+      }
+      policies[npolicies++]=i;
+    }
+  }
+
+  load_image(argv[optind]);
+  if (argc - optind == 2 && strcmp(argv[optind + 1], "-") &&
+      !(f=fopen(argv[optind + 1], "r")))
+    die("can't open", argv[optind + 1]);
+  load_trace(f, want_dev, want_maj, want_min);
+  if (f != stdin)
+    fclose(f);
+
+  printf("%u data zones, %u free; %u inodes, %u free\n", fs->ndatazones,
+	 xiafs_free_zones(fs), fs->ninodes, xiafs_free_inodes(fs));
+  printf("%lu events", (unsigned long)nevents);
+  if (other_dev)
+    printf(", %lu for other devices left out", other_dev);
+  if (skipped)
+    printf(", %lu not understood or out of range", skipped);
+  if (trace_failed)
+    printf(", %lu allocations that failed in the trace left out",
+	   trace_failed);
+  printf("\n");
+
+  for (i=0; i < npolicies; i++) {
+    sim_init(&s, policies[i]);
+    replay(&s);
+    if (!i) {
+      printf("%llu inodes allocated, %llu freed, %.1f imap bits scanned "
+	     "each, first fit agreed with the trace on %.1f%%\n",
+	     (unsigned long long)s.ialloc, (unsigned long long)s.ifree,
+	     ratio(s.iscanned, s.ialloc), 100 * ratio(s.iagreed, s.ialloc));
+      printf("\n%-6s %9s %7s %10s %11s %7s %12s %9s %9s %8s\n", "policy",
+	     "allocs", "failed", "bits/alloc", "bytes/alloc", "contig%",
+	     "extents/file", "free runs", "longest", "avg run");
+    }
+    report(&s);
+    if (s.policy == FIRST)
+      first_agreed=100 * ratio(s.agreed, s.allocs);
+    sim_free(&s);
+  }
+  /* if this isn't near 100, the image isn't what the trace started with */
+  if (first_agreed >= 0)
+    printf("%sfirst fit gave the zone the trace did %.1f%% of the time\n",
+	   verbose ? "" : "\n", first_agreed);
+
+  xiafs_close(fs);
+  exit(0);
+}
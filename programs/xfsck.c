@@ -15,16 +15,18 @@
  **************************************************************************/
 
 /*
- * Usage: xiafsck [-{a|k|r|s}] device
+ * Usage: xiafsck [-{a|k|r|s}] [-c] device
  *
  *	-a    automatic repair.
  *      -r    interactive repair.
  *      -s    display super block info only.
  *	-k    read the kernel image from the reserved space.
+ *	-c    compact directories.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <signal.h>
@@ -34,7 +36,7 @@
 #include <time.h>
 #include <sys/types.h>
 #include <linux/fs.h>
-#include "xiafs.h"
+#include "libxiafs.h"
 #include <string.h>
 #include <ctype.h>
 #include <getopt.h>
@@ -51,38 +53,39 @@
 #define ADDR_PER_ZONE   	(BLOCK_SIZE >> (2 - zone_shift))
 #define INODES_PER_ZONE		(_XIAFS_INODES_PER_BLOCK << zone_shift)
 
-#define NR_INODES	(INODE_ZONES * _XIAFS_INODES_PER_BLOCK << zone_shift)
-#define INODE_ZONES	(((zones - kern_zones) >> (2 + zone_shift)) \
-			 / _XIAFS_INODES_PER_BLOCK + 1)
-#define IMAP_ZONES 	(NR_INODES / BITS_PER_ZONE + 1)
-#define ZMAP_ZONES 	((zones - kern_zones) / BITS_PER_ZONE + 1)
+/* the layout, as mkxfs would have made it; see ck_sup_zone() */
+#define NR_INODES	(geom.s_ninodes)
+#define INODE_ZONES	(xiafs_inode_zones(&geom))
+#define IMAP_ZONES 	(geom.s_imap_zones)
+#define ZMAP_ZONES 	(geom.s_zmap_zones)
 #define FIRST_KERN_ZONE (1 + IMAP_ZONES + ZMAP_ZONES + INODE_ZONES)
-#define FIRST_DATA_ZONE (FIRST_KERN_ZONE + kern_zones)
-#define NR_DATA_ZONES	(zones - FIRST_DATA_ZONE)
-#define MAX_SIZE	(zone_shift == 2 ? 0xffffffff : \
-			 (((ADDR_PER_ZONE+1)*ADDR_PER_ZONE)+8)*ZONE_SIZE )
+#define NR_DATA_ZONES	(geom.s_ndatazones)
+#define MAX_SIZE	(geom.s_max_size)
 #define INODE_MAX_ZONE  (8 + (1 + ADDR_PER_ZONE) * (ADDR_PER_ZONE))
 #define RNDUP(x) 	(((x) + 3) & ~3) 
+#define IS_FAST_SYMLINK(ip) (S_ISLNK((ip)->i_mode) && \
+			     (features & XIAFS_FEATURE_FAST_SYMLINK) && \
+			     (ip)->i_size < _XIAFS_FAST_SYMLINK_SIZE)
  
 char   *pgm_name;		/* program name */
 int    rep=0;			/* cmd line switches */
 int    auto_rep=0;
 int    show_sup=0;
 int    read_kern=0;
+int    compact=0;
 int    xiafs_dirt=0;
 int    zones;			/* size of file system in zones */
 int    kern_zones;		/* zones reserved for kernel image */
 int    first_data_zone;		/* as name said. */
 int    zone_shift=0;		/* ZONE_SIZE = BLOCK_SIZE << zone_shfit */
+uint32_t features;		/* s_features */
+struct xiafs_super_block geom;	/* what the superblock should say */
 int    dev;			/* device fd */
 
+struct xiafs_fs *fs;		/* everything past the super block */
+
 u_char *zmap_buf;		/* for zmap */
-u_char *zone_buf;		/* zone buffer */
-int    zone_addr=-1;		/* zone buffered */
-uint32_t *indz_buf;		/* for indirect zone */
-int    indz_addr=-1;		/* indirect zone buffered */
-uint32_t *dindz_buf;		/* for double indirect zone */
-int    dindz_addr=-1;		/* double indirect zone buffered */
+u_char *zone_buf;		/* for the super block */
 
 #define imap_buf    zmap_buf    /* self document */
 
@@ -93,7 +96,7 @@ uint16_t *nlinks;		/* number of links counter */
  */
 void usage()
 {
-    fprintf(stderr, "usage: %s [-{a|k|r|s}] device\n", pgm_name);
+    fprintf(stderr, "usage: %s [-{a|k|r|s}] [-c] device\n", pgm_name);
     exit(1);
 }
 
@@ -104,22 +107,22 @@ void die(char *cp)
 }
 
 /*------------------------------------------------------------------------
- * error free read/write rutines
+ * error free read rutines. rd_zone() is only for the super block, which
+ * is checked before fs is opened.
  */
 void rd_zone(int zone_nr, void *buffer)
 {
-    if (lseek(dev, zone_nr * ZONE_SIZE, SEEK_SET) < 0)
-        die("seek device failed");
-    if (read(dev, buffer, ZONE_SIZE) < 0)
+    if (xiafs_read_zones(dev, zone_shift, zone_nr, 1, buffer))
         die("reading device failed");
 }
 
-void wt_zone(int zone_nr, void *buffer)
+u_char *get_zone(uint32_t zone_nr)
 {
-    if (lseek(dev, zone_nr * ZONE_SIZE, SEEK_SET) < 0)
-        die("seek device failed.");
-    if (write(dev, buffer, ZONE_SIZE) < 0)
-        die("write device failed.");
+    u_char *zp;
+
+    if (!(zp=xiafs_zone(fs, zone_nr)))
+        die("reading device failed");
+    return zp;
 }
 
 /*----------------------------------------------------------------------
@@ -267,6 +270,9 @@ void ck_sup_zone()
     /* primary data */
     if (sp->s_magic != _XIAFS_SUPER_MAGIC)
         die("magic number mismatch");
+    features=sp->s_features;
+    if (features & ~XIAFS_FEATURE_ALL)
+        die("unsupported features");
     zones=sp->s_nzones;
     zone_shift=sp->s_zone_shift;
     if (zone_shift && zone_shift != 1 && zone_shift != 2)
@@ -278,14 +284,16 @@ void ck_sup_zone()
         kern_zones=0;
     else
         kern_zones=first_data_zone-sp->s_firstkernzone;
+    if (kern_zones < 0 || kern_zones >= zones)
+        die("super block data inconsistent");
 
     /* derived data */
-    if (sp->s_zone_size != BLOCK_SIZE << zone_shift ||
+    xiafs_geometry(&geom, zones, kern_zones, zone_shift);
+    if (sp->s_zone_size != geom.s_zone_size ||
 	    sp->s_ninodes != NR_INODES ||
 	    sp->s_imap_zones != IMAP_ZONES ||
 	    sp->s_zmap_zones != ZMAP_ZONES ||
 	    (sp->s_firstkernzone && sp->s_firstkernzone < FIRST_KERN_ZONE) ||
-	    kern_zones < 0 ||
 	    first_data_zone > zones ||
 	    sp->s_ndatazones != NR_DATA_ZONES ||
 	    sp->s_max_size != MAX_SIZE )
@@ -319,6 +327,9 @@ void show_sup_zone()
   if (zone_shift==2)
     tmp++;
   printf(  "    max file size: %u (0x%X) MB\n", tmp, tmp);
+  printf(  "         features: 0x%X%s\n", sp->s_features,
+	      (sp->s_features & XIAFS_FEATURE_FAST_SYMLINK) ? 
+	      " (fast symlinks)" : "");
   printf(  "      xiafs magic: %u (0x%X) ---%s\n", sp->s_magic, 
  						   sp->s_magic, 
 	      (sp->s_magic==_XIAFS_SUPER_MAGIC) ? "match" : "mismatch");
@@ -331,29 +342,21 @@ void show_sup_zone()
  */
 void rd_inode(uint32_t ino, struct xiafs_inode *ip)
 {
-    int ino_addr, ino_off;
+    struct xiafs_inode *i_pt;
 
-    ino_addr= 1 + IMAP_ZONES + ZMAP_ZONES + ((ino-1) / INODES_PER_ZONE);
-    ino_off=(ino-1) & (INODES_PER_ZONE - 1);
-    if (zone_addr != ino_addr) {
-        zone_addr=ino_addr;
-	rd_zone(ino_addr, zone_buf);
-    }
-    memcpy(ip, ino_off+(struct xiafs_inode *)zone_buf, sizeof(struct xiafs_inode));
+    if (!(i_pt=xiafs_inode(fs, ino)))
+        die("reading device failed");
+    memcpy(ip, i_pt, sizeof(struct xiafs_inode));
 }
 
 void wt_inode(uint32_t ino, struct xiafs_inode *ip)
 {
-    int ino_addr, ino_off;
+    struct xiafs_inode *i_pt;
 
-    ino_addr = 1 + IMAP_ZONES + ZMAP_ZONES + (ino-1) / INODES_PER_ZONE;
-    ino_off = (ino-1) & (INODES_PER_ZONE -1);
-    if (zone_addr != ino_addr) {
-        zone_addr=ino_addr;
-	rd_zone(ino_addr, zone_buf);
-    }
-    memcpy((struct xiafs_inode *)zone_buf+ino_off, ip, sizeof(struct xiafs_inode));
-    wt_zone(ino_addr, zone_buf);
+    if (!(i_pt=xiafs_inode(fs, ino)))
+        die("reading device failed");
+    memcpy(i_pt, ip, sizeof(struct xiafs_inode));
+    xiafs_inode_dirty(fs, ino);
 }
 
 /*------------------------------------------------------------------------
@@ -381,46 +384,20 @@ void show_badnum(uint32_t num)
 void show_badblks()
 {
     struct xiafs_inode bi;
-    int i, j, k, bz, tmp;
+    struct xiafs_bmap_iter it;
+    struct xiafs_run run;
+    uint32_t i;
+    int r;
 
-    rd_inode(2, &bi);
+    rd_inode(_XIAFS_BAD_INO, &bi);
     if (bi.i_size & (ZONE_SIZE-1))
         fprintf(stderr, "bad size in inode 2\n");
-    bz=(bi.i_size + ZONE_SIZE -1) / ZONE_SIZE;
-    tmp= bz > 8 ? 8 : bz;
-    for (i=0; i < tmp; i++)
-        show_badnum(bi.i_zone[i]);
-    bz -= 8;
-    if (bz <= 0)
-	goto showed;
-    if (indz_addr != bi.i_zone[8]) {
-        indz_addr = bi.i_zone[8];
-	rd_zone(indz_addr, indz_buf);
-    }
-    tmp= bz > ADDR_PER_ZONE ? ADDR_PER_ZONE : bz;
-    for (i=0; i < tmp; i++)
-        show_badnum(indz_buf[i]);
-    bz -= ADDR_PER_ZONE;
-    if (bz <= 0)
-        goto showed;
-    tmp= (bz + ADDR_PER_ZONE -1) / ADDR_PER_ZONE;
-    bz &= ADDR_PER_ZONE-1;
-    k=ADDR_PER_ZONE;
-    if (dindz_addr != bi.i_zone[9]) {
-        dindz_addr=bi.i_zone[9];
-	rd_zone(dindz_addr, dindz_buf);
-    }
-    for (j=0; j < tmp; j++) {
-        if (indz_addr != bi.i_zone[8]) {
-	    indz_addr=bi.i_zone[9];
-	    rd_zone(indz_addr, indz_buf);
-	}
-        if (j == tmp -1)
-	    k = bz;
-        for (i=0; i < k; i++)
-	    show_badnum(indz_buf[i]);
-    }
-showed:
+    xiafs_bmap_init(&it, fs, &bi, 0);
+    while ((r=xiafs_bmap_next(&it, &run)) > 0)
+        for (i=0; i < run.r_len; i++)
+	    show_badnum(run.r_zone + i);
+    if (r < 0)
+        die("reading device failed");
     printf("\n");
 }
       
@@ -428,56 +405,31 @@ showed:
  * directory misc rutines.
  */
 
-uint32_t get_addr(struct xiafs_inode *ip, int indx)
-{
-  uint32_t addr;
-
-  if (indx < 0 || indx >= INODE_MAX_ZONE)
-      return 0;
-  if (indx < 8)
-      return (ip->i_zone[indx] & 0xffffff);
-
-  indx -=8;
-  if (indx < ADDR_PER_ZONE) {
-      if ( indz_addr != (ip->i_zone[8] & 0xffffff) ) {
-	  indz_addr=ip->i_zone[8] & 0xffffff;
-	  if (indz_addr < first_data_zone || indz_addr >= zones)
-	      return 0;
-	  rd_zone(ip->i_zone[8], indz_buf);
-      }
-      return indz_buf[indx];
-  }
-  indx -= ADDR_PER_ZONE;
-  if ( dindz_addr != (ip->i_zone[9] & 0xffffff) ) {
-      dindz_addr=ip->i_zone[9] & 0xffffff;
-      if (dindz_addr < first_data_zone || dindz_addr >= zones)
-	  return 0;
-      rd_zone(ip->i_zone[9], dindz_buf);
-  }
-  addr=dindz_buf[indx / ADDR_PER_ZONE];
-  if ( indz_addr != addr ) {
-      indz_addr=addr;
-      if (addr < first_data_zone || addr >= zones)
-	  return 0;
-      rd_zone(addr, indz_buf);
-  }
-  return indz_buf[indx & (ADDR_PER_ZONE-1)];
-}
-
 struct da_t {
-    struct xiafs_inode inode;
-    uint32_t zone;
-    uint32_t addr;
-    struct xiafs_direct *pre_de;
-    struct xiafs_direct *cur_de;
+    struct xiafs_dir_iter it;	/* it.zone, it.off: the entry got last */
+    uint32_t pre_off;		/* the entry before it in that zone */
 };
 
 static struct da_t *da=(struct da_t *)0;
 static int da_size=0;
 static int da_top=-1;
+
+#define end_dir()	 (da_top--)
+
+int next_de(struct da_t *d, struct xiafs_direct **de)
+{
+    uint32_t zone=d->it.zone, off=d->it.off;
+    int r;
+
+    if ((r=xiafs_dir_next(&d->it, de)) < 0 && errno != EUCLEAN)
+        die("reading device failed");
+    d->pre_off=(d->it.zone == zone) ? off : d->it.off;
+    return r;
+}
   
 int start_dir(struct xiafs_inode *ip)
 {
+    struct da_t *d;
     struct xiafs_direct *de;
 
     if (ip->i_size & (ZONE_SIZE -1))
@@ -487,26 +439,21 @@ int start_dir(struct xiafs_inode *ip)
 	if (!(da=(struct da_t *)realloc(da, da_size)))
 	    die("allocate memory failed.");
     }
-    da[da_top].inode=*ip;
-    da[da_top].zone=0;
-    da[da_top].addr=ip->i_zone[0];
-    if (zone_addr!=ip->i_zone[0]) {
-        zone_addr=ip->i_zone[0];
-	rd_zone(zone_addr, zone_buf);
-    }
-    de=(struct xiafs_direct *)zone_buf;
-    if (de->d_ino <= 0 || de->d_ino > NR_INODES || de->d_rec_len!=12 ||
-	    de->d_name_len!=1 || de->d_name[0] != '.' || de->d_name[1])
+    d=&da[da_top];
+    xiafs_dir_init(&d->it, fs, ip, 1);
+    if (next_de(d, &de) <= 0 || d->it.zone != (ip->i_zone[0] & 0xffffff) ||
+	    d->it.off || de->d_ino <= 0 || de->d_rec_len!=12 ||
+	    de->d_name_len!=1 || de->d_name[0] != '.' || de->d_name[1]) {
+        end_dir();
         return -1;
+    }
     nlinks[de->d_ino-1]++;
-    de=(struct xiafs_direct *)((u_char *)de + 12);
-    if (de->d_ino!=pre_ino() || de->d_name_len!=2 || de->d_rec_len < 12 || 
-	    (u_char *)de + de->d_rec_len > zone_buf + ZONE_SIZE || 
-	    strcmp(de->d_name, "..") )
+    if (next_de(d, &de) <= 0 || d->it.off != 12 || de->d_ino!=pre_ino() ||
+	    de->d_name_len!=2 || strcmp(de->d_name, "..") ) {
+        end_dir();
         return -1;
+    }
     nlinks[de->d_ino-1]++;
-    da[da_top].pre_de=(struct xiafs_direct *)zone_buf;
-    da[da_top].cur_de=de;
     return 0;
 }
 
@@ -514,35 +461,15 @@ int get_de(struct xiafs_direct * res_de)
 {
     /* return -1 on error, 0 on EOF, else 1 */
 
+    struct da_t *d=&da[da_top];
     struct xiafs_direct *de;
+    int r;
 
-    if (da[da_top].addr != zone_addr) {
-        zone_addr=da[da_top].addr;
-	rd_zone(zone_addr, zone_buf);
-    }
-    da[da_top].pre_de=da[da_top].cur_de;
-    de=(struct xiafs_direct *)
-        ((u_char *)(da[da_top].cur_de)+da[da_top].cur_de->d_rec_len);
-    if ( (u_char *)de >= zone_buf + ZONE_SIZE ) {
-        while (da[da_top].inode.i_size > ++(da[da_top].zone) * ZONE_SIZE) {
-	    zone_addr=get_addr(&(da[da_top].inode), da[da_top].zone);
-	    rd_zone(zone_addr, zone_buf);
-	    de=(struct xiafs_direct *)zone_buf;
-	    if (de->d_ino || de->d_rec_len < ZONE_SIZE)
-	        break;
-	}
-	if (da[da_top].inode.i_size <= da[da_top].zone * ZONE_SIZE)
-	    return 0;
-	da[da_top].pre_de=de;
-	if (!de->d_ino)
-	    de=(struct xiafs_direct *)(zone_buf+de->d_rec_len);
-	da[da_top].addr=zone_addr;
-    }
-    da[da_top].cur_de=de;
-    if (de->d_rec_len < 12 || (u_char *)de+de->d_rec_len > zone_buf+ZONE_SIZE 
-	    || de->d_name_len <= 0 || de->d_name_len + 8 > de->d_rec_len 
-	    || de->d_ino < 1 || de->d_ino > NR_INODES 
-	    || de->d_name[de->d_name_len])
+    do {			/* only a zone's first entry may be unused */
+        if ((r=next_de(d, &de)) <= 0)
+	    return r;
+    } while (!de->d_ino && !d->it.off);
+    if (de->d_name_len <= 0 || de->d_ino < 1 || de->d_name[de->d_name_len])
         return -1;
     res_de->d_ino=de->d_ino;
     res_de->d_rec_len=de->d_rec_len;
@@ -553,42 +480,45 @@ int get_de(struct xiafs_direct * res_de)
 
 void rep_de()
 {
+    struct da_t *d=&da[da_top];
     struct xiafs_direct *de;
+    u_char *zp;
 
-    if (zone_addr != da[da_top].addr) {
-        zone_addr = da[da_top].addr;
-	rd_zone(zone_addr, zone_buf);
-    }
-    de=da[da_top].cur_de;
-    if ((u_char *)de==zone_buf) {
+    if (!d->it.zone)			/* a bad zone pointer */
+        return;
+    zp=get_zone(d->it.zone);
+    de=(struct xiafs_direct *)(zp + d->it.off);
+    if (!d->it.off) {
         de->d_rec_len=ZONE_SIZE;
 	de->d_ino=0;
 	de->d_name_len=0;
     } else {
-        da[da_top].pre_de->d_rec_len += zone_buf+ZONE_SIZE - (u_char *)de;
-	da[da_top].cur_de=da[da_top].pre_de;
+        ((struct xiafs_direct *)(zp + d->pre_off))->d_rec_len += 
+	  ZONE_SIZE - d->it.off;
+	d->it.off=d->pre_off;
     }
-    wt_zone(zone_addr, zone_buf);
+    d->it.next=ZONE_SIZE;		/* the rest of the zone is gone */
+    xiafs_zone_dirty(fs, d->it.zone);
 }
 
 void del_de()
 {
-    if (zone_addr != da[da_top].addr) {
-        zone_addr=da[da_top].addr;
-	rd_zone(zone_addr, zone_buf);
-    }
-    if ((u_char *)da[da_top].cur_de==zone_buf) {
-        da[da_top].cur_de->d_ino=0;
-	da[da_top].cur_de->d_name_len=0;
+    struct da_t *d=&da[da_top];
+    struct xiafs_direct *de;
+    u_char *zp;
+
+    zp=get_zone(d->it.zone);
+    de=(struct xiafs_direct *)(zp + d->it.off);
+    if (!d->it.off) {
+        de->d_ino=0;
+	de->d_name_len=0;
     } else {
-        da[da_top].pre_de->d_rec_len += da[da_top].cur_de->d_rec_len;
-	da[da_top].cur_de=da[da_top].pre_de;
+        ((struct xiafs_direct *)(zp + d->pre_off))->d_rec_len += de->d_rec_len;
+	d->it.off=d->pre_off;
     }
-    wt_zone(zone_addr, zone_buf);
+    xiafs_zone_dirty(fs, d->it.zone);
 }
 
-#define end_dir()	 (da_top--)
-
 /*------------------------------------------------------------------------
  *
  */
@@ -612,9 +542,18 @@ int test_set_zbit(int addr)
     return 0;
 }
 
+void clr_zbit(uint32_t addr)
+{
+    int bnr;
+
+    bnr=z_to_bnr(addr);
+    zmap_buf[bnr >> 3] &= ~(1 << (bnr & 7));
+}
+
 void ck_zmap()
 {
     int i, j, k, dirt;
+    u_char *zp;
     char msg[80];
 
     zmap_buf[0] |= 1;
@@ -623,26 +562,26 @@ void ck_zmap()
     if (i+1 < ZMAP_ZONES*ZONE_SIZE)
         memset(zmap_buf+i+1, 0xff, ZMAP_ZONES*ZONE_SIZE-i-1);
     for (i=0; i < ZMAP_ZONES; i++) {
-        rd_zone(1+IMAP_ZONES+i, zone_buf);
+        zp=get_zone(1+IMAP_ZONES+i);
 	dirt=0;
 	for (j=0; j < ZONE_SIZE; j++) {
-	    if (zone_buf[j]^zmap_buf[i*ZONE_SIZE+j]) {
+	    if (zp[j]^zmap_buf[i*ZONE_SIZE+j]) {
 	        for (k=0; k < 8; k++) {
-		    if ((zone_buf[j] & (1<<k)) && 
+		    if ((zp[j] & (1<<k)) && 
 			    !(zmap_buf[i*ZONE_SIZE+j] & (1<<k))) {
 		        sprintf(msg, "free zone %u (0x%X) marked as used.", 
 				(i*ZONE_SIZE+j)*8+k, (i*ZONE_SIZE+j)*8+k);
 			if (ask_rep(msg)) {
-			    zone_buf[j] &= ~(1<<k);
+			    zp[j] &= ~(1<<k);
 			    dirt=1;
 			}
 		    }
-		    if (!(zone_buf[j] & (1<<k)) && 
+		    if (!(zp[j] & (1<<k)) && 
 			      (zmap_buf[i*ZONE_SIZE+j] & (1<<k))) {
 		        sprintf(msg, "used zone %u (0x%X) marked as free.",
 				(i*ZONE_SIZE+j)*8+k, (i*ZONE_SIZE+j)*8+k);
 			if (ask_rep(msg)) {
-			    zone_buf[j] |= (1<<k);
+			    zp[j] |= (1<<k);
 			    dirt=1;
 			}
 		    }
@@ -650,7 +589,7 @@ void ck_zmap()
 	    }
 	}
 	if (dirt)
-	    wt_zone(1+IMAP_ZONES+i, zone_buf);
+	    xiafs_zone_dirty(fs, 1+IMAP_ZONES+i);
     }
 }
 
@@ -665,9 +604,8 @@ void ck_nlinks()
 
     nlinks[0]--;
     for (i=0; i < INODE_ZONES; i++) {
-        rd_zone(1+IMAP_ZONES+ZMAP_ZONES+i, zone_buf);
 	dirt=0;
-	i_pt=(struct xiafs_inode *)zone_buf;
+	i_pt=(struct xiafs_inode *)get_zone(1+IMAP_ZONES+ZMAP_ZONES+i);
 	for (j=0; j < INODES_PER_ZONE; j++) {
 	    if (nlinks[i*INODES_PER_ZONE+j] &&
 		    i_pt->i_nlinks != nlinks[i*INODES_PER_ZONE+j]) {
@@ -685,7 +623,7 @@ void ck_nlinks()
 	    i_pt++;
 	}
 	if (dirt)
-	    wt_zone(1+IMAP_ZONES+ZMAP_ZONES+i, zone_buf);
+	    xiafs_zone_dirty(fs, 1+IMAP_ZONES+ZMAP_ZONES+i);
     }
 }
       
@@ -693,6 +631,7 @@ void ck_nlinks()
 void ck_imap()
 {
     int i, j, k, dirt;
+    u_char *zp;
     char msg[80];
 
     i=(NR_INODES+1) >> 3;
@@ -708,26 +647,26 @@ void ck_imap()
 	    set_bit(i+1, imap_buf);
   
     for (i=0; i < IMAP_ZONES; i++) {
-        rd_zone(1+i, zone_buf);
+        zp=get_zone(1+i);
 	dirt=0;
 	for (j=0; j < ZONE_SIZE; j++) {
-	    if (zone_buf[j]^imap_buf[i*ZONE_SIZE+j]) {
+	    if (zp[j]^imap_buf[i*ZONE_SIZE+j]) {
 	        for (k=0; k < 8; k++) {
-		    if ((zone_buf[j] & (1<<k)) && 
+		    if ((zp[j] & (1<<k)) && 
 		            !(imap_buf[i*ZONE_SIZE+j] & (1<<k))) {
 		        sprintf(msg, "free inode %u (0x%X) marked as used.", 
 				(i*ZONE_SIZE+j)*8+k, (i*ZONE_SIZE+j)*8+k);
 			if (ask_rep(msg)) {
-			    zone_buf[j] &= ~(1<<k);
+			    zp[j] &= ~(1<<k);
 			    dirt=1;
 			}
 		    }
-		    if (!(zone_buf[j] & (1<<k)) && 
+		    if (!(zp[j] & (1<<k)) && 
 			    (imap_buf[i*ZONE_SIZE+j] & (1<<k))) {
 		        sprintf(msg, "used inode %u (0x%X) marked as free.",
 				(i*ZONE_SIZE+j)*8+k, (i*ZONE_SIZE+j)*8+k);
 			if (ask_rep(msg)) {
-			    zone_buf[j] |= (1<<k);
+			    zp[j] |= (1<<k);
 			    dirt=1;
 			}
 		    }
@@ -735,7 +674,7 @@ void ck_imap()
 	    }
 	}
 	if (dirt)
-	    wt_zone(1+i, zone_buf);
+	    xiafs_zone_dirty(fs, 1+i);
     }
 }  
 
@@ -745,164 +684,103 @@ void ck_imap()
 #define IS_ZADDR(addr) ((((addr) & 0xffffff)>=first_data_zone && \
 			 ((addr) & 0xffffff) < zones )|| !((addr) & 0xffffff))
 
-void rep_z(struct xiafs_inode * inode_pt, int i)
+void trunc_ptrs(struct xiafs_inode * inode_pt, uint32_t lblk)
 {
-    inode_pt->i_size= i * ZONE_SIZE;
-    while (i < 8)
-        inode_pt->i_zone[i++]=0;
-    inode_pt->i_zone[8]=0;
-    inode_pt->i_zone[9]=0;
-}
+    /* cut the file at zone lblk; ck_zmap() frees what it drops */
 
-void rep_indz(struct xiafs_inode * inode_pt, int i)
-{
-    inode_pt->i_size= (8+i) * ZONE_SIZE;
-    if (i <= 0) {
+    uint32_t *ind, addr, g, start, z;
+    int i;
+
+    inode_pt->i_size= lblk * ZONE_SIZE;
+    for (i=lblk; i < 8; i++)
+        inode_pt->i_zone[i] &= 0xff000000;
+    addr=inode_pt->i_zone[8] & 0xffffff;
+    if (lblk <= 8)
         inode_pt->i_zone[8]=0;
-	inode_pt->i_zone[9]=0;
-	return;
+    else if (lblk < 8+ADDR_PER_ZONE && addr && IS_ZADDR(addr)) {
+        ind=(uint32_t *)get_zone(addr);
+	memset(ind+lblk-8, 0, (8+ADDR_PER_ZONE-lblk)*sizeof(uint32_t));
+	xiafs_zone_dirty(fs, addr);
     }
-    while (i < ADDR_PER_ZONE)
-        indz_buf[i++]=0;
-    wt_zone(indz_addr, indz_buf);
-    inode_pt->i_zone[9]=0;
-}
-
-void rep_dindz(struct xiafs_inode * inode_pt, int di, int i)
-{
-    inode_pt->i_size= (8+ (1+di) * ADDR_PER_ZONE + i) * ZONE_SIZE; 
-    if (di <= 0) {
+    addr=inode_pt->i_zone[9] & 0xffffff;
+    if (lblk <= 8+ADDR_PER_ZONE) {
         inode_pt->i_zone[9]=0;
 	return;
     }
-    if (i <= 0) 
-        dindz_buf[di]=0;
-    else {    
-        while (i < ADDR_PER_ZONE) 
-	    indz_buf[i++]=0;
-	wt_zone(indz_addr, indz_buf);
+    if (!addr || !IS_ZADDR(addr))
+        return;
+    g=(lblk-8-ADDR_PER_ZONE) / ADDR_PER_ZONE;
+    start=8+(1+g)*ADDR_PER_ZONE;
+    if (start < lblk) {				/* keep the head of group g */
+        z=((uint32_t *)get_zone(addr))[g];
+	if (z && IS_ZADDR(z)) {
+	    ind=(uint32_t *)get_zone(z);
+	    memset(ind+lblk-start, 0,
+		   (start+ADDR_PER_ZONE-lblk)*sizeof(uint32_t));
+	    xiafs_zone_dirty(fs, z);
+	}
+	g++;
     }
-    while (++di < ADDR_PER_ZONE)
-        dindz_buf[di]=0;
-    wt_zone(dindz_addr, dindz_buf);
+    ind=(uint32_t *)get_zone(addr);
+    memset(ind+g, 0, (ADDR_PER_ZONE-g)*sizeof(uint32_t));
+    xiafs_zone_dirty(fs, addr);
 }
 
 int ck_addr(struct xiafs_inode * inode_pt, int *dirt_flag)
 {
     /* return 0 if no error or repaired, -1 if error found but no repair */
 
-    int nr_zone, nr_ind, nr_dind, tmp;
-    int i, di;
-    uint32_t addr;
+    struct xiafs_bmap_iter it;
+    struct xiafs_run run;
+    uint32_t i, lblk, meta[2], meta_lblk=0;
+    int r, n_meta=0;
     int d_blocks, st_blocks=0;
     char msg_cnfz[]="Conflict zone use.";
     char msg_badz[]="Bad zone pointer.";
     char msg_uxp_badz[]="Bad zone pointer (unexpected error).";
-    char msg_block[120];
-
-    nr_zone=(inode_pt->i_size + ZONE_SIZE -1) / ZONE_SIZE;
-    tmp=(nr_zone > 8) ? 8 : nr_zone;
-    for (i=0; i < tmp; i++) {
-        addr=inode_pt->i_zone[i] & 0xffffff;
-	if (addr)
-	    st_blocks++;
-	if ( !IS_ZADDR(addr) || test_set_zbit(addr) ) {
-	    if (ask_rep( IS_ZADDR(addr) ? msg_cnfz : msg_uxp_badz)) {
-	        rep_z(inode_pt, i);
-		*dirt_flag=1;
-		return 0;
-	    } else 
-	        return -1;
-	} 
-    }
-    nr_zone -= tmp;
-    if (!nr_zone)
-        goto block_ck;
-    nr_ind=(nr_zone > ADDR_PER_ZONE) ? ADDR_PER_ZONE : nr_zone;
-    addr=inode_pt->i_zone[8] & 0xffffff;
-    if ( !IS_ZADDR(addr) || test_set_zbit(addr) ) {	/* test indz */
-        if (ask_rep( IS_ZADDR(addr) ? msg_cnfz : msg_uxp_badz)) {	
-	    rep_indz(inode_pt, 0);
-	    *dirt_flag=1;
-	    return 0;
-	} else
-	    return -1;
-    }
-    if (addr) {
-        st_blocks++;
-        if (indz_addr != addr) {		/* indz is fine and not a big hole */
-	    indz_addr=addr;			/* load indirect zone ptrs */
-	    rd_zone(indz_addr, indz_buf);
-	}
-	for (i=0; i < nr_ind; i++) {		/* test indirect zone ptrs */
-	    addr=indz_buf[i];
-	    if (addr)
-	        st_blocks++;
-	    if ( !IS_ZADDR(addr) || test_set_zbit(addr) ) {
-	        if (ask_rep( IS_ZADDR(addr) ? msg_cnfz : msg_badz) ) {
-		    rep_indz(inode_pt, i);
-		    *dirt_flag=1;
-		    return 0;
-		} else 
-		    return -1;
+    char *msg, msg_block[120];
+
+    xiafs_bmap_init(&it, fs, inode_pt, XIAFS_BMAP_META);
+    while ((r=xiafs_bmap_next(&it, &run)) > 0) {
+        for (i=0; i < run.r_len; i++)
+	    if ((run.r_flags & XIAFS_RUN_BAD) || test_set_zbit(run.r_zone+i))
+	        break;
+	st_blocks += i;
+	if (i == run.r_len) {
+	    /*
+	     * an indirect zone comes just before the zones it maps, and
+	     * the double indirect one and its first group share an lblk;
+	     * keep the last of them in case the zone after them is bad
+	     */
+	    if (run.r_flags & XIAFS_RUN_META) {
+	        if (meta_lblk != run.r_lblk)
+		    n_meta=0;
+		meta_lblk=run.r_lblk;
+		meta[n_meta++]=run.r_zone;
 	    }
-	}
-    }
-    nr_zone -= nr_ind;
-    if (!nr_zone)
-        goto block_ck;
-    nr_ind=nr_zone & (ADDR_PER_ZONE -1);
-    nr_dind=(nr_zone + ADDR_PER_ZONE -1 )/ ADDR_PER_ZONE - 1;
-    if (!nr_ind)
-        nr_ind=ADDR_PER_ZONE;
-    addr=inode_pt->i_zone[9] & 0xffffff;
-    if (!IS_ZADDR(addr) || test_set_zbit(addr) ) {
-        if (ask_rep( IS_ZADDR(addr) ? msg_cnfz : msg_uxp_badz) ) {
-	    rep_dindz(inode_pt, 0, 0);
-	    *dirt_flag=1;
-	    return 0;
-	} else
-	    return -1;
-    }
-    if (!addr)
-        goto block_ck;				/* a big hole */
-    st_blocks++;
-    if (dindz_addr != addr) {
-        dindz_addr=addr;
-	rd_zone(addr, dindz_buf);
-    }
-    for (di=0; di <= nr_dind; di++ ) {
-        addr=dindz_buf[di];
-	if ( !IS_ZADDR(addr) || test_set_zbit(addr) ) {
-	    if (ask_rep(IS_ZADDR(addr) ? msg_cnfz : msg_badz) ) {
-	        rep_dindz(inode_pt, di, 0);
-		*dirt_flag=1;
-		return 0;
-	    } else
-	        return -1;
-	}
-	if (!addr)
 	    continue;
-	st_blocks++;
-	if (indz_addr != addr) {
-	    indz_addr=addr;
-	    rd_zone(addr, indz_buf);
 	}
-	for (i=0; i < (di==nr_dind ? nr_ind : ADDR_PER_ZONE); i++) {
-	    addr=indz_buf[i];
-	    if (addr)
-	        st_blocks++;
-	    if ( !IS_ZADDR(addr) || test_set_zbit(addr) ) {
-	        if (ask_rep( IS_ZADDR(addr) ? msg_cnfz : msg_badz) ) {
-		    rep_dindz(inode_pt, di, i);
-		    *dirt_flag=1;
-		    return 0;
-		} else 
-		    return -1;
+	lblk=(run.r_flags & XIAFS_RUN_META) ? run.r_lblk : run.r_lblk+i;
+	if (!(run.r_flags & XIAFS_RUN_BAD))
+	    msg=msg_cnfz;
+	else if (lblk < 8 || ((run.r_flags & XIAFS_RUN_META) &&
+		 (lblk == 8 || (lblk == 8+ADDR_PER_ZONE && meta_lblk != lblk))))
+	    msg=msg_uxp_badz;		/* i_zone[] itself, not an indirect zone */
+	else
+	    msg=msg_badz;
+	if (!ask_rep(msg))
+	    return -1;
+	if (n_meta && meta_lblk == lblk)	/* nothing left for them to map */
+	    while (n_meta) {
+	        clr_zbit(meta[--n_meta]);
+		st_blocks--;
 	    }
-	}
+	trunc_ptrs(inode_pt, lblk);
+	*dirt_flag=1;
+	break;
     }
-block_ck:
+    if (r < 0)
+        die("reading device failed");
     st_blocks <<= 1 + zone_shift;
     d_blocks=((inode_pt->i_zone[0] >> 24) & 0xff) |
       ((inode_pt->i_zone[1] >> 16) & 0xff00) | ((inode_pt->i_zone[2] >> 8) & 0xff0000);
@@ -916,6 +794,183 @@ block_ck:
     return 0;
 }
 
+/*------------------------------------------------------------------------
+ * directory compaction. Live entries are packed from the start of the
+ * directory, dead records are dropped, and the zones no longer needed
+ * are given back both in zmap_buf and in the zmap on disk, so ck_zmap()
+ * has nothing to complain about afterwards.
+ */
+int    compact_dirs=0;		/* directories compacted */
+long   compact_bytes=0;		/* bytes reclaimed */
+
+void free_zone(uint32_t addr)
+{
+    clr_zbit(addr);
+    if (xiafs_set_zone_used(fs, addr, 0) < 0)
+        die("write device failed.");
+}
+
+int trunc_dir(struct xiafs_inode *ip, int new_nz, int nz, uint32_t *gone)
+{
+    /* 
+     * return the number of zones dropped, pointer zones included, with
+     * their numbers in gone[]; they are freed once the pointers are fixed
+     */
+
+    uint32_t *ind, *dind, addr, z;
+    int i, di, lo, first, last, start, end, freed=0;
+
+    for (i=new_nz; i < nz && i < 8; i++) {
+        if ((addr=ip->i_zone[i] & 0xffffff))
+	    gone[freed++]=addr;
+	ip->i_zone[i] &= 0xff000000;
+    }
+    if (nz > 8 && (addr=ip->i_zone[8] & 0xffffff)) {
+        ind=(uint32_t *)get_zone(addr);
+	for (i=(new_nz > 8 ? new_nz-8 : 0); i < nz-8 && i < ADDR_PER_ZONE; i++)
+	    if (ind[i]) {
+	        gone[freed++]=ind[i];
+		ind[i]=0;
+	    }
+	if (new_nz <= 8) {
+	    gone[freed++]=addr;
+	    ip->i_zone[8] &= 0xff000000;
+	} else
+	    xiafs_zone_dirty(fs, addr);
+    }
+    if (nz > 8+ADDR_PER_ZONE && (addr=ip->i_zone[9] & 0xffffff)) {
+        first=new_nz-8-ADDR_PER_ZONE;
+	if (first < 0)
+	    first=0;
+	last=nz-8-ADDR_PER_ZONE;
+	for (di=first / ADDR_PER_ZONE; di*ADDR_PER_ZONE < last; di++) {
+	    dind=(uint32_t *)get_zone(addr);
+	    if (!(z=dind[di]))
+	        continue;
+	    lo=di*ADDR_PER_ZONE;
+	    start=(first > lo ? first : lo) - lo;
+	    end=(last < lo+ADDR_PER_ZONE ? last : lo+ADDR_PER_ZONE) - lo;
+	    if (!start) {
+	        gone[freed++]=z;
+		dind[di]=0;
+	    }
+	    ind=(uint32_t *)get_zone(z);
+	    for (i=start; i < end; i++)
+	        if (ind[i]) {
+		    gone[freed++]=ind[i];
+		    ind[i]=0;
+		}
+	    if (start)
+	        xiafs_zone_dirty(fs, z);
+	}
+	if (!first) {
+	    gone[freed++]=addr;
+	    ip->i_zone[9] &= 0xff000000;
+	} else
+	    xiafs_zone_dirty(fs, addr);
+    }
+    return freed;
+}
+
+int compact_dir(struct xiafs_inode *ip)
+{
+    /* return 1 if the inode was changed */
+
+    struct xiafs_direct *de, *last=NULL;
+    struct xiafs_bmap_iter it;
+    struct xiafs_run run;
+    u_char *old, *new, *p, *end, *zp, *out;
+    uint32_t *addrs, *gone, j;
+    int nz, new_nz, i, r, len, freed, blocks, changed=0;
+
+    nz=ip->i_size / ZONE_SIZE;
+    if (nz <= 0)
+        return 0;
+    old=(u_char *)malloc(nz * ZONE_SIZE);
+    new=(u_char *)calloc(nz, ZONE_SIZE);
+    addrs=(uint32_t *)malloc(nz * sizeof(uint32_t));
+    gone=(uint32_t *)malloc((2*nz + 2) * sizeof(uint32_t));
+    if (!old || !new || !addrs || !gone)
+        die("allocate memory failed.");
+
+    xiafs_bmap_init(&it, fs, ip, XIAFS_BMAP_HOLES);
+    for (i=0; (r=xiafs_bmap_next(&it, &run)) > 0; ) {
+        if (!run.r_zone || (run.r_flags & XIAFS_RUN_BAD))
+	    goto done;				/* a hole, leave it alone */
+	for (j=0; j < run.r_len; j++, i++) {
+	    addrs[i]=run.r_zone + j;
+	    memcpy(old + i*ZONE_SIZE, get_zone(addrs[i]), ZONE_SIZE);
+	}
+    }
+    if (r < 0)
+        die("reading device failed");
+
+    zp=out=new;
+    for (i=0; i < nz; i++) {
+        p=old + i*ZONE_SIZE;
+	end=p + ZONE_SIZE;
+	for (; p < end; p += de->d_rec_len) {
+	    de=(struct xiafs_direct *)p;
+	    if (de->d_rec_len < 12 || p + de->d_rec_len > end)
+	        goto done;
+	    if (!de->d_ino)
+	        continue;
+	    len=RNDUP(de->d_name_len) + 8;
+	    if (len > de->d_rec_len)
+	        goto done;
+	    if (out + len > zp + ZONE_SIZE) {	/* last entry fills its zone */
+	        last->d_rec_len += zp + ZONE_SIZE - out;
+		zp += ZONE_SIZE;
+		out=zp;
+	    }
+	    memcpy(out, de, 7 + de->d_name_len);
+	    last=(struct xiafs_direct *)out;
+	    last->d_rec_len=len;
+	    out += len;
+	}
+    }
+    if (!last)
+        goto done;
+    last->d_rec_len += zp + ZONE_SIZE - out;
+    new_nz=(zp - new) / ZONE_SIZE + 1;
+
+    for (i=0; i < new_nz; i++)
+        if (memcmp(old + i*ZONE_SIZE, new + i*ZONE_SIZE, ZONE_SIZE)) {
+	    memcpy(get_zone(addrs[i]), new + i*ZONE_SIZE, ZONE_SIZE);
+	    xiafs_zone_dirty(fs, addrs[i]);
+	    changed=1;
+	}
+    if (new_nz < nz) {
+	freed=trunc_dir(ip, new_nz, nz, gone);
+	for (i=0; i < freed; i++)
+	    free_zone(gone[i]);
+	blocks=((ip->i_zone[0] >> 24) & 0xff) |
+	  ((ip->i_zone[1] >> 16) & 0xff00) | ((ip->i_zone[2] >> 8) & 0xff0000);
+	blocks -= freed << (1 + zone_shift);
+	if (blocks < 0)
+	    blocks=0;
+	ip->i_zone[0]=(ip->i_zone[0] & 0xffffff) | ((blocks << 24) & 0xff000000);
+	ip->i_zone[1]=(ip->i_zone[1] & 0xffffff) | ((blocks << 16) & 0xff000000);
+	ip->i_zone[2]=(ip->i_zone[2] & 0xffffff) | ((blocks <<  8) & 0xff000000);
+	ip->i_size=new_nz * ZONE_SIZE;
+	compact_bytes += freed * ZONE_SIZE;
+	changed=1;
+    }
+    if (changed) {
+	print_path();
+	printf("---- Directory compacted, %d -> %d zones.\n\n", nz, new_nz);
+        compact_dirs++;
+	xiafs_dirt=1;
+    }
+
+done:
+    free(old);
+    free(new);
+    free(addrs);
+    free(gone);
+    return changed;
+}
+
 /*------------------------------------------------------------------------
  * check file, return 0 mean do not delete, -1 to delete.
  */
@@ -942,12 +997,22 @@ int ck_file(struct xiafs_direct *dir_pt)
 	return tmp;
     }
 
-    if ( ck_addr(&inode, &inode_dirt) ) {
+    if (IS_FAST_SYMLINK(&inode)) {		/* target is in i_zone */
+        char *cp=(char *)inode.i_zone;
+
+        if (strnlen(cp, _XIAFS_FAST_SYMLINK_SIZE) != inode.i_size) {
+	    tmp=ask_rep("Bad fast symlink.");
+	    pop_de();
+	    return tmp;
+	}
+    } else if ( ck_addr(&inode, &inode_dirt) ) {
         pop_de();
 	return 0;				/* error found, no repair */
     }
   
     if (S_ISDIR(inode.i_mode)) {		/* recursive check */
+        int dir_ok=1;
+
 	if ( start_dir(&inode) ) {
 	    tmp=ask_rep("Bad directory.");
 	    pop_de();
@@ -956,9 +1021,11 @@ int ck_file(struct xiafs_direct *dir_pt)
 
 	while ( (tmp=get_de(&de)) ) {
 	    if (tmp < 0) {
-	        if (ask_rep("Bad directory entry."))
+	        dir_ok=0;
+	        if (ask_rep("Bad directory entry.")) {
 		    rep_de();
-		else {
+		    continue;
+		} else {
 		    end_dir();
 		    pop_de();
 		    return 0;
@@ -971,6 +1038,8 @@ int ck_file(struct xiafs_direct *dir_pt)
 	    }
 	}
 	end_dir();
+	if (compact && dir_ok && compact_dir(&inode))	/* only sane ones */
+	    inode_dirt=1;
     }
 
     if (inode_dirt)
@@ -1009,8 +1078,7 @@ void do_read_kern()
   i = sp->s_firstkernzone;
   end = i + sp->s_kernzones;
   for (; i < end; i++) {
-      rd_zone(i, zone_buf);
-      if ( write(1, zone_buf, ZONE_SIZE) != ZONE_SIZE )
+      if ( write(1, get_zone(i), ZONE_SIZE) != ZONE_SIZE )
 	  die("write stdout failed");
   }
 }
@@ -1028,11 +1096,9 @@ void init_buf(int step)
   if (step==1) {
     zmap_buf=(u_char *)calloc( 1, ZMAP_ZONES * ZONE_SIZE );
     nlinks=(uint16_t *)calloc(1, NR_INODES*2 );
-    indz_buf=(uint32_t *)malloc(ZONE_SIZE);
-    dindz_buf=(uint32_t *)malloc(ZONE_SIZE);
-    if (!zmap_buf|| !nlinks|| !indz_buf|| !dindz_buf) {
-      sprintf((char *)zone_buf, "allocate memory failed (%lu KB needed).",
-	      (ZMAP_ZONES*ZONE_SIZE+2*(NR_INODES+ZONE_SIZE)) >> 10);
+    if (!zmap_buf|| !nlinks) {
+      sprintf((char *)zone_buf, "allocate memory failed (%u KB needed).",
+	      (ZMAP_ZONES*ZONE_SIZE+2*NR_INODES) >> 10);
       die((char *)zone_buf);
     }
   }
@@ -1046,6 +1112,7 @@ struct termios term_org, term_raw;
 void clr_up()
 {
   tcsetattr(0, TCSANOW, &term_org);
+  xiafs_flush(fs);			/* keep what has been repaired */
   die("Killed by signal.");
 }
   
@@ -1056,9 +1123,10 @@ int main(int argc, char *argv[])
   extern int optind;
   
   pgm_name=argv[0];
-  while ((c=getopt(argc, argv, "akrs")) != EOF) {
+  while ((c=getopt(argc, argv, "ackrs")) != EOF) {
     switch (c) {
     case 'a': auto_rep=1; break;
+    case 'c': compact=1; break;
     case 'k': read_kern=1; break;
     case 'r': rep=1; break;
     case 's': show_sup=1; break;
@@ -1067,16 +1135,20 @@ int main(int argc, char *argv[])
   }
   if (auto_rep+rep+show_sup+read_kern > 1) 
     usage();
-  if (getuid() && (auto_rep+rep))
+  if (compact && (show_sup || read_kern))
+    usage();
+  if (getuid() && (auto_rep+rep+compact))
     die("repair can only be done by root");
   if (optind+1 != argc)
     usage();
 
-  if ( (dev=open(argv[optind], (auto_rep || rep) ? O_RDWR : O_RDONLY)) < 0)
+  if ( (dev=open(argv[optind], (auto_rep || rep || compact) ? O_RDWR : O_RDONLY)) < 0)
     die("opening device fail");
 
   init_buf(0);
   ck_sup_zone();
+  if (!(fs=xiafs_fdopen(dev, (auto_rep || rep || compact) ? XIAFS_OPEN_RDWR : 0)))
+    die("reading device failed");
 
   if (show_sup) {
     show_sup_zone();
@@ -1123,6 +1195,12 @@ int main(int argc, char *argv[])
 
   if (raw_term)
     tcsetattr(0, TCSANOW, &term_org);
+  if (xiafs_close(fs))
+    die("write device failed.");
+
+  if (compact)
+    printf("%d director%s compacted, %ld bytes reclaimed.\n", compact_dirs,
+	   compact_dirs == 1 ? "y" : "ies", compact_bytes);
 
   if (xiafs_dirt)
     fprintf(stderr, "\nThe file system has been modified.\n\n"); 
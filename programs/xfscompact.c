@@ -0,0 +1,86 @@
+/*
+ * xfscompact.c - compact directories on a mounted xiafs file system
+ */
+/*
+ * Usage: xfscompact [-q] directory ...
+ *
+ *	-q    quiet, only report errors.
+ *
+ * Each directory is packed by the kernel with the XIAFS_IOC_COMPACT_DIR
+ * ioctl: dead entries are dropped, the live ones are moved to the front,
+ * and the zones left over at the end are freed. Use xfsck -c to do the
+ * same thing to every directory of an unmounted file system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include "xia_fs.h"
+
+char *pgm;			/* program name */
+int quiet=0;
+
+void usage()
+{
+  fprintf(stderr, "usage: %s [-q] directory ...\n", pgm);
+  exit(1);
+}
+
+int compact(char *path, uint64_t *total)
+{
+  struct xiafs_dir_compact dc;
+  int fd;
+
+  if ((fd=open(path, O_RDONLY | O_DIRECTORY)) < 0) {
+    fprintf(stderr, "%s: %s: %s\n", pgm, path, strerror(errno));
+    return -1;
+  }
+  if (ioctl(fd, XIAFS_IOC_COMPACT_DIR, &dc) < 0) {
+    fprintf(stderr, "%s: %s: %s\n", pgm, path, 
+	    errno == ENOTTY ? "not on a xiafs file system" : strerror(errno));
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  *total += dc.dc_reclaimed;
+  if (!quiet)
+    printf("%s: %u entries, %u dead records dropped, %llu -> %llu bytes, "
+	   "%llu bytes reclaimed\n", path, dc.dc_live, dc.dc_dead,
+	   (unsigned long long)dc.dc_old_size, 
+	   (unsigned long long)dc.dc_new_size,
+	   (unsigned long long)dc.dc_reclaimed);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  uint64_t total=0;
+  int opt, i, err=0;
+
+  pgm=argv[0];
+  while ((opt=getopt(argc, argv, "q")) != EOF) {
+    switch (opt) {
+    case 'q':
+      quiet=1;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind >= argc)
+    usage();
+
+  for (i=optind; i < argc; i++)
+    if (compact(argv[i], &total))
+      err=1;
+  if (!quiet && argc - optind > 1)
+    printf("total: %llu bytes reclaimed\n", (unsigned long long)total);
+
+  exit(err);
+}
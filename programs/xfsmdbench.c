@@ -0,0 +1,327 @@
+/*
+ * xfsmdbench.c - multithreaded metadata benchmark for a mounted xiafs
+ */
+/*
+ * Usage: xfsmdbench [-s] [-t threads] [-n files] [-p files] [-l lists]
+ *                   [-w bytes] [-k] directory
+ *
+ *	-s    all threads work in one shared directory, instead of one each.
+ *	-t    number of threads (default 1).
+ *	-n    files each thread creates, stats, renames and unlinks
+ *	      (default 1000).
+ *	-p    files to put in each directory beforehand, untimed, so the
+ *	      timed operations have a big directory to search (default 0).
+ *	-l    times each thread lists its directory (default 10).
+ *	-w    bytes to write to each file when it's created (default 0).
+ *	-k    keep the directories afterwards.
+ *
+ * The threads go through the phases (create, stat, list, rename, unlink)
+ * together: none starts a phase until all have finished the one before.
+ * For each phase it reports operations per second over all threads, from
+ * the start of the phase to the last thread finishing it, and the 50th,
+ * 99th and 99.9th percentile times of single operations. A list is one
+ * whole opendir/readdir/closedir of the directory.
+ *
+ * Nothing here is xiafs specific, so the same runs can be done on other
+ * file systems to compare. Mount with -o dirsync to see its cost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define PATHLEN 4200
+
+enum { CREATE, STAT, LIST, RENAME, UNLINK, NR_PHASES };
+
+static const char *phase_names[NR_PHASES] = {
+  "create", "stat", "list", "rename", "unlink"
+};
+
+char *pgm;			/* program name */
+char *top;			/* <directory>/xfsmdbench.<pid> */
+int nthreads=1, nfiles=1000, nprefill=0, nlists=10, wsize=0;
+int shared=0, keep=0;
+char *wbuf;
+pthread_barrier_t barrier;
+
+struct worker {
+  pthread_t tid;
+  int id;
+  char dir[PATHLEN - 100];
+  uint64_t *lat[NR_PHASES];	/* ns, one per operation */
+  int nops[NR_PHASES];
+};
+
+void usage()
+{
+  fprintf(stderr,
+	  "usage: %s [-s] [-t threads] [-n files] [-p files] [-l lists] "
+	  "[-w bytes] [-k] directory\n", pgm);
+  exit(1);
+}
+
+void die(char *what, char *path)
+{
+  fprintf(stderr, "%s: %s %s: %s\n", pgm, what, path, strerror(errno));
+  exit(1);
+}
+
+static uint64_t now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void create_file(char *path)
+{
+  int fd;
+
+  if ((fd=open(path, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0)
+    die("create", path);
+  if (wsize && write(fd, wbuf, wsize) != wsize)
+    die("write", path);
+  close(fd);
+}
+
+static void list_dir(char *path)
+{
+  DIR *d;
+
+  if (!(d=opendir(path)))
+    die("opendir", path);
+  errno=0;
+  while (readdir(d))
+    ;
+  if (errno)
+    die("readdir", path);
+  closedir(d);
+}
+
+/* Names are unique across threads, so a shared directory works too. */
+static void name(char *buf, struct worker *w, const char *kind, int i)
+{
+  snprintf(buf, PATHLEN, "%s/%s%d.%d", w->dir, kind, w->id, i);
+}
+
+static void do_phase(struct worker *w, int phase)
+{
+  char path[PATHLEN], path2[PATHLEN];
+  struct stat st;
+  uint64_t t;
+  int i;
+
+  for (i=0; i < w->nops[phase]; i++) {
+    name(path, w, phase < RENAME ? "f" : "r", i);
+    t=now();
+    switch (phase) {
+    case CREATE:
+      create_file(path);
+      break;
+    case STAT:
+      if (stat(path, &st) < 0)
+	die("stat", path);
+      break;
+    case LIST:
+      list_dir(w->dir);
+      break;
+    case RENAME:
+      name(path2, w, "f", i);
+      if (rename(path2, path) < 0)
+	die("rename", path2);
+      break;
+    case UNLINK:
+      if (unlink(path) < 0)
+	die("unlink", path);
+      break;
+    }
+    w->lat[phase][i]=now() - t;
+  }
+}
+
+void *worker(void *arg)
+{
+  struct worker *w=arg;
+  int phase;
+
+  for (phase=0; phase < NR_PHASES; phase++) {
+    pthread_barrier_wait(&barrier);
+    do_phase(w, phase);
+    pthread_barrier_wait(&barrier);
+  }
+  return NULL;
+}
+
+/* Untimed: make a directory's worth of files, or get rid of them. */
+static void prefill(char *dir, int id, int remove)
+{
+  char path[PATHLEN];
+  int i;
+
+  for (i=0; i < nprefill; i++) {
+    snprintf(path, sizeof(path), "%s/p%d.%d", dir, id, i);
+    if (remove) {
+      if (unlink(path) < 0)
+	die("unlink", path);
+    } else
+      create_file(path);
+  }
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x=*(const uint64_t *)a, y=*(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static double pct(uint64_t *v, long n, int permille)
+{
+  long i=(n * permille + 999) / 1000;
+
+  return n ? v[i ? i - 1 : 0] / 1000.0 : 0;
+}
+
+static void report(struct worker *ws, uint64_t *elapsed)
+{
+  uint64_t *all;
+  long n, total;
+  int phase, i;
+
+  total=(long)nthreads * (nfiles > nlists ? nfiles : nlists);
+  if (!(all=malloc(total * sizeof(uint64_t)))) {
+    fprintf(stderr, "%s: out of memory\n", pgm);
+    exit(1);
+  }
+  printf("%d thread%s, %d files each, %s director%s, %d prefilled\n",
+	 nthreads, nthreads == 1 ? "" : "s", nfiles,
+	 shared ? "one shared" : "private", shared ? "y" : "ies", nprefill);
+  printf("%-8s %10s %10s %12s %10s %10s %10s\n", "phase", "ops", "secs",
+	 "ops/sec", "p50 us", "p99 us", "p99.9 us");
+  for (phase=0; phase < NR_PHASES; phase++) {
+    n=0;
+    for (i=0; i < nthreads; i++) {
+      memcpy(all + n, ws[i].lat[phase], ws[i].nops[phase] * sizeof(uint64_t));
+      n += ws[i].nops[phase];
+    }
+    qsort(all, n, sizeof(uint64_t), cmp_u64);
+    printf("%-8s %10ld %10.3f %12.0f %10.1f %10.1f %10.1f\n",
+	   phase_names[phase], n, elapsed[phase] / 1e9,
+	   elapsed[phase] ? n * 1e9 / elapsed[phase] : 0,
+	   pct(all, n, 500), pct(all, n, 990), pct(all, n, 999));
+  }
+  free(all);
+}
+
+int main(int argc, char *argv[])
+{
+  uint64_t elapsed[NR_PHASES], t;
+  struct worker *ws;
+  char *endp;
+  int opt, i, phase, err;
+
+  pgm=argv[0];
+  while ((opt=getopt(argc, argv, "st:n:p:l:w:k")) != EOF) {
+    switch (opt) {
+    case 's':
+      shared=1;
+      break;
+    case 't':
+    case 'n':
+    case 'p':
+    case 'l':
+    case 'w':
+      i=strtol(optarg, &endp, 0);
+      if (*endp || i < 0)
+	usage();
+      switch (opt) {
+      case 't': nthreads=i; break;
+      case 'n': nfiles=i; break;
+      case 'p': nprefill=i; break;
+      case 'l': nlists=i; break;
+      case 'w': wsize=i; break;
+      }
+      break;
+    case 'k':
+      keep=1;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc - 1 || nthreads < 1)
+    usage();
+
+  if (!(top=malloc(strlen(argv[optind]) + 32)) ||
+      !(ws=calloc(nthreads, sizeof(*ws))) ||
+      !(wbuf=calloc(1, wsize + 1))) {
+    fprintf(stderr, "%s: out of memory\n", pgm);
+    exit(1);
+  }
+  sprintf(top, "%s/xfsmdbench.%d", argv[optind], (int)getpid());
+  if (mkdir(top, 0755) < 0)
+    die("mkdir", top);
+
+  for (i=0; i < nthreads; i++) {
+    struct worker *w=&ws[i];
+
+    w->id=i;
+    if (shared)
+      snprintf(w->dir, sizeof(w->dir), "%s", top);
+    else {
+      snprintf(w->dir, sizeof(w->dir), "%s/t%d", top, i);
+      if (mkdir(w->dir, 0755) < 0)
+	die("mkdir", w->dir);
+    }
+    if (!shared || !i)
+      prefill(w->dir, i, 0);
+    for (phase=0; phase < NR_PHASES; phase++) {
+      w->nops[phase]=phase == LIST ? nlists : nfiles;
+      if (!(w->lat[phase]=calloc(w->nops[phase] + 1, sizeof(uint64_t)))) {
+	fprintf(stderr, "%s: out of memory\n", pgm);
+	exit(1);
+      }
+    }
+  }
+  sync();
+
+  pthread_barrier_init(&barrier, NULL, nthreads + 1);
+  for (i=0; i < nthreads; i++)
+    if ((err=pthread_create(&ws[i].tid, NULL, worker, &ws[i]))) {
+      errno=err;
+      die("pthread_create", "");
+    }
+  for (phase=0; phase < NR_PHASES; phase++) {
+    pthread_barrier_wait(&barrier);
+    t=now();
+    pthread_barrier_wait(&barrier);
+    elapsed[phase]=now() - t;
+  }
+  for (i=0; i < nthreads; i++)
+    pthread_join(ws[i].tid, NULL);
+
+  report(ws, elapsed);
+
+  if (!keep) {
+    for (i=0; i < nthreads; i++) {
+      if (!shared || !i)
+	prefill(ws[i].dir, i, 1);
+      if (!shared && rmdir(ws[i].dir) < 0)
+	die("rmdir", ws[i].dir);
+    }
+    if (rmdir(top) < 0)
+      die("rmdir", top);
+  }
+  exit(0);
+}